@@ -0,0 +1,191 @@
+// compares the bvh against brute force culling and picking on random boxes
+// usage: BvhBenchmark [objectCount]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../Classes/Bvh.h"
+#include "../Classes/FrustumCuller.h"
+#include "../Classes/ThreadPool.h"
+
+namespace
+{
+	static inline constexpr const float WORLD_SIZE = 1000.f;
+	static inline constexpr const int REPEAT_COUNT = 10;
+	static inline constexpr const int RAY_COUNT = 1000;
+
+	// average milliseconds of REPEAT_COUNT runs
+	template <typename Function>
+	double measure(Function function)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (auto i = 0; i < REPEAT_COUNT; i++)
+		{
+			function();
+		}
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / REPEAT_COUNT;
+	}
+
+	bool isInsideFrustum(const BoundingBox& box, const glm::vec4* planes)
+	{
+		for (auto p = 0; p < 6; p++)
+		{
+			glm::vec3 positive{ planes[p].x >= 0.f ? box.max.x : box.min.x, planes[p].y >= 0.f ? box.max.y : box.min.y, planes[p].z >= 0.f ? box.max.z : box.min.z };
+			if (glm::dot(glm::vec3(planes[p]), positive) + planes[p].w < 0.f)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool intersectRay(const BoundingBox& box, const glm::vec3& origin, const glm::vec3& inverseDirection, float& distance)
+	{
+		auto t0 = (box.min - origin) * inverseDirection;
+		auto t1 = (box.max - origin) * inverseDirection;
+		auto tNear = glm::min(t0, t1);
+		auto tFar = glm::max(t0, t1);
+
+		distance = std::max({ tNear.x, tNear.y, tNear.z, 0.f });
+		return distance <= std::min({ tFar.x, tFar.y, tFar.z });
+	}
+}
+
+int main(int argc, char** argv)
+{
+	auto objectCount = argc > 1 ? std::max(1u, static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10))) : 100000u;
+
+	// deterministic scene, boxes of 0.5 to 5 units spread over the world
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-WORLD_SIZE * 0.5f, WORLD_SIZE * 0.5f);
+	std::uniform_real_distribution<float> size(0.5f, 5.f);
+
+	std::vector<BoundingBox> boxes(objectCount);
+	for (auto& box : boxes)
+	{
+		glm::vec3 center{ position(random), position(random), position(random) };
+		glm::vec3 extent{ size(random), size(random), size(random) };
+		box = { center - extent * 0.5f, center + extent * 0.5f };
+	}
+
+	ThreadPool threadPool;
+	threadPool.init();
+
+	std::printf("objects: %u, threads: %u\n\n", objectCount, threadPool.getThreadCount());
+
+	// build
+	Bvh bvh;
+	auto serialBuild = measure([&] { bvh.build(boxes, nullptr); });
+	auto parallelBuild = measure([&] { bvh.build(boxes, &threadPool); });
+	std::printf("build serial      %9.3f ms\n", serialBuild);
+	std::printf("build parallel    %9.3f ms  (%zu nodes of %zu bytes)\n", parallelBuild, bvh.getNodes().size(), sizeof(Bvh::Node));
+
+	// refit after moving 1% of the boxes
+	std::uniform_int_distribution<uint32_t> pick(0, objectCount - 1);
+	auto refit = measure([&]
+	{
+		for (uint32_t i = 0; i < objectCount / 100; i++)
+		{
+			auto index = pick(random);
+			boxes[index].min.y += 1.f;
+			boxes[index].max.y += 1.f;
+			bvh.updatePrimitive(index, boxes[index]);
+		}
+		bvh.refit();
+	});
+	std::printf("refit 1%% moved   %9.3f ms\n\n", refit);
+
+	// frustum from the world center
+	auto projection = glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, WORLD_SIZE * 0.5f);
+	auto view = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, 1.f), glm::vec3(0.f, 1.f, 0.f));
+	glm::vec4 planes[6];
+	FrustumCuller::extractPlanes(projection * view, planes);
+
+	std::vector<uint32_t> bruteForceVisible;
+	auto bruteForce = measure([&]
+	{
+		bruteForceVisible.clear();
+		for (uint32_t i = 0; i < objectCount; i++)
+		{
+			if (isInsideFrustum(boxes[i], planes))
+			{
+				bruteForceVisible.push_back(i);
+			}
+		}
+	});
+
+	FrustumCuller frustumCuller;
+	frustumCuller.resize(objectCount);
+	for (uint32_t i = 0; i < objectCount; i++)
+	{
+		auto center = (boxes[i].min + boxes[i].max) * 0.5f;
+		frustumCuller.setSphere(i, glm::vec4(center, glm::length(boxes[i].max - center)));
+	}
+
+	std::vector<uint32_t> simdVisible;
+	auto simd = measure([&] { frustumCuller.cull(planes, simdVisible); });
+
+	std::vector<uint32_t> bvhVisible;
+	auto hierarchical = measure([&] { bvh.queryFrustum(planes, bvhVisible); });
+
+	std::sort(bvhVisible.begin(), bvhVisible.end());
+	auto frustumMatch = bvhVisible == bruteForceVisible;
+
+	std::printf("frustum brute     %9.3f ms  (%zu visible)\n", bruteForce, bruteForceVisible.size());
+	std::printf("frustum simd      %9.3f ms  (%zu visible, spheres)\n", simd, simdVisible.size());
+	std::printf("frustum bvh       %9.3f ms  (%zu visible, %s)\n\n", hierarchical, bvhVisible.size(), frustumMatch ? "matches brute force" : "MISMATCH");
+
+	// picking rays from random points in random directions
+	std::vector<glm::vec3> rayOrigins(RAY_COUNT);
+	std::vector<glm::vec3> rayDirections(RAY_COUNT);
+	std::normal_distribution<float> direction;
+	for (auto i = 0; i < RAY_COUNT; i++)
+	{
+		rayOrigins[i] = { position(random), position(random), position(random) };
+		rayDirections[i] = glm::normalize(glm::vec3(direction(random), direction(random), direction(random)));
+	}
+
+	std::vector<uint32_t> bruteForceHits(RAY_COUNT);
+	auto bruteForceRays = measure([&]
+	{
+		for (auto r = 0; r < RAY_COUNT; r++)
+		{
+			auto inverseDirection = 1.f / rayDirections[r];
+			auto closest = WORLD_SIZE * 2.f;
+			bruteForceHits[r] = Bvh::INVALID_PRIMITIVE;
+
+			for (uint32_t i = 0; i < objectCount; i++)
+			{
+				float distance;
+				if (intersectRay(boxes[i], rayOrigins[r], inverseDirection, distance) && distance < closest)
+				{
+					closest = distance;
+					bruteForceHits[r] = i;
+				}
+			}
+		}
+	}) / RAY_COUNT;
+
+	std::vector<uint32_t> bvhHits(RAY_COUNT);
+	auto bvhRays = measure([&]
+	{
+		for (auto r = 0; r < RAY_COUNT; r++)
+		{
+			float distance;
+			bvhHits[r] = bvh.raycast(rayOrigins[r], rayDirections[r], WORLD_SIZE * 2.f, distance);
+		}
+	}) / RAY_COUNT;
+
+	std::printf("ray brute         %9.5f ms per ray\n", bruteForceRays);
+	std::printf("ray bvh           %9.5f ms per ray  (%s)\n", bvhRays, bvhHits == bruteForceHits ? "matches brute force" : "MISMATCH");
+
+	threadPool.cleanup();
+
+	return frustumMatch ? EXIT_SUCCESS : EXIT_FAILURE;
+}
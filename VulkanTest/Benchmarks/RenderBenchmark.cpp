@@ -0,0 +1,402 @@
+// renders a generated scene for a fixed number of frames and reports frame, cpu record and gpu times as json
+// usage: RenderBenchmark [--objects N] [--textures M] [--geometries K] [--frames F] [--warmup W]
+//                        [--windowed] [--static] [--output file.json]
+// the scene only depends on the counts, every run of the same arguments draws the same frames
+
+#define STB_IMAGE_IMPLEMENTATION
+#define GLM_FORCE_RADIANS
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../Classes/VulkanRenderer.h"
+
+namespace
+{
+	static inline constexpr const float OBJECT_SPACING = 3.f;
+	static inline constexpr const uint32_t TEXTURE_SIZE = 64;
+	static inline constexpr const uint32_t SEED = 1234;
+
+	struct Settings
+	{
+		uint32_t objectCount = 10000;
+		uint32_t textureCount = 16;
+		uint32_t geometryCount = 64;
+		uint32_t frameCount = 600;
+		uint32_t warmupFrames = 60;		// pipelines, uploads and first recordings, not measured
+		bool windowed = false;
+		bool animated = true;
+		std::string output;				// stdout if empty
+	};
+
+	// animation of one object, spins around its own axis
+	struct ObjectMotion
+	{
+		glm::vec3 position;
+		glm::vec3 axis;
+		float speed;					// radians per second
+		float phase;
+	};
+
+	struct Percentiles
+	{
+		double average = 0.0;
+		double p50 = 0.0;
+		double p90 = 0.0;
+		double p99 = 0.0;
+		double max = 0.0;
+	};
+
+	Percentiles getPercentiles(std::vector<double> values)
+	{
+		Percentiles result;
+		if (values.empty())
+		{
+			return result;
+		}
+
+		std::sort(values.begin(), values.end());
+
+		// nearest rank
+		auto rank = [&](double p) { return values[std::max<size_t>(static_cast<size_t>(std::ceil(p * values.size())), 1) - 1]; };
+
+		for (auto value : values)
+		{
+			result.average += value;
+		}
+		result.average /= values.size();
+		result.p50 = rank(0.5);
+		result.p90 = rank(0.9);
+		result.p99 = rank(0.99);
+		result.max = values.back();
+
+		return result;
+	}
+
+	void writePercentiles(std::ostream& out, const char* name, const Percentiles& percentiles, bool last = false)
+	{
+		out << "\t\t\"" << name << "\": { \"average\": " << percentiles.average << ", \"p50\": " << percentiles.p50 << ", \"p90\": " << percentiles.p90
+			<< ", \"p99\": " << percentiles.p99 << ", \"max\": " << percentiles.max << " }" << (last ? "\n" : ",\n");
+	}
+
+	bool parseArguments(int argc, char** argv, Settings& settings)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			auto hasValue = i + 1 < argc;
+
+			if (arg == "--objects" && hasValue)
+			{
+				settings.objectCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			}
+			else if (arg == "--textures" && hasValue)
+			{
+				settings.textureCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			}
+			else if (arg == "--geometries" && hasValue)
+			{
+				settings.geometryCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			}
+			else if (arg == "--frames" && hasValue)
+			{
+				settings.frameCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			}
+			else if (arg == "--warmup" && hasValue)
+			{
+				settings.warmupFrames = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			}
+			else if (arg == "--windowed")
+			{
+				settings.windowed = true;
+			}
+			else if (arg == "--static")
+			{
+				settings.animated = false;
+			}
+			else if (arg == "--output" && hasValue)
+			{
+				settings.output = argv[++i];
+			}
+			else
+			{
+				std::fprintf(stderr, "unknown argument %s\n", arg.c_str());
+				return false;
+			}
+		}
+
+		settings.objectCount = std::max(1u, settings.objectCount);
+		settings.geometryCount = std::clamp(settings.geometryCount, 1u, settings.objectCount);
+		settings.textureCount = std::max(1u, settings.textureCount);
+		settings.frameCount = std::max(1u, settings.frameCount);
+		return true;
+	}
+
+	// box with 4 vertices per face so every face gets the whole texture
+	void createBox(const glm::vec3& extent, const glm::vec3& color, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+	{
+		static const glm::vec3 normals[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+
+		vertices.clear();
+		indices.clear();
+		for (auto& normal : normals)
+		{
+			// two axes spanning the face
+			auto u = glm::vec3(normal.y, normal.z, normal.x);
+			auto v = glm::cross(normal, u);
+
+			auto first = static_cast<uint32_t>(vertices.size());
+			vertices.push_back({ (normal - u - v) * extent, color, { 0.f, 0.f } });
+			vertices.push_back({ (normal + u - v) * extent, color, { 1.f, 0.f } });
+			vertices.push_back({ (normal + u + v) * extent, color, { 1.f, 1.f } });
+			vertices.push_back({ (normal - u + v) * extent, color, { 0.f, 1.f } });
+
+			indices.insert(indices.end(), { first, first + 1, first + 2, first + 2, first + 3, first });
+		}
+	}
+
+	// checker board of two random colors
+	void createTexturePixels(std::mt19937& random, std::vector<unsigned char>& pixels)
+	{
+		std::uniform_int_distribution<int> channel(0, 255);
+		unsigned char colors[2][4] = {
+			{ static_cast<unsigned char>(channel(random)), static_cast<unsigned char>(channel(random)), static_cast<unsigned char>(channel(random)), 255 },
+			{ static_cast<unsigned char>(channel(random)), static_cast<unsigned char>(channel(random)), static_cast<unsigned char>(channel(random)), 255 } };
+
+		pixels.resize(TEXTURE_SIZE * TEXTURE_SIZE * 4);
+		for (uint32_t y = 0; y < TEXTURE_SIZE; y++)
+		{
+			for (uint32_t x = 0; x < TEXTURE_SIZE; x++)
+			{
+				auto color = colors[((x / 8) + (y / 8)) % 2];
+				std::copy(color, color + 4, &pixels[(y * TEXTURE_SIZE + x) * 4]);
+			}
+		}
+	}
+
+	glm::mat4 getObjectModel(const ObjectMotion& motion, float time)
+	{
+		auto model = glm::translate(glm::mat4(1.f), motion.position);
+		return glm::rotate(model, motion.phase + motion.speed * time, motion.axis);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Settings settings;
+	if (!parseArguments(argc, argv, settings))
+	{
+		return EXIT_FAILURE;
+	}
+
+	GLFWwindow* window = nullptr;
+	VulkanRenderer renderer;
+
+	if (settings.windowed)
+	{
+		glfwInit();
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+		glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+		window = glfwCreateWindow(1280, 720, "RenderBenchmark", nullptr, nullptr);
+
+		if (renderer.init(window) == EXIT_FAILURE)
+		{
+			return EXIT_FAILURE;
+		}
+	}
+	else if (renderer.initHeadless(VulkanRenderer::HeadlessSettings{}) == EXIT_FAILURE)
+	{
+		return EXIT_FAILURE;
+	}
+
+	settings.textureCount = std::min(settings.textureCount, renderer.getTextureCapacity());
+
+	// objects on a cube shaped grid in front of the camera, spread over all geometries and textures
+	std::mt19937 random(SEED);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	auto gridSize = static_cast<uint32_t>(std::ceil(std::cbrt(static_cast<double>(settings.objectCount))));
+	auto gridExtent = gridSize * OBJECT_SPACING;
+
+	std::vector<ObjectMotion> motions(settings.objectCount);
+	for (uint32_t i = 0; i < settings.objectCount; i++)
+	{
+		auto& motion = motions[i];
+		glm::vec3 cell{ static_cast<float>(i % gridSize), static_cast<float>((i / gridSize) % gridSize), static_cast<float>(i / (gridSize * gridSize)) };
+		motion.position = (cell + 0.5f) * OBJECT_SPACING - glm::vec3(gridExtent * 0.5f, gridExtent * 0.5f, gridExtent);
+		motion.axis = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + 0.1f);
+		motion.speed = 0.5f + unit(random) * 2.f;
+		motion.phase = unit(random) * 6.28f;
+	}
+
+	std::vector<int> objectIds;
+	objectIds.reserve(settings.objectCount);
+
+	auto setupStart = std::chrono::steady_clock::now();
+	try
+	{
+		std::vector<int> textureIds;
+		std::vector<unsigned char> pixels;
+		for (uint32_t t = 0; t < settings.textureCount; t++)
+		{
+			createTexturePixels(random, pixels);
+			textureIds.push_back(renderer.createTexture(pixels.data(), TEXTURE_SIZE, TEXTURE_SIZE));
+		}
+
+		// first objects own the geometries, the rest are instances of them
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices;
+		for (uint32_t i = 0; i < settings.objectCount; i++)
+		{
+			auto model = getObjectModel(motions[i], 0.f);
+			if (i < settings.geometryCount)
+			{
+				createBox(glm::vec3(0.3f + unit(random) * 0.7f, 0.3f + unit(random) * 0.7f, 0.3f + unit(random) * 0.7f),
+					glm::vec3(unit(random), unit(random), unit(random)), vertices, indices);
+				objectIds.push_back(renderer.addMesh(vertices, indices, textureIds[i % textureIds.size()], model));
+			}
+			else
+			{
+				objectIds.push_back(renderer.addMeshInstance(objectIds[i % settings.geometryCount], model));
+				renderer.setModelTexture(objectIds.back(), textureIds[i % textureIds.size()]);
+			}
+		}
+	}
+	catch (const std::runtime_error& e)
+	{
+		std::fprintf(stderr, "ERROR: %s\n", e.what());
+		renderer.cleanup();
+		return EXIT_FAILURE;
+	}
+	auto setupMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - setupStart).count();
+
+	// whole grid in view from the front
+	auto cameraDistance = gridExtent * 0.5f / std::tan(glm::radians(30.f)) + OBJECT_SPACING;
+	renderer.setCamera(glm::lookAt(glm::vec3(0.f, 0.f, cameraDistance - gridExtent * 0.5f), glm::vec3(0.f, 0.f, -gridExtent * 0.5f), glm::vec3(0.f, 1.f, 0.f)),
+		glm::radians(60.f), 0.1f, cameraDistance + gridExtent * 2.f);
+
+	std::vector<double> frameTimes, drawTimes, updateTimes, recordTimes, fenceWaitTimes, cpuTimes;
+	auto totalFrames = settings.warmupFrames + settings.frameCount;
+
+	// the object buffer grows on the first draw, a scene over the device limits throws there
+	try
+	{
+		for (uint32_t frame = 0; frame < totalFrames; frame++)
+		{
+			if (window != nullptr)
+			{
+				glfwPollEvents();
+				if (glfwWindowShouldClose(window))
+				{
+					break;
+				}
+			}
+
+			auto frameStart = std::chrono::steady_clock::now();
+
+			// fixed 60 fps steps, independent of how long frames take
+			if (settings.animated)
+			{
+				auto time = frame / 60.f;
+				for (uint32_t i = 0; i < settings.objectCount; i++)
+				{
+					renderer.updateModel(objectIds[i], getObjectModel(motions[i], time));
+				}
+			}
+			auto drawStart = std::chrono::steady_clock::now();
+
+			renderer.draw();
+
+			auto frameEnd = std::chrono::steady_clock::now();
+			if (frame < settings.warmupFrames)
+			{
+				continue;
+			}
+
+			auto& counters = renderer.getLastFrameCounters();
+			auto drawMs = std::chrono::duration<double, std::milli>(frameEnd - drawStart).count();
+			frameTimes.push_back(std::chrono::duration<double, std::milli>(frameEnd - frameStart).count());
+			drawTimes.push_back(drawMs);
+			updateTimes.push_back(std::chrono::duration<double, std::milli>(drawStart - frameStart).count());
+			recordTimes.push_back(counters.recordMs);
+			fenceWaitTimes.push_back(counters.fenceWaitMs + counters.acquireWaitMs);
+			cpuTimes.push_back(drawMs - counters.fenceWaitMs - counters.acquireWaitMs);
+		}
+	}
+	catch (const std::runtime_error& e)
+	{
+		std::fprintf(stderr, "ERROR: %s\n", e.what());
+		renderer.cleanup();
+		return EXIT_FAILURE;
+	}
+
+	// timestamps of the last frames are only read back once their images are used again
+	auto lastCounters = renderer.getLastFrameCounters();
+	auto gpuStats = renderer.getGpuProfiler().getStats();
+	renderer.cleanup();
+
+	if (window != nullptr)
+	{
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
+
+	std::ostringstream json;
+	json << "{\n\t\"objects\": " << settings.objectCount << ",\n\t\"textures\": " << settings.textureCount << ",\n\t\"geometries\": " << settings.geometryCount
+		<< ",\n\t\"frames\": " << frameTimes.size() << ",\n\t\"warmupFrames\": " << settings.warmupFrames
+		<< ",\n\t\"headless\": " << (settings.windowed ? "false" : "true") << ",\n\t\"animated\": " << (settings.animated ? "true" : "false")
+		<< ",\n\t\"setupMs\": " << setupMs << ",\n";
+
+	// milliseconds, update = animating the objects, cpu = draw call without fence and acquire waits
+	json << "\t\"cpu\": {\n";
+	writePercentiles(json, "frameMs", getPercentiles(frameTimes));
+	writePercentiles(json, "updateMs", getPercentiles(updateTimes));
+	writePercentiles(json, "drawMs", getPercentiles(drawTimes));
+	writePercentiles(json, "cpuMs", getPercentiles(cpuTimes));
+	writePercentiles(json, "recordMs", getPercentiles(recordTimes));
+	writePercentiles(json, "waitMs", getPercentiles(fenceWaitTimes), true);
+	json << "\t},\n";
+
+	// rolling gpu scopes of the last frames, empty without timestamp support
+	json << "\t\"gpu\": {";
+	for (size_t i = 0; i < gpuStats.size(); i++)
+	{
+		json << (i == 0 ? "\n" : ",\n") << "\t\t\"" << gpuStats[i].name << "\": { \"averageMs\": " << gpuStats[i].averageMs
+			<< ", \"p99Ms\": " << gpuStats[i].p99Ms << ", \"samples\": " << gpuStats[i].sampleCount << " }";
+	}
+	json << "\n\t},\n";
+
+	json << "\t\"lastFrame\": { \"drawCalls\": " << lastCounters.commands.drawCalls << ", \"indirectDraws\": " << lastCounters.commands.indirectDraws
+		<< ", \"triangles\": " << lastCounters.triangles << ", \"hostWrittenBytes\": " << lastCounters.hostWrittenBytes << " }\n}\n";
+
+	if (settings.output.empty())
+	{
+		std::cout << json.str();
+	}
+	else
+	{
+		std::ofstream file(settings.output);
+		if (!file.is_open())
+		{
+			std::fprintf(stderr, "ERROR: Failed to open %s\n", settings.output.c_str());
+			return EXIT_FAILURE;
+		}
+		file << json.str();
+	}
+
+	return 0;
+}
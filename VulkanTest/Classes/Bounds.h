@@ -0,0 +1,49 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <glm/glm.hpp>
+
+// axis aligned bounding box
+struct BoundingBox
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+// min > max, grows to the first box merged into it
+static inline BoundingBox emptyBoundingBox()
+{
+	auto infinity = std::numeric_limits<float>::infinity();
+	return { glm::vec3(infinity), glm::vec3(-infinity) };
+}
+
+static inline BoundingBox mergeBoundingBoxes(const BoundingBox& a, const BoundingBox& b)
+{
+	return { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+}
+
+static inline float getSurfaceArea(const BoundingBox& box)
+{
+	auto extent = glm::max(box.max - box.min, glm::vec3(0.f));
+	return 2.f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+static inline bool overlaps(const BoundingBox& a, const BoundingBox& b)
+{
+	return a.min.x <= b.max.x && a.max.x >= b.min.x
+		&& a.min.y <= b.max.y && a.max.y >= b.min.y
+		&& a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+// box of box transformed by matrix, from the transformed center and extents (Arvo)
+static inline BoundingBox transformBoundingBox(const glm::mat4& matrix, const BoundingBox& box)
+{
+	auto center = glm::vec3(matrix * glm::vec4((box.min + box.max) * 0.5f, 1.f));
+	auto extent = (box.max - box.min) * 0.5f;
+
+	auto absMatrix = glm::mat3(glm::abs(glm::vec3(matrix[0])), glm::abs(glm::vec3(matrix[1])), glm::abs(glm::vec3(matrix[2])));
+	auto worldExtent = absMatrix * extent;
+
+	return { center - worldExtent, center + worldExtent };
+}
@@ -0,0 +1,508 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+
+namespace
+{
+	// entry distance of the ray into box, false if it misses within [0, maxDistance]
+	bool intersectRay(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec3& origin, const glm::vec3& inverseDirection,
+		float maxDistance, float& distance)
+	{
+		auto t0 = (boxMin - origin) * inverseDirection;
+		auto t1 = (boxMax - origin) * inverseDirection;
+
+		auto tNear = glm::min(t0, t1);
+		auto tFar = glm::max(t0, t1);
+
+		auto entry = std::max({ tNear.x, tNear.y, tNear.z, 0.f });
+		auto exit = std::min({ tFar.x, tFar.y, tFar.z, maxDistance });
+
+		distance = entry;
+		return entry <= exit;
+	}
+
+	// farthest / nearest box corner along the plane normal
+	glm::vec3 getPositiveVertex(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec4& plane)
+	{
+		return { plane.x >= 0.f ? boxMax.x : boxMin.x, plane.y >= 0.f ? boxMax.y : boxMin.y, plane.z >= 0.f ? boxMax.z : boxMin.z };
+	}
+
+	glm::vec3 getNegativeVertex(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec4& plane)
+	{
+		return { plane.x >= 0.f ? boxMin.x : boxMax.x, plane.y >= 0.f ? boxMin.y : boxMax.y, plane.z >= 0.f ? boxMin.z : boxMax.z };
+	}
+}
+
+void Bvh::build(const std::vector<BoundingBox>& primitiveBounds, ThreadPool* threadPool)
+{
+	bounds = primitiveBounds;
+	dirtyLeaves.clear();
+	nodes.clear();
+
+	auto primitiveCount = static_cast<uint32_t>(bounds.size());
+	primitiveList.resize(primitiveCount);
+	centroids.resize(primitiveCount);
+	for (uint32_t i = 0; i < primitiveCount; i++)
+	{
+		primitiveList[i] = i;
+		centroids[i] = (bounds[i].min + bounds[i].max) * 0.5f;
+	}
+
+	if (primitiveCount == 0)
+	{
+		updateParents();
+		return;
+	}
+
+	nodes.push_back({});
+
+	if (threadPool == nullptr || threadPool->getThreadCount() == 1 || primitiveCount < MIN_PARALLEL_SUBTREE_SIZE)
+	{
+		buildSubtree(nodes, 0, 0, primitiveCount);
+	}
+	else
+	{
+		// split the top levels breadth first until there are enough independent subtrees
+		auto targetTaskCount = threadPool->getThreadCount() * PARALLEL_SUBTREES_PER_THREAD;
+
+		std::vector<BuildTask> pending{ { 0, 0, primitiveCount } };
+		std::vector<BuildTask> subtreeTasks;
+		for (size_t head = 0; head < pending.size(); head++)
+		{
+			auto task = pending[head];
+			auto queuedCount = pending.size() - head - 1 + subtreeTasks.size();
+
+			if (task.end - task.begin < MIN_PARALLEL_SUBTREE_SIZE || queuedCount + 1 >= targetTaskCount)
+			{
+				subtreeTasks.push_back(task);
+				continue;
+			}
+
+			uint32_t middle;
+			if (splitNode(nodes, task.node, task.begin, task.end, middle))
+			{
+				auto leftChild = nodes[task.node].firstChildOrPrimitive;
+				pending.push_back({ leftChild, task.begin, middle });
+				pending.push_back({ leftChild + 1, middle, task.end });
+			}
+		}
+
+		// subtrees own disjoint ranges of the primitive list, each is built into its own node list
+		std::vector<std::vector<Node>> subtreeNodes(subtreeTasks.size());
+		threadPool->parallelFor(static_cast<uint32_t>(subtreeTasks.size()), [&](uint32_t index, uint32_t)
+		{
+			auto& task = subtreeTasks[index];
+			subtreeNodes[index].push_back({});
+			buildSubtree(subtreeNodes[index], 0, task.begin, task.end);
+		});
+
+		// the subtree root replaces its placeholder, the other nodes are appended
+		for (size_t i = 0; i < subtreeTasks.size(); i++)
+		{
+			auto& localNodes = subtreeNodes[i];
+			auto offset = static_cast<uint32_t>(nodes.size()) - 1;
+
+			for (auto& node : localNodes)
+			{
+				if (node.primitiveCount == 0)
+				{
+					node.firstChildOrPrimitive += offset;
+				}
+			}
+
+			nodes[subtreeTasks[i].node] = localNodes[0];
+			nodes.insert(nodes.end(), localNodes.begin() + 1, localNodes.end());
+		}
+	}
+
+	centroids.clear();
+	centroids.shrink_to_fit();
+
+	updateParents();
+}
+
+void Bvh::updatePrimitive(uint32_t primitive, const BoundingBox& newBounds)
+{
+	if (primitive >= bounds.size())
+	{
+		return;
+	}
+
+	bounds[primitive] = newBounds;
+
+	// a leaf is refit once no matter how many of its primitives moved
+	auto leaf = primitiveLeaves[primitive];
+	if (!leafQueued[leaf])
+	{
+		leafQueued[leaf] = 1;
+		dirtyLeaves.push_back(leaf);
+	}
+}
+
+void Bvh::refit()
+{
+	for (auto leaf : dirtyLeaves)
+	{
+		leafQueued[leaf] = 0;
+		setNodeBounds(nodes[leaf], nodes[leaf].firstChildOrPrimitive, nodes[leaf].firstChildOrPrimitive + nodes[leaf].primitiveCount);
+
+		// walk up until a parent does not change, the rest of the path is covered already
+		for (auto node = parents[leaf]; node != INVALID_NODE; node = parents[node])
+		{
+			auto& left = nodes[nodes[node].firstChildOrPrimitive];
+			auto& right = nodes[nodes[node].firstChildOrPrimitive + 1];
+
+			auto newMin = glm::min(left.boundsMin, right.boundsMin);
+			auto newMax = glm::max(left.boundsMax, right.boundsMax);
+			if (newMin == nodes[node].boundsMin && newMax == nodes[node].boundsMax)
+			{
+				break;
+			}
+
+			nodes[node].boundsMin = newMin;
+			nodes[node].boundsMax = newMax;
+		}
+	}
+
+	dirtyLeaves.clear();
+}
+
+void Bvh::queryFrustum(const glm::vec4* planes, std::vector<uint32_t>& primitives) const
+{
+	primitives.clear();
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	// planes a node is not known to be fully inside of yet, children only test those
+	struct StackEntry
+	{
+		uint32_t node;
+		uint32_t planeMask;
+	};
+
+	std::vector<StackEntry> stack{ { 0, 0x3f } };
+	while (!stack.empty())
+	{
+		auto entry = stack.back();
+		stack.pop_back();
+
+		auto& node = nodes[entry.node];
+
+		auto outside = false;
+		for (uint32_t p = 0; p < 6 && !outside; p++)
+		{
+			if ((entry.planeMask & (1u << p)) == 0)
+			{
+				continue;
+			}
+
+			auto& plane = planes[p];
+			if (glm::dot(glm::vec3(plane), getPositiveVertex(node.boundsMin, node.boundsMax, plane)) + plane.w < 0.f)
+			{
+				outside = true;
+			}
+			else if (glm::dot(glm::vec3(plane), getNegativeVertex(node.boundsMin, node.boundsMax, plane)) + plane.w >= 0.f)
+			{
+				entry.planeMask &= ~(1u << p);
+			}
+		}
+
+		if (outside)
+		{
+			continue;
+		}
+
+		if (node.primitiveCount > 0)
+		{
+			// a leaf box partially inside, test its primitives
+			for (auto i = node.firstChildOrPrimitive; i < node.firstChildOrPrimitive + node.primitiveCount; i++)
+			{
+				auto& box = bounds[primitiveList[i]];
+
+				auto inside = true;
+				for (uint32_t p = 0; p < 6 && inside; p++)
+				{
+					auto& plane = planes[p];
+					inside = (entry.planeMask & (1u << p)) == 0 || glm::dot(glm::vec3(plane), getPositiveVertex(box.min, box.max, plane)) + plane.w >= 0.f;
+				}
+
+				if (inside)
+				{
+					primitives.push_back(primitiveList[i]);
+				}
+			}
+			continue;
+		}
+
+		stack.push_back({ node.firstChildOrPrimitive + 1, entry.planeMask });
+		stack.push_back({ node.firstChildOrPrimitive, entry.planeMask });
+	}
+}
+
+void Bvh::queryBox(const BoundingBox& region, std::vector<uint32_t>& primitives) const
+{
+	primitives.clear();
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	std::vector<uint32_t> stack{ 0 };
+	while (!stack.empty())
+	{
+		auto& node = nodes[stack.back()];
+		stack.pop_back();
+
+		if (!overlaps(region, { node.boundsMin, node.boundsMax }))
+		{
+			continue;
+		}
+
+		if (node.primitiveCount > 0)
+		{
+			for (auto i = node.firstChildOrPrimitive; i < node.firstChildOrPrimitive + node.primitiveCount; i++)
+			{
+				if (overlaps(region, bounds[primitiveList[i]]))
+				{
+					primitives.push_back(primitiveList[i]);
+				}
+			}
+			continue;
+		}
+
+		stack.push_back(node.firstChildOrPrimitive + 1);
+		stack.push_back(node.firstChildOrPrimitive);
+	}
+}
+
+uint32_t Bvh::raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& hitDistance) const
+{
+	auto hitPrimitive = INVALID_PRIMITIVE;
+	hitDistance = maxDistance;
+
+	if (nodes.empty())
+	{
+		return hitPrimitive;
+	}
+
+	// division by a zero component gives +-inf, the slab test handles that
+	auto inverseDirection = 1.f / direction;
+
+	std::vector<uint32_t> stack{ 0 };
+	while (!stack.empty())
+	{
+		auto& node = nodes[stack.back()];
+		stack.pop_back();
+
+		float distance;
+		if (!intersectRay(node.boundsMin, node.boundsMax, origin, inverseDirection, hitDistance, distance))
+		{
+			continue;
+		}
+
+		if (node.primitiveCount > 0)
+		{
+			for (auto i = node.firstChildOrPrimitive; i < node.firstChildOrPrimitive + node.primitiveCount; i++)
+			{
+				auto& box = bounds[primitiveList[i]];
+				if (intersectRay(box.min, box.max, origin, inverseDirection, hitDistance, distance) && distance < hitDistance)
+				{
+					hitDistance = distance;
+					hitPrimitive = primitiveList[i];
+				}
+			}
+			continue;
+		}
+
+		// nearer child on top of the stack, its hits shorten the ray for the other one
+		auto leftChild = node.firstChildOrPrimitive;
+		float leftDistance, rightDistance;
+		auto leftHit = intersectRay(nodes[leftChild].boundsMin, nodes[leftChild].boundsMax, origin, inverseDirection, hitDistance, leftDistance);
+		auto rightHit = intersectRay(nodes[leftChild + 1].boundsMin, nodes[leftChild + 1].boundsMax, origin, inverseDirection, hitDistance, rightDistance);
+
+		if (leftHit && rightHit)
+		{
+			stack.push_back(leftDistance < rightDistance ? leftChild + 1 : leftChild);
+			stack.push_back(leftDistance < rightDistance ? leftChild : leftChild + 1);
+		}
+		else if (leftHit)
+		{
+			stack.push_back(leftChild);
+		}
+		else if (rightHit)
+		{
+			stack.push_back(leftChild + 1);
+		}
+	}
+
+	return hitPrimitive;
+}
+
+uint32_t Bvh::getPrimitiveCount() const
+{
+	return static_cast<uint32_t>(bounds.size());
+}
+
+const std::vector<Bvh::Node>& Bvh::getNodes() const
+{
+	return nodes;
+}
+
+bool Bvh::splitNode(std::vector<Node>& nodeList, uint32_t nodeIndex, uint32_t begin, uint32_t end, uint32_t& middle)
+{
+	setNodeBounds(nodeList[nodeIndex], begin, end);
+
+	auto count = end - begin;
+	if (count <= MAX_LEAF_SIZE)
+	{
+		nodeList[nodeIndex].firstChildOrPrimitive = begin;
+		nodeList[nodeIndex].primitiveCount = count;
+		return false;
+	}
+
+	// bins over the centroid bounds, split candidates are the planes between bins
+	auto centroidBounds = emptyBoundingBox();
+	for (auto i = begin; i < end; i++)
+	{
+		centroidBounds.min = glm::min(centroidBounds.min, centroids[primitiveList[i]]);
+		centroidBounds.max = glm::max(centroidBounds.max, centroids[primitiveList[i]]);
+	}
+
+	auto bestCost = std::numeric_limits<float>::max();
+	auto bestAxis = -1;
+	uint32_t bestSplit = 0;
+
+	for (auto axis = 0; axis < 3; axis++)
+	{
+		auto extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+		if (extent <= 0.f)
+		{
+			continue;
+		}
+
+		std::array<BoundingBox, BIN_COUNT> binBounds;
+		std::array<uint32_t, BIN_COUNT> binCounts{};
+		binBounds.fill(emptyBoundingBox());
+
+		auto scale = BIN_COUNT / extent;
+		for (auto i = begin; i < end; i++)
+		{
+			auto primitive = primitiveList[i];
+			auto bin = std::min(BIN_COUNT - 1, static_cast<uint32_t>((centroids[primitive][axis] - centroidBounds.min[axis]) * scale));
+			binBounds[bin] = mergeBoundingBoxes(binBounds[bin], bounds[primitive]);
+			binCounts[bin]++;
+		}
+
+		// SAH cost of every split from both sides
+		std::array<float, BIN_COUNT - 1> leftCosts;
+		auto leftBounds = emptyBoundingBox();
+		uint32_t leftCount = 0;
+		for (uint32_t bin = 0; bin < BIN_COUNT - 1; bin++)
+		{
+			leftBounds = mergeBoundingBoxes(leftBounds, binBounds[bin]);
+			leftCount += binCounts[bin];
+			leftCosts[bin] = leftCount * getSurfaceArea(leftBounds);
+		}
+
+		auto rightBounds = emptyBoundingBox();
+		uint32_t rightCount = 0;
+		for (auto bin = BIN_COUNT - 1; bin > 0; bin--)
+		{
+			rightBounds = mergeBoundingBoxes(rightBounds, binBounds[bin]);
+			rightCount += binCounts[bin];
+
+			auto cost = leftCosts[bin - 1] + rightCount * getSurfaceArea(rightBounds);
+			if (rightCount > 0 && rightCount < count && cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = bin;
+			}
+		}
+	}
+
+	middle = begin + count / 2;
+	if (bestAxis >= 0)
+	{
+		auto scale = BIN_COUNT / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+		auto minCentroid = centroidBounds.min[bestAxis];
+
+		auto split = std::partition(primitiveList.begin() + begin, primitiveList.begin() + end, [&](uint32_t primitive)
+		{
+			return std::min(BIN_COUNT - 1, static_cast<uint32_t>((centroids[primitive][bestAxis] - minCentroid) * scale)) < bestSplit;
+		});
+		middle = static_cast<uint32_t>(split - primitiveList.begin());
+	}
+
+	// all centroids in one spot or an empty side, fall back to halves
+	if (middle == begin || middle == end)
+	{
+		middle = begin + count / 2;
+	}
+
+	auto leftChild = static_cast<uint32_t>(nodeList.size());
+	nodeList.push_back({});
+	nodeList.push_back({});
+
+	nodeList[nodeIndex].firstChildOrPrimitive = leftChild;
+	nodeList[nodeIndex].primitiveCount = 0;
+
+	return true;
+}
+
+void Bvh::buildSubtree(std::vector<Node>& nodeList, uint32_t rootNode, uint32_t begin, uint32_t end)
+{
+	std::vector<BuildTask> stack{ { rootNode, begin, end } };
+	while (!stack.empty())
+	{
+		auto task = stack.back();
+		stack.pop_back();
+
+		uint32_t middle;
+		if (splitNode(nodeList, task.node, task.begin, task.end, middle))
+		{
+			auto leftChild = nodeList[task.node].firstChildOrPrimitive;
+			stack.push_back({ leftChild + 1, middle, task.end });
+			stack.push_back({ leftChild, task.begin, middle });
+		}
+	}
+}
+
+void Bvh::setNodeBounds(Node& node, uint32_t begin, uint32_t end) const
+{
+	auto nodeBounds = emptyBoundingBox();
+	for (auto i = begin; i < end; i++)
+	{
+		nodeBounds = mergeBoundingBoxes(nodeBounds, bounds[primitiveList[i]]);
+	}
+
+	node.boundsMin = nodeBounds.min;
+	node.boundsMax = nodeBounds.max;
+}
+
+void Bvh::updateParents()
+{
+	parents.assign(nodes.size(), INVALID_NODE);
+	leafQueued.assign(nodes.size(), 0);
+	primitiveLeaves.assign(bounds.size(), INVALID_NODE);
+
+	for (uint32_t i = 0; i < nodes.size(); i++)
+	{
+		auto& node = nodes[i];
+		if (node.primitiveCount == 0)
+		{
+			parents[node.firstChildOrPrimitive] = i;
+			parents[node.firstChildOrPrimitive + 1] = i;
+			continue;
+		}
+
+		for (auto p = node.firstChildOrPrimitive; p < node.firstChildOrPrimitive + node.primitiveCount; p++)
+		{
+			primitiveLeaves[primitiveList[p]] = i;
+		}
+	}
+}
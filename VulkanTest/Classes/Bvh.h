@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Bounds.h"
+#include "ThreadPool.h"
+
+// bounding volume hierarchy over primitive boxes (index = primitive id)
+// built top down with binned SAH, subtrees below the top levels are built in parallel
+// nodes are stored flattened, children of a node are adjacent and always behind their parent
+class Bvh
+{
+public:
+	// 32 bytes, two nodes per cache line
+	struct Node
+	{
+		glm::vec3 boundsMin;
+		uint32_t firstChildOrPrimitive;		// interior: left child, right child follows it / leaf: first entry in the primitive list
+		glm::vec3 boundsMax;
+		uint32_t primitiveCount;			// 0 for interior nodes
+	};
+
+	static inline constexpr const uint32_t INVALID_PRIMITIVE = 0xffffffff;
+
+	Bvh() = default;
+
+	// threadPool may be null for a single threaded build
+	void build(const std::vector<BoundingBox>& primitiveBounds, ThreadPool* threadPool);
+
+	// new bounds of a moved primitive, applied by the next refit
+	// pending refits are bounded by the leaf count, however often primitives move in between
+	void updatePrimitive(uint32_t primitive, const BoundingBox& bounds);
+
+	// refit the nodes above updated primitives, topology is kept
+	void refit();
+
+	// primitives whose box is at least partially inside the 6 planes (xyz normal pointing inside, w distance)
+	void queryFrustum(const glm::vec4* planes, std::vector<uint32_t>& primitives) const;
+
+	// primitives whose box overlaps region
+	void queryBox(const BoundingBox& region, std::vector<uint32_t>& primitives) const;
+
+	// closest primitive box hit by the ray, INVALID_PRIMITIVE if none
+	uint32_t raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& hitDistance) const;
+
+	uint32_t getPrimitiveCount() const;
+	const std::vector<Node>& getNodes() const;
+
+private:
+	static inline constexpr const uint32_t INVALID_NODE = 0xffffffff;
+	static inline constexpr const uint32_t BIN_COUNT = 16;
+	static inline constexpr const uint32_t MAX_LEAF_SIZE = 4;
+	static inline constexpr const uint32_t PARALLEL_SUBTREES_PER_THREAD = 4;	// subtrees handed to the thread pool per thread
+	static inline constexpr const uint32_t MIN_PARALLEL_SUBTREE_SIZE = 1024;	// smaller ranges are built by the caller
+
+	struct BuildTask
+	{
+		uint32_t node;
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	// splits the node into a leaf or two children, returns false for a leaf
+	bool splitNode(std::vector<Node>& nodes, uint32_t nodeIndex, uint32_t begin, uint32_t end, uint32_t& middle);
+	void buildSubtree(std::vector<Node>& nodes, uint32_t rootNode, uint32_t begin, uint32_t end);
+
+	void setNodeBounds(Node& node, uint32_t begin, uint32_t end) const;
+	void updateParents();
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> primitiveList;		// primitive ids, leaves reference ranges of it
+	std::vector<BoundingBox> bounds;			// per primitive id
+	std::vector<glm::vec3> centroids;			// per primitive id, build only
+	std::vector<uint32_t> parents;				// per node
+	std::vector<uint32_t> primitiveLeaves;		// leaf node per primitive id
+	std::vector<uint32_t> dirtyLeaves;			// leaves to refit, each at most once
+	std::vector<uint8_t> leafQueued;			// per node, set while the leaf is in dirtyLeaves
+};
@@ -0,0 +1,158 @@
+#include "CpuProfiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define CPU_PROFILER_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CPU_PROFILER_TSC
+#endif
+
+namespace
+{
+	struct Event
+	{
+		const char* name;
+		uint64_t start;
+		uint64_t end;
+	};
+
+	// written by its thread only, writeIndex is published after the event
+	struct ThreadBuffer
+	{
+		std::vector<Event> events = std::vector<Event>(CpuProfiler::EVENTS_PER_THREAD);
+		std::atomic<uint64_t> writeIndex{ 0 };
+		uint32_t threadIndex = 0;
+		std::string name;
+	};
+
+	// threads are registered once, buffers of finished threads are kept for the export
+	std::mutex registryMutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> threadBuffers;
+	thread_local ThreadBuffer* localBuffer = nullptr;
+
+	// tick rate is measured against steady_clock between the first scope and the export
+	struct ClockReference
+	{
+		uint64_t ticks;
+		std::chrono::steady_clock::time_point time;
+	};
+
+	ClockReference clockReference{ CpuProfiler::now(), std::chrono::steady_clock::now() };
+
+	ThreadBuffer* registerThread()
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+
+		threadBuffers.push_back(std::make_unique<ThreadBuffer>());
+		localBuffer = threadBuffers.back().get();
+		localBuffer->threadIndex = static_cast<uint32_t>(threadBuffers.size() - 1);
+		return localBuffer;
+	}
+
+	// names are ours, only quotes and backslashes would break the json
+	std::string escape(const std::string& text)
+	{
+		std::string escaped;
+		for (auto c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				escaped += '\\';
+			}
+			escaped += c;
+		}
+		return escaped;
+	}
+}
+
+uint64_t CpuProfiler::now()
+{
+#ifdef CPU_PROFILER_TSC
+	// invariant tsc on anything recent, a few cycles compared to a clock_gettime / QueryPerformanceCounter call
+	return __rdtsc();
+#else
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+void CpuProfiler::record(const char* name, uint64_t start, uint64_t end)
+{
+	auto buffer = localBuffer != nullptr ? localBuffer : registerThread();
+
+	auto index = buffer->writeIndex.load(std::memory_order_relaxed);
+	buffer->events[index & (EVENTS_PER_THREAD - 1)] = { name, start, end };
+	buffer->writeIndex.store(index + 1, std::memory_order_release);
+}
+
+void CpuProfiler::setThreadName(const std::string& name)
+{
+	auto buffer = localBuffer != nullptr ? localBuffer : registerThread();
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+	buffer->name = name;
+}
+
+void CpuProfiler::writeChromeTrace(const std::string& filename)
+{
+	std::ofstream file(filename);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open " + filename + " for the cpu trace!");
+	}
+
+	auto elapsedNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - clockReference.time).count();
+	auto elapsedTicks = static_cast<double>(now() - clockReference.ticks);
+	auto ticksPerUs = elapsedNs > 0.0 ? elapsedTicks / elapsedNs * 1000.0 : 1000.0;
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+
+	// microseconds with nanosecond digits, long runs would end up in exponent notation otherwise
+	file << std::fixed;
+	file.precision(3);
+
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	auto first = true;
+	std::vector<Event> events;
+
+	for (auto& buffer : threadBuffers)
+	{
+		auto name = buffer->name.empty() ? "thread " + std::to_string(buffer->threadIndex) : buffer->name;
+		file << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadIndex
+			<< ",\"args\":{\"name\":\"" << escape(name) << "\"}}";
+		first = false;
+
+		// copy, then drop whatever the thread overwrote while copying
+		auto endIndex = buffer->writeIndex.load(std::memory_order_acquire);
+		auto beginIndex = endIndex > EVENTS_PER_THREAD ? endIndex - EVENTS_PER_THREAD : 0;
+		events.clear();
+		for (auto i = beginIndex; i < endIndex; i++)
+		{
+			events.push_back(buffer->events[i & (EVENTS_PER_THREAD - 1)]);
+		}
+
+		// the writer may be storing event overwrittenEnd without having published it, its slot is lost as well
+		auto overwrittenEnd = buffer->writeIndex.load(std::memory_order_acquire);
+		auto validBegin = overwrittenEnd + 1 > EVENTS_PER_THREAD ? overwrittenEnd + 1 - EVENTS_PER_THREAD : 0;
+
+		for (auto i = std::max(beginIndex, validBegin); i < endIndex; i++)
+		{
+			auto& event = events[i - beginIndex];
+			auto start = static_cast<double>(static_cast<int64_t>(event.start - clockReference.ticks)) / ticksPerUs;
+			auto duration = static_cast<double>(event.end - event.start) / ticksPerUs;
+			file << ",\n{\"name\":\"" << escape(event.name) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadIndex
+				<< ",\"ts\":" << start << ",\"dur\":" << duration << "}";
+		}
+	}
+
+	file << "\n]}\n";
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// scoped cpu instrumentation, CPU_PROFILE_SCOPE("name") times the rest of the enclosing block
+// every thread writes into its own ring of the last EVENTS_PER_THREAD scopes, no locks or allocations after
+// the first scope of a thread, the rings are exported as chrome trace events (chrome://tracing, ui.perfetto.dev)
+// built with CPU_PROFILER_DISABLED (cmake -DENABLE_CPU_PROFILER=OFF) the scopes compile to nothing and traces are empty
+class CpuProfiler
+{
+public:
+	static inline constexpr const uint32_t EVENTS_PER_THREAD = 1 << 16;		// power of two
+
+	// names are not copied, use string literals
+	class Scope
+	{
+	public:
+		explicit Scope(const char* newName) : name(newName), start(now()) {}
+		~Scope() { record(name, start, now()); }
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		const char* name;
+		uint64_t start;
+	};
+
+	// clock ticks, tsc on x86 (converted when exporting), nanoseconds elsewhere
+	static uint64_t now();
+
+	static void record(const char* name, uint64_t start, uint64_t end);
+
+	// name of the calling thread in the trace, threads without one show up by index
+	static void setThreadName(const std::string& name);
+
+	// scopes of all threads still in their rings, safe while other threads record
+	// scopes overwritten during the export are left out
+	static void writeChromeTrace(const std::string& filename);
+};
+
+#ifdef CPU_PROFILER_DISABLED
+#define CPU_PROFILE_SCOPE(name)
+#else
+#define CPU_PROFILE_CONCAT_IMPL(a, b) a##b
+#define CPU_PROFILE_CONCAT(a, b) CPU_PROFILE_CONCAT_IMPL(a, b)
+#define CPU_PROFILE_SCOPE(name) CpuProfiler::Scope CPU_PROFILE_CONCAT(cpuProfileScope, __LINE__)(name)
+#endif
@@ -0,0 +1,76 @@
+#include "DrawSort.h"
+
+#include <array>
+#include <cstring>
+
+uint64_t makeDrawKey(uint32_t pipeline, uint32_t geometry, uint32_t texture, float depth)
+{
+	// bit pattern of a positive float increases with its value, keep the top bits
+	// draws behind the camera or at it sort first
+	uint32_t depthBits = 0;
+	if (depth > 0.f)
+	{
+		std::memcpy(&depthBits, &depth, sizeof(depthBits));
+		depthBits >>= 32 - DRAW_KEY_DEPTH_BITS;
+	}
+
+	auto key = static_cast<uint64_t>(pipeline & ((1u << DRAW_KEY_PIPELINE_BITS) - 1));
+	key = (key << DRAW_KEY_GEOMETRY_BITS) | (geometry & ((1u << DRAW_KEY_GEOMETRY_BITS) - 1));
+	key = (key << DRAW_KEY_DEPTH_BITS) | depthBits;
+	key = (key << DRAW_KEY_TEXTURE_BITS) | (texture & ((1u << DRAW_KEY_TEXTURE_BITS) - 1));
+
+	return key;
+}
+
+void DrawSorter::sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values)
+{
+	auto count = keys.size();
+	if (count < 2)
+	{
+		return;
+	}
+
+	// histograms of all passes in one read of the keys
+	std::array<std::array<uint32_t, DIGIT_COUNT>, PASS_COUNT> histograms{};
+	for (auto key : keys)
+	{
+		for (uint32_t pass = 0; pass < PASS_COUNT; pass++)
+		{
+			histograms[pass][(key >> (pass * DIGIT_BITS)) & (DIGIT_COUNT - 1)]++;
+		}
+	}
+
+	scratchKeys.resize(count);
+	scratchValues.resize(count);
+
+	for (uint32_t pass = 0; pass < PASS_COUNT; pass++)
+	{
+		auto& histogram = histograms[pass];
+		auto shift = pass * DIGIT_BITS;
+
+		// all keys share this digit (unused key fields), order would not change
+		if (histogram[(keys[0] >> shift) & (DIGIT_COUNT - 1)] == count)
+		{
+			continue;
+		}
+
+		// digit counts to start offsets
+		uint32_t offset = 0;
+		for (auto& bucket : histogram)
+		{
+			auto bucketCount = bucket;
+			bucket = offset;
+			offset += bucketCount;
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			auto destination = histogram[(keys[i] >> shift) & (DIGIT_COUNT - 1)]++;
+			scratchKeys[destination] = keys[i];
+			scratchValues[destination] = values[i];
+		}
+
+		keys.swap(scratchKeys);
+		values.swap(scratchValues);
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// packed 64 bit draw key, compared as an integer, most significant field first
+// | pipeline 4 | geometry 20 | depth 24 | texture 16 |
+// geometry ranks above depth: instances of one draw have to be contiguous, depth orders them front to back inside it
+// textures are bindless, the texture only breaks depth ties
+static inline constexpr const uint32_t DRAW_KEY_PIPELINE_BITS = 4;
+static inline constexpr const uint32_t DRAW_KEY_GEOMETRY_BITS = 20;
+static inline constexpr const uint32_t DRAW_KEY_DEPTH_BITS = 24;
+static inline constexpr const uint32_t DRAW_KEY_TEXTURE_BITS = 16;
+
+// depth is the view space distance, closer draws sort first (front to back)
+uint64_t makeDrawKey(uint32_t pipeline, uint32_t geometry, uint32_t texture, float depth);
+
+// LSD radix sort of (key, value) pairs, 8 bit digits, stable
+// passes whose digit is equal for all keys are skipped, scratch memory is kept between sorts
+class DrawSorter
+{
+public:
+	DrawSorter() = default;
+
+	void sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values);
+
+private:
+	static inline constexpr const uint32_t DIGIT_BITS = 8;
+	static inline constexpr const uint32_t DIGIT_COUNT = 1u << DIGIT_BITS;
+	static inline constexpr const uint32_t PASS_COUNT = 64 / DIGIT_BITS;
+
+	std::vector<uint64_t> scratchKeys;
+	std::vector<uint32_t> scratchValues;
+};
@@ -0,0 +1,87 @@
+#include "FrameStats.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	template<typename Value>
+	CounterSummary summarize(const std::vector<FrameCounters>& frames, std::vector<double>& values, Value value)
+	{
+		CounterSummary summary;
+		if (frames.empty())
+		{
+			return summary;
+		}
+
+		values.clear();
+		for (auto& frame : frames)
+		{
+			values.push_back(static_cast<double>(value(frame)));
+		}
+		std::sort(values.begin(), values.end());
+
+		summary.min = values.front();
+		summary.max = values.back();
+		for (auto v : values)
+		{
+			summary.average += v;
+		}
+		summary.average /= values.size();
+
+		// nearest rank
+		auto rank = static_cast<size_t>(std::ceil(0.99 * values.size()));
+		summary.p99 = values[std::max<size_t>(rank, 1) - 1];
+
+		return summary;
+	}
+}
+
+void FrameStatsWindow::push(const FrameCounters& counters)
+{
+	if (frames.size() < WINDOW_SIZE)
+	{
+		frames.push_back(counters);
+	}
+	else
+	{
+		frames[nextFrame] = counters;
+	}
+	nextFrame = (nextFrame + 1) % WINDOW_SIZE;
+}
+
+void FrameStatsWindow::clear()
+{
+	frames.clear();
+	nextFrame = 0;
+}
+
+FrameStats FrameStatsWindow::getStats() const
+{
+	FrameStats stats;
+	stats.frameCount = static_cast<uint32_t>(frames.size());
+	stats.recordedFrames = static_cast<uint32_t>(std::count_if(frames.begin(), frames.end(), [](const FrameCounters& frame) { return frame.recorded; }));
+
+	std::vector<double> values;
+	values.reserve(frames.size());
+
+	stats.drawCalls = summarize(frames, values, [](const FrameCounters& f) { return f.commands.drawCalls; });
+	stats.indirectDraws = summarize(frames, values, [](const FrameCounters& f) { return f.commands.indirectDraws; });
+	stats.dispatches = summarize(frames, values, [](const FrameCounters& f) { return f.commands.dispatches; });
+	stats.triangles = summarize(frames, values, [](const FrameCounters& f) { return f.triangles; });
+	stats.pipelineBinds = summarize(frames, values, [](const FrameCounters& f) { return f.commands.pipelineBinds; });
+	stats.vertexBufferBinds = summarize(frames, values, [](const FrameCounters& f) { return f.commands.vertexBufferBinds; });
+	stats.indexBufferBinds = summarize(frames, values, [](const FrameCounters& f) { return f.commands.indexBufferBinds; });
+	stats.descriptorSetBinds = summarize(frames, values, [](const FrameCounters& f) { return f.commands.descriptorSetBinds; });
+	stats.pushConstantBytes = summarize(frames, values, [](const FrameCounters& f) { return f.commands.pushConstantBytes; });
+	stats.uploadedBytes = summarize(frames, values, [](const FrameCounters& f) { return f.uploadedBytes; });
+	stats.hostWrittenBytes = summarize(frames, values, [](const FrameCounters& f) { return f.hostWrittenBytes; });
+	stats.allocations = summarize(frames, values, [](const FrameCounters& f) { return f.allocations; });
+	stats.deviceAllocations = summarize(frames, values, [](const FrameCounters& f) { return f.deviceAllocations; });
+	stats.fenceWaitMs = summarize(frames, values, [](const FrameCounters& f) { return f.fenceWaitMs; });
+	stats.acquireWaitMs = summarize(frames, values, [](const FrameCounters& f) { return f.acquireWaitMs; });
+	stats.recordMs = summarize(frames, values, [](const FrameCounters& f) { return f.recordMs; });
+	stats.frameMs = summarize(frames, values, [](const FrameCounters& f) { return f.frameMs; });
+
+	return stats;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// commands of one recording, counted by whoever records them
+struct CommandCounters
+{
+	uint32_t drawCalls = 0;				// indirect draw commands
+	uint32_t indirectDraws = 0;			// draws they issue at most, one per batch
+	uint32_t dispatches = 0;
+	uint32_t pipelineBinds = 0;			// graphics and compute
+	uint32_t vertexBufferBinds = 0;
+	uint32_t indexBufferBinds = 0;
+	uint32_t descriptorSetBinds = 0;	// vkCmdBindDescriptorSets calls
+	uint32_t pushConstantBytes = 0;
+
+	void add(const CommandCounters& other)
+	{
+		drawCalls += other.drawCalls;
+		indirectDraws += other.indirectDraws;
+		dispatches += other.dispatches;
+		pipelineBinds += other.pipelineBinds;
+		vertexBufferBinds += other.vertexBufferBinds;
+		indexBufferBinds += other.indexBufferBinds;
+		descriptorSetBinds += other.descriptorSetBinds;
+		pushConstantBytes += other.pushConstantBytes;
+	}
+};
+
+// everything one draw call did
+struct FrameCounters
+{
+	CommandCounters commands;			// of the command buffer submitted, recorded this frame or earlier
+	uint64_t triangles = 0;				// of the objects left after the cpu culling, the gpu culling may drop more
+	uint64_t uploadedBytes = 0;			// staging copies of UploadContext
+	uint64_t hostWrittenBytes = 0;		// object, uniform and batch data written to mapped buffers
+	uint32_t allocations = 0;			// MemoryAllocator sub allocations
+	uint32_t deviceAllocations = 0;		// vkAllocateMemory calls among them
+	bool recorded = false;				// command buffer was recorded again
+	double fenceWaitMs = 0.0;			// frame and image fences
+	double acquireWaitMs = 0.0;
+	double recordMs = 0.0;				// recordCommands, 0 if the command buffer was reused
+	double frameMs = 0.0;				// whole draw call
+};
+
+// one counter over the window
+struct CounterSummary
+{
+	double min = 0.0;
+	double average = 0.0;
+	double max = 0.0;
+	double p99 = 0.0;
+};
+
+struct FrameStats
+{
+	uint32_t frameCount = 0;			// frames in the window
+	uint32_t recordedFrames = 0;		// frames that recorded their command buffer again
+	CounterSummary drawCalls;
+	CounterSummary indirectDraws;
+	CounterSummary dispatches;
+	CounterSummary triangles;
+	CounterSummary pipelineBinds;
+	CounterSummary vertexBufferBinds;
+	CounterSummary indexBufferBinds;
+	CounterSummary descriptorSetBinds;
+	CounterSummary pushConstantBytes;
+	CounterSummary uploadedBytes;
+	CounterSummary hostWrittenBytes;
+	CounterSummary allocations;
+	CounterSummary deviceAllocations;
+	CounterSummary fenceWaitMs;
+	CounterSummary acquireWaitMs;
+	CounterSummary recordMs;
+	CounterSummary frameMs;
+};
+
+// counters of the last WINDOW_SIZE frames, adding a frame is a copy into a ring
+// the summaries are only computed when asked for
+class FrameStatsWindow
+{
+public:
+	static inline constexpr const uint32_t WINDOW_SIZE = 300;
+
+	FrameStatsWindow() = default;
+
+	void push(const FrameCounters& counters);
+	void clear();
+
+	FrameStats getStats() const;
+
+private:
+	std::vector<FrameCounters> frames;		// ring, at most WINDOW_SIZE
+	uint32_t nextFrame = 0;
+};
@@ -0,0 +1,226 @@
+#include "FrustumCuller.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define FRUSTUM_CULLER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// msvc compiles avx intrinsics without flags, gcc / clang need them enabled per function
+#if defined(FRUSTUM_CULLER_X86) && !defined(_MSC_VER)
+#define FRUSTUM_CULLER_TARGET_AVX __attribute__((target("avx")))
+#else
+#define FRUSTUM_CULLER_TARGET_AVX
+#endif
+
+namespace
+{
+	// avx needs cpu support and the os saving the ymm registers
+	bool isAvxSupported()
+	{
+#if defined(FRUSTUM_CULLER_X86)
+#if defined(_MSC_VER)
+		int cpuInfo[4];
+		__cpuid(cpuInfo, 1);
+		auto osxsave = (cpuInfo[2] & (1 << 27)) != 0;
+		auto avx = (cpuInfo[2] & (1 << 28)) != 0;
+		return osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx");
+#endif
+#else
+		return false;
+#endif
+	}
+}
+
+FrustumCuller::FrustumCuller()
+{
+#if defined(FRUSTUM_CULLER_X86)
+	// sse2 is part of every x64 cpu
+	simdLevel = isAvxSupported() ? SimdLevel::Avx : SimdLevel::Sse;
+#endif
+}
+
+void FrustumCuller::resize(uint32_t newCount)
+{
+	count = newCount;
+	centerX.resize(count);
+	centerY.resize(count);
+	centerZ.resize(count);
+	radius.resize(count);
+}
+
+uint32_t FrustumCuller::size() const
+{
+	return count;
+}
+
+void FrustumCuller::setSphere(uint32_t index, const glm::vec4& sphere)
+{
+	centerX[index] = sphere.x;
+	centerY[index] = sphere.y;
+	centerZ[index] = sphere.z;
+	radius[index] = sphere.w;
+}
+
+void FrustumCuller::cull(const glm::vec4* planes, std::vector<uint32_t>& visibleIndices) const
+{
+	// simd paths store a whole register of candidate indices before advancing, leave room for it
+	visibleIndices.resize(count + LANE_PADDING);
+
+	uint32_t visibleCount = 0;
+	switch (simdLevel)
+	{
+	case SimdLevel::Avx:
+		visibleCount = cullAvx(planes, visibleIndices.data());
+		break;
+	case SimdLevel::Sse:
+		visibleCount = cullSse(planes, visibleIndices.data());
+		break;
+	default:
+		visibleCount = cullScalar(planes, 0, visibleIndices.data());
+		break;
+	}
+
+	visibleIndices.resize(visibleCount);
+}
+
+FrustumCuller::SimdLevel FrustumCuller::getSimdLevel() const
+{
+	return simdLevel;
+}
+
+void FrustumCuller::extractPlanes(const glm::mat4& viewProjection, glm::vec4* planes)
+{
+	// rows of the (column major) matrix
+	auto row = [&](int i) { return glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]); };
+
+	planes[0] = row(3) + row(0);	// left
+	planes[1] = row(3) - row(0);	// right
+	planes[2] = row(3) + row(1);	// bottom
+	planes[3] = row(3) - row(1);	// top
+	planes[4] = row(3) + row(2);	// near, conservative for a [0, 1] depth range as well
+	planes[5] = row(3) - row(2);	// far
+
+	for (uint32_t p = 0; p < 6; p++)
+	{
+		planes[p] /= glm::length(glm::vec3(planes[p]));
+	}
+}
+
+uint32_t FrustumCuller::cullScalar(const glm::vec4* planes, uint32_t first, uint32_t* visibleIndices) const
+{
+	uint32_t visibleCount = 0;
+	for (auto i = first; i < count; i++)
+	{
+		auto inside = true;
+		for (uint32_t p = 0; p < 6; p++)
+		{
+			auto distance = planes[p].x * centerX[i] + planes[p].y * centerY[i] + planes[p].z * centerZ[i] + planes[p].w;
+			inside &= distance >= -radius[i];
+		}
+
+		// branchless append
+		visibleIndices[visibleCount] = i;
+		visibleCount += inside ? 1 : 0;
+	}
+
+	return visibleCount;
+}
+
+uint32_t FrustumCuller::cullSse(const glm::vec4* planes, uint32_t* visibleIndices) const
+{
+#if defined(FRUSTUM_CULLER_X86)
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (uint32_t p = 0; p < 6; p++)
+	{
+		planeX[p] = _mm_set1_ps(planes[p].x);
+		planeY[p] = _mm_set1_ps(planes[p].y);
+		planeZ[p] = _mm_set1_ps(planes[p].z);
+		planeW[p] = _mm_set1_ps(planes[p].w);
+	}
+
+	auto zero = _mm_setzero_ps();
+	auto simdCount = count & ~3u;
+	uint32_t visibleCount = 0;
+
+	for (uint32_t i = 0; i < simdCount; i += 4)
+	{
+		auto x = _mm_loadu_ps(&centerX[i]);
+		auto y = _mm_loadu_ps(&centerY[i]);
+		auto z = _mm_loadu_ps(&centerZ[i]);
+		auto negRadius = _mm_sub_ps(zero, _mm_loadu_ps(&radius[i]));
+
+		// all bits set in lanes that are inside every plane so far
+		auto inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (uint32_t p = 0; p < 6; p++)
+		{
+			auto distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+				_mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+		}
+
+		auto mask = static_cast<uint32_t>(_mm_movemask_ps(inside));
+		for (uint32_t lane = 0; lane < 4; lane++)
+		{
+			visibleIndices[visibleCount] = i + lane;
+			visibleCount += (mask >> lane) & 1;
+		}
+	}
+
+	return visibleCount + cullScalar(planes, simdCount, visibleIndices + visibleCount);
+#else
+	return cullScalar(planes, 0, visibleIndices);
+#endif
+}
+
+FRUSTUM_CULLER_TARGET_AVX
+uint32_t FrustumCuller::cullAvx(const glm::vec4* planes, uint32_t* visibleIndices) const
+{
+#if defined(FRUSTUM_CULLER_X86)
+	__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (uint32_t p = 0; p < 6; p++)
+	{
+		planeX[p] = _mm256_set1_ps(planes[p].x);
+		planeY[p] = _mm256_set1_ps(planes[p].y);
+		planeZ[p] = _mm256_set1_ps(planes[p].z);
+		planeW[p] = _mm256_set1_ps(planes[p].w);
+	}
+
+	auto zero = _mm256_setzero_ps();
+	auto simdCount = count & ~7u;
+	uint32_t visibleCount = 0;
+
+	for (uint32_t i = 0; i < simdCount; i += 8)
+	{
+		auto x = _mm256_loadu_ps(&centerX[i]);
+		auto y = _mm256_loadu_ps(&centerY[i]);
+		auto z = _mm256_loadu_ps(&centerZ[i]);
+		auto negRadius = _mm256_sub_ps(zero, _mm256_loadu_ps(&radius[i]));
+
+		// all bits set in lanes that are inside every plane so far
+		auto inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (uint32_t p = 0; p < 6; p++)
+		{
+			auto distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planeX[p], x), _mm256_mul_ps(planeY[p], y)),
+				_mm256_add_ps(_mm256_mul_ps(planeZ[p], z), planeW[p]));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+		}
+
+		auto mask = static_cast<uint32_t>(_mm256_movemask_ps(inside));
+		for (uint32_t lane = 0; lane < 8; lane++)
+		{
+			visibleIndices[visibleCount] = i + lane;
+			visibleCount += (mask >> lane) & 1;
+		}
+	}
+
+	return visibleCount + cullScalar(planes, simdCount, visibleIndices + visibleCount);
+#else
+	return cullScalar(planes, 0, visibleIndices);
+#endif
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// frustum culling of bounding spheres on the cpu
+// spheres are stored as structure of arrays so 4 (SSE) or 8 (AVX) of them are tested per instruction
+// the instruction set is picked once at runtime, a scalar path is used on other cpus
+class FrustumCuller
+{
+public:
+	enum class SimdLevel
+	{
+		Scalar,
+		Sse,
+		Avx
+	};
+
+	FrustumCuller();
+
+	// number of spheres, contents are undefined until set
+	void resize(uint32_t newCount);
+	uint32_t size() const;
+
+	// xyz center, w radius, in world space
+	void setSphere(uint32_t index, const glm::vec4& sphere);
+
+	// test all spheres against the 6 planes (xyz normal pointing inside, w distance)
+	// writes the indices of the spheres at least partially inside to visibleIndices, in increasing order
+	void cull(const glm::vec4* planes, std::vector<uint32_t>& visibleIndices) const;
+
+	SimdLevel getSimdLevel() const;
+
+	// the 6 planes of the view frustum of viewProjection, normalized
+	static void extractPlanes(const glm::mat4& viewProjection, glm::vec4* planes);
+
+private:
+	// only the output index vector is padded, by one AVX register of candidate indices past the visible ones
+	// the sphere arrays are not, spheres past the last full register go through the scalar path
+	static inline constexpr const uint32_t LANE_PADDING = 8;
+
+	uint32_t cullScalar(const glm::vec4* planes, uint32_t first, uint32_t* visibleIndices) const;
+	uint32_t cullSse(const glm::vec4* planes, uint32_t* visibleIndices) const;
+	uint32_t cullAvx(const glm::vec4* planes, uint32_t* visibleIndices) const;
+
+	SimdLevel simdLevel = SimdLevel::Scalar;
+
+	uint32_t count = 0;
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> radius;
+};
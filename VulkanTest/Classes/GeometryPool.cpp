@@ -0,0 +1,104 @@
+#include "GeometryPool.h"
+
+#include <algorithm>
+
+static inline constexpr const VkBufferUsageFlags VERTEX_POOL_USAGE = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+static inline constexpr const VkBufferUsageFlags INDEX_POOL_USAGE = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+
+void GeometryPool::init(VkDevice newDevice, MemoryAllocator* newAllocator, UploadContext* newUploadContext,
+	uint32_t vertexCapacity, uint32_t indexCapacity)
+{
+	device = newDevice;
+	allocator = newAllocator;
+	uploadContext = newUploadContext;
+
+	// transfer src so the contents can be copied over when growing
+	createBuffer(device, *allocator, sizeof(Vertex) * static_cast<VkDeviceSize>(vertexCapacity), VERTEX_POOL_USAGE,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+	createBuffer(device, *allocator, sizeof(uint32_t) * static_cast<VkDeviceSize>(indexCapacity), INDEX_POOL_USAGE,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+
+	vertexRanges = RangeAllocator(vertexCapacity);
+	indexRanges = RangeAllocator(indexCapacity);
+}
+
+void GeometryPool::cleanup()
+{
+	destroyBuffer(device, *allocator, indexBuffer, indexBufferMemory);
+	destroyBuffer(device, *allocator, vertexBuffer, vertexBufferMemory);
+}
+
+GeometryRange GeometryPool::allocate(uint32_t vertexCount, uint32_t indexCount)
+{
+	// the range allocator has no empty ranges, a zero count would look like a full pool and grow it
+	if (vertexCount == 0 || indexCount == 0)
+	{
+		throw std::runtime_error("Geometry needs at least one vertex and one index!");
+	}
+
+	GeometryRange range;
+	range.vertexCount = vertexCount;
+	range.indexCount = indexCount;
+
+	auto vertexOffset = vertexRanges.allocate(vertexCount);
+	if (vertexOffset == RangeAllocator::INVALID_OFFSET)
+	{
+		// at least double, so growing stays rare
+		auto oldCapacity = vertexRanges.getSize();
+		auto newCapacity = std::max(oldCapacity * 2, oldCapacity + vertexCount);
+		growBuffer(vertexBuffer, vertexBufferMemory, VERTEX_POOL_USAGE, sizeof(Vertex) * oldCapacity, sizeof(Vertex) * newCapacity);
+		vertexRanges.grow(newCapacity);
+		vertexOffset = vertexRanges.allocate(vertexCount);
+	}
+
+	auto firstIndex = indexRanges.allocate(indexCount);
+	if (firstIndex == RangeAllocator::INVALID_OFFSET)
+	{
+		auto oldCapacity = indexRanges.getSize();
+		auto newCapacity = std::max(oldCapacity * 2, oldCapacity + indexCount);
+		growBuffer(indexBuffer, indexBufferMemory, INDEX_POOL_USAGE, sizeof(uint32_t) * oldCapacity, sizeof(uint32_t) * newCapacity);
+		indexRanges.grow(newCapacity);
+		firstIndex = indexRanges.allocate(indexCount);
+	}
+
+	range.vertexOffset = static_cast<uint32_t>(vertexOffset);
+	range.firstIndex = static_cast<uint32_t>(firstIndex);
+
+	return range;
+}
+
+void GeometryPool::free(const GeometryRange& range)
+{
+	vertexRanges.free(range.vertexOffset, range.vertexCount);
+	indexRanges.free(range.firstIndex, range.indexCount);
+}
+
+VkBuffer GeometryPool::getVertexBuffer() const
+{
+	return vertexBuffer;
+}
+
+VkBuffer GeometryPool::getIndexBuffer() const
+{
+	return indexBuffer;
+}
+
+void GeometryPool::growBuffer(VkBuffer& buffer, MemoryAllocation& bufferMemory, VkBufferUsageFlags usage, VkDeviceSize oldSize, VkDeviceSize newSize)
+{
+	VkBuffer newBuffer;
+	MemoryAllocation newBufferMemory;
+	createBuffer(device, *allocator, newSize, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, newBuffer, newBufferMemory);
+
+	// finish uploads already recorded against the old buffer, it may also still be used by command buffers in flight
+	uploadContext->flush();
+	vkDeviceWaitIdle(device);
+
+	// copy existing geometry, offsets stay valid
+	uploadContext->copyBuffer(buffer, newBuffer, oldSize);
+	uploadContext->flush();
+
+	destroyBuffer(device, *allocator, buffer, bufferMemory);
+
+	buffer = newBuffer;
+	bufferMemory = newBufferMemory;
+}
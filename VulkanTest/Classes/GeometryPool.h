@@ -0,0 +1,56 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "Utilities.h"
+#include "RangeAllocator.h"
+#include "UploadContext.h"
+
+// location of a mesh inside the shared vertex and index buffers
+struct GeometryRange
+{
+	uint32_t vertexOffset = 0;		// first vertex, passed as vertexOffset to vkCmdDrawIndexed
+	uint32_t vertexCount = 0;
+	uint32_t firstIndex = 0;		// first index, passed as firstIndex to vkCmdDrawIndexed
+	uint32_t indexCount = 0;
+};
+
+// one device local vertex buffer and one index buffer shared by all meshes
+// so the draw loop only has to bind them once
+class GeometryPool
+{
+public:
+	static inline constexpr const uint32_t DEFAULT_VERTEX_CAPACITY = 1024 * 1024;
+	static inline constexpr const uint32_t DEFAULT_INDEX_CAPACITY = 4 * 1024 * 1024;
+
+	GeometryPool() = default;
+
+	void init(VkDevice newDevice, MemoryAllocator* newAllocator, UploadContext* newUploadContext,
+		uint32_t vertexCapacity = DEFAULT_VERTEX_CAPACITY, uint32_t indexCapacity = DEFAULT_INDEX_CAPACITY);
+	void cleanup();
+
+	// reserve space for a mesh, grows the buffers if they are full
+	GeometryRange allocate(uint32_t vertexCount, uint32_t indexCount);
+	void free(const GeometryRange& range);
+
+	VkBuffer getVertexBuffer() const;
+	VkBuffer getIndexBuffer() const;
+
+private:
+	void growBuffer(VkBuffer& buffer, MemoryAllocation& bufferMemory, VkBufferUsageFlags usage, VkDeviceSize oldSize, VkDeviceSize newSize);
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+
+	// used to copy old contents when growing
+	UploadContext* uploadContext = nullptr;
+
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	MemoryAllocation vertexBufferMemory;
+	RangeAllocator vertexRanges;		// in vertices
+
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	MemoryAllocation indexBufferMemory;
+	RangeAllocator indexRanges;			// in indices
+};
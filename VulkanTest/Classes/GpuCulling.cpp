@@ -0,0 +1,374 @@
+#include "GpuCulling.h"
+#include "FrustumCuller.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+void GpuCulling::init(VkPhysicalDevice physicalDevice, VkDevice newDevice, MemoryAllocator* newAllocator, ShaderLibrary* shaderLibrary,
+	PipelineCache* pipelineCache, uint32_t newImageCount, VkBuffer uniformBuffer, const HiZPyramid* newDepthPyramid, bool newCompactDraws)
+{
+	device = newDevice;
+	allocator = newAllocator;
+	imageCount = newImageCount;
+	frustumBuffer = uniformBuffer;
+	depthPyramid = newDepthPyramid;
+	compactDraws = newCompactDraws;
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+	storageAlignment = deviceProperties.limits.minStorageBufferOffsetAlignment;
+
+	createPipeline(shaderLibrary, pipelineCache);
+	createDescriptorSets();
+}
+
+void GpuCulling::cleanup()
+{
+	destroyBuffers();
+
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+	vkDestroyPipeline(device, pipeline, nullptr);
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+}
+
+bool GpuCulling::reserve(uint32_t newObjectCapacity, uint32_t newBatchCapacity)
+{
+	if (newObjectCapacity <= objectCapacity && newBatchCapacity <= batchCapacity)
+	{
+		return false;
+	}
+
+	// at least double, so growing stays rare
+	objectCapacity = std::max({ newObjectCapacity, objectCapacity * 2, 1u });
+	batchCapacity = std::max({ newBatchCapacity, batchCapacity * 2, INITIAL_BATCH_CAPACITY });
+
+	destroyBuffers();
+	createBuffers();
+	updateDescriptorSets();
+
+	return true;
+}
+
+void GpuCulling::setObjectBuffer(VkBuffer buffer, VkDeviceSize regionSize, uint32_t newObjectCapacity)
+{
+	objectBuffer = buffer;
+	objectRegionSize = regionSize;
+
+	// visible list needs room for every object
+	if (!reserve(newObjectCapacity, batchCapacity))
+	{
+		updateDescriptorSets();
+	}
+}
+
+void GpuCulling::writeBatches(uint32_t imageIndex, const std::vector<CullBatch>& batches)
+{
+	auto data = static_cast<char*>(batchBuffer.memory.mappedData) + batchBuffer.regionSize * imageIndex;
+	memcpy(data, batches.data(), sizeof(CullBatch) * batches.size());
+}
+
+void GpuCulling::recordCull(VkCommandBuffer commandBuffer, uint32_t imageIndex, CullPhase phase, uint32_t frustumOffset, uint32_t objectCount, uint32_t batchCount,
+	CommandCounters& counters)
+{
+	VkMemoryBarrier memoryBarrier{};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+
+	if (phase == CullPhase::Early)
+	{
+		// counts start at zero every frame
+		vkCmdFillBuffer(commandBuffer, countBuffer.buffer, countBuffer.regionSize * imageIndex, countBuffer.regionSize, 0);
+
+		// the depth pyramid was last written by the previous frame
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+	else
+	{
+		// early counts and object states are complete
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[imageIndex], 1, &frustumOffset);
+
+	auto firstPass = phase == CullPhase::Early ? 0u : 2u;
+
+	CullParams params{};
+	params.objectCount = objectCount;
+	params.batchCount = batchCount;
+	params.batchCapacity = batchCapacity;
+	params.compactDraws = compactDraws ? 1 : 0;
+	params.pyramidLevels = depthPyramid->getLevelCount();
+	params.depthSize[0] = static_cast<float>(depthPyramid->getDepthWidth());
+	params.depthSize[1] = static_cast<float>(depthPyramid->getDepthHeight());
+
+	// cull objects
+	params.pass = firstPass;
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullParams), &params);
+	vkCmdDispatch(commandBuffer, (objectCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+	// instance counts complete before the draws are written
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+	// write draws
+	params.pass = firstPass + 1;
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullParams), &params);
+	vkCmdDispatch(commandBuffer, (batchCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+	// draws and visible list are read by indirect draws and the vertex shader
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0,
+		1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+	counters.pipelineBinds++;
+	counters.descriptorSetBinds++;
+	counters.dispatches += 2;
+	counters.pushConstantBytes += 2 * sizeof(CullParams);
+}
+
+void GpuCulling::recordDraws(VkCommandBuffer commandBuffer, uint32_t imageIndex, CullPhase phase, uint32_t drawGroup, uint32_t firstBatch, uint32_t batchCount,
+	CommandCounters& counters)
+{
+	// late draws and counts follow the early ones
+	VkDeviceSize phaseIndex = phase == CullPhase::Early ? 0 : 1;
+	auto drawOffset = drawBuffer.regionSize * imageIndex + sizeof(VkDrawIndexedIndirectCommand) * (phaseIndex * batchCapacity + firstBatch);
+
+	if (compactDraws)
+	{
+		// visible draws of the group are packed at its start, the gpu provides their count
+		auto countOffset = countBuffer.regionSize * imageIndex + sizeof(uint32_t) * ((2 + phaseIndex) * batchCapacity + drawGroup);
+		vkCmdDrawIndexedIndirectCount(commandBuffer, drawBuffer.buffer, drawOffset, countBuffer.buffer, countOffset, batchCount,
+			sizeof(VkDrawIndexedIndirectCommand));
+	}
+	else
+	{
+		// culled batches are draws with zero instances
+		vkCmdDrawIndexedIndirect(commandBuffer, drawBuffer.buffer, drawOffset, batchCount, sizeof(VkDrawIndexedIndirectCommand));
+	}
+
+	counters.drawCalls++;
+	counters.indirectDraws += batchCount;
+}
+
+uint32_t GpuCulling::getBatchCapacity() const
+{
+	return batchCapacity;
+}
+
+VkBuffer GpuCulling::getVisibleBuffer() const
+{
+	return visibleBuffer.buffer;
+}
+
+VkDeviceSize GpuCulling::getVisibleRegionSize() const
+{
+	return visibleBuffer.regionSize;
+}
+
+uint32_t GpuCulling::getObjectCapacity() const
+{
+	return objectCapacity;
+}
+
+UboFrustum GpuCulling::extractFrustum(const glm::mat4& viewProjection)
+{
+	UboFrustum frustum;
+	FrustumCuller::extractPlanes(viewProjection, frustum.planes);
+
+	return frustum;
+}
+
+void GpuCulling::createPipeline(ShaderLibrary* shaderLibrary, PipelineCache* pipelineCache)
+{
+	auto shaderModule = shaderLibrary->getModule("cull.spv");
+
+	// frustum + object, batch, visible, draw, count buffers + depth pyramid + object state buffer
+	std::array<VkDescriptorSetLayoutBinding, 8> layoutBindings{};
+	for (uint32_t i = 0; i < layoutBindings.size(); i++)
+	{
+		layoutBindings[i].binding = i;
+		layoutBindings[i].descriptorType = getDescriptorType(i);
+		layoutBindings[i].descriptorCount = 1;
+		layoutBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+	layoutCreateInfo.pBindings = layoutBindings.data();
+
+	auto result = vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &descriptorSetLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create cull descriptor set layout!");
+	}
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(CullParams);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create cull pipeline layout!");
+	}
+
+	VkComputePipelineCreateInfo pipelineCreateInfo{};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = shaderModule;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.layout = pipelineLayout;
+
+	result = pipelineCache->createComputePipeline(pipelineCreateInfo, pipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create cull pipeline!");
+	}
+}
+
+void GpuCulling::createDescriptorSets()
+{
+	std::array<VkDescriptorPoolSize, 3> poolSizes{};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSizes[0].descriptorCount = imageCount;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount = imageCount * 6;
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[2].descriptorCount = imageCount;
+
+	VkDescriptorPoolCreateInfo poolCreateInfo{};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = imageCount;
+	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+
+	auto result = vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &descriptorPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create cull descriptor pool!");
+	}
+
+	std::vector<VkDescriptorSetLayout> setLayouts(imageCount, descriptorSetLayout);
+
+	VkDescriptorSetAllocateInfo setAllocInfo{};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = descriptorPool;
+	setAllocInfo.descriptorSetCount = imageCount;
+	setAllocInfo.pSetLayouts = setLayouts.data();
+
+	descriptorSets.resize(imageCount);
+	result = vkAllocateDescriptorSets(device, &setAllocInfo, descriptorSets.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate cull descriptor sets!");
+	}
+}
+
+void GpuCulling::createBuffers()
+{
+	// batches are written by the host every frame, everything else only ever by the cull shader
+	const VkMemoryPropertyFlags hostMemory = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	const VkMemoryPropertyFlags gpuMemory = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+	createRegionBuffer(batchBuffer, sizeof(CullBatch) * static_cast<VkDeviceSize>(batchCapacity), hostMemory);
+	createRegionBuffer(visibleBuffer, sizeof(uint32_t) * static_cast<VkDeviceSize>(objectCapacity), gpuMemory);
+	createRegionBuffer(drawBuffer, sizeof(VkDrawIndexedIndirectCommand) * 2 * static_cast<VkDeviceSize>(batchCapacity), gpuMemory);
+	createRegionBuffer(countBuffer, sizeof(uint32_t) * 4 * static_cast<VkDeviceSize>(batchCapacity), gpuMemory);	// a group has at least one batch
+	createRegionBuffer(stateBuffer, sizeof(uint32_t) * static_cast<VkDeviceSize>(objectCapacity), gpuMemory);
+}
+
+void GpuCulling::destroyBuffers()
+{
+	for (auto regionBuffer : { &batchBuffer, &visibleBuffer, &drawBuffer, &countBuffer, &stateBuffer })
+	{
+		if (regionBuffer->buffer != VK_NULL_HANDLE)
+		{
+			destroyBuffer(device, *allocator, regionBuffer->buffer, regionBuffer->memory);
+			regionBuffer->buffer = VK_NULL_HANDLE;
+		}
+	}
+}
+
+void GpuCulling::updateDescriptorSets()
+{
+	// nothing to point to yet
+	if (objectBuffer == VK_NULL_HANDLE || batchBuffer.buffer == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	for (uint32_t i = 0; i < imageCount; i++)
+	{
+		std::array<VkDescriptorBufferInfo, 8> bufferInfos{};
+		bufferInfos[0] = { frustumBuffer, 0, sizeof(UboFrustum) };
+		bufferInfos[1] = { objectBuffer, objectRegionSize * i, objectRegionSize };
+		bufferInfos[2] = { batchBuffer.buffer, batchBuffer.regionSize * i, batchBuffer.regionSize };
+		bufferInfos[3] = { visibleBuffer.buffer, visibleBuffer.regionSize * i, visibleBuffer.regionSize };
+		bufferInfos[4] = { drawBuffer.buffer, drawBuffer.regionSize * i, drawBuffer.regionSize };
+		bufferInfos[5] = { countBuffer.buffer, countBuffer.regionSize * i, countBuffer.regionSize };
+		bufferInfos[7] = { stateBuffer.buffer, stateBuffer.regionSize * i, stateBuffer.regionSize };
+
+		VkDescriptorImageInfo pyramidInfo{ depthPyramid->getSampler(), depthPyramid->getImageView(), VK_IMAGE_LAYOUT_GENERAL };
+
+		std::array<VkWriteDescriptorSet, 8> setWrites{};
+		for (uint32_t k = 0; k < setWrites.size(); k++)
+		{
+			setWrites[k].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			setWrites[k].dstSet = descriptorSets[i];
+			setWrites[k].dstBinding = k;
+			setWrites[k].dstArrayElement = 0;
+			setWrites[k].descriptorType = getDescriptorType(k);
+			setWrites[k].descriptorCount = 1;
+			if (k == PYRAMID_BINDING)
+			{
+				setWrites[k].pImageInfo = &pyramidInfo;
+			}
+			else
+			{
+				setWrites[k].pBufferInfo = &bufferInfos[k];
+			}
+		}
+
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
+	}
+}
+
+void GpuCulling::createRegionBuffer(RegionBuffer& regionBuffer, VkDeviceSize size, VkMemoryPropertyFlags memoryProperties)
+{
+	// regions are bound as storage buffers and used as indirect / count buffer offsets
+	regionBuffer.regionSize = alignUp(std::max(size, VkDeviceSize(4)), std::max(storageAlignment, VkDeviceSize(4)));
+
+	createBuffer(device, *allocator, regionBuffer.regionSize * imageCount,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		memoryProperties, regionBuffer.buffer, regionBuffer.memory);
+}
+
+VkDescriptorType GpuCulling::getDescriptorType(uint32_t binding)
+{
+	if (binding == 0)
+	{
+		return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	}
+	return binding == PYRAMID_BINDING ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+}
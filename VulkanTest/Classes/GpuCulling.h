@@ -0,0 +1,163 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Utilities.h"
+#include "FrameStats.h"
+#include "HiZPyramid.h"
+#include "PipelineCache.h"
+#include "ShaderLibrary.h"
+
+// ObjectData::flags
+static inline constexpr const uint32_t OBJECT_FLAG_HIDDEN = 1u << 0;		// never drawn
+static inline constexpr const uint32_t OBJECT_FLAG_NO_CULL = 1u << 1;		// drawn without frustum or occlusion test
+static inline constexpr const uint32_t OBJECT_FLAG_FRUSTUM_VISIBLE = 1u << 2;	// frustum test passed on the cpu, still occlusion tested
+
+// per object data read by cull.comp and shader.vert
+struct ObjectData
+{
+	glm::mat4 model;
+	glm::vec4 boundingSphere;	// xyz center, w radius, in model space
+	uint32_t batchIndex;		// draw batch the object is an instance of
+	uint32_t textureIndex;		// element of the bindless texture array
+	uint32_t flags;				// OBJECT_FLAG_*
+	uint32_t padding;
+};
+
+// one instanced draw before culling, layout matches BatchData in cull.comp
+struct CullBatch
+{
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t firstInstance;		// start of the instance range in the visible object list
+	uint32_t drawGroup;			// draws of a group share their bindings and one draw count
+	uint32_t groupFirstDraw;	// first indirect draw of the group
+	uint32_t padding[2];
+};
+
+struct UboFrustum
+{
+	glm::vec4 planes[6];				// xyz normal pointing inside, w distance
+	glm::mat4 viewProjection;			// late phase, the depth pyramid holds the early draws of this frame
+	glm::mat4 previousViewProjection;	// early phase, the depth pyramid holds the previous frame
+	uint32_t earlyOcclusion;			// 0 skips the occlusion test of the phase
+	uint32_t lateOcclusion;
+	uint32_t padding[2];
+};
+
+// frustum / occlusion culling and indirect draw generation on the gpu
+// cull.comp writes the visible object list and indirect draws into per image regions,
+// draws then consume them with vkCmdDrawIndexedIndirectCount (or vkCmdDrawIndexedIndirect with empty draws if unsupported)
+// culling runs in two phases, objects found occluded by the early phase are tested again after the early draws
+// and drawn by the late phase if they are visible after all
+class GpuCulling
+{
+public:
+	enum class CullPhase
+	{
+		Early,
+		Late
+	};
+
+	static inline constexpr const uint32_t WORKGROUP_SIZE = 64;
+	static inline constexpr const uint32_t INITIAL_BATCH_CAPACITY = 256;
+
+	GpuCulling() = default;
+
+	// frustum planes are read from uniformBuffer at the dynamic offset passed to recordCull
+	// occlusion is tested against depthPyramid, it has to stay alive until cleanup
+	void init(VkPhysicalDevice physicalDevice, VkDevice newDevice, MemoryAllocator* newAllocator, ShaderLibrary* shaderLibrary,
+		PipelineCache* pipelineCache, uint32_t newImageCount, VkBuffer uniformBuffer, const HiZPyramid* newDepthPyramid, bool newCompactDraws);
+	void cleanup();
+
+	// grow buffers to hold objectCapacity objects and batchCapacity batches per image
+	// returns true if buffers were recreated, device has to be idle then and recorded command buffers are invalid
+	bool reserve(uint32_t objectCapacity, uint32_t batchCapacity);
+
+	// object buffer the culling reads, one region of regionSize bytes per image
+	void setObjectBuffer(VkBuffer buffer, VkDeviceSize regionSize, uint32_t objectCapacity);
+
+	// batch table of the image, has to be written before a command buffer using it is submitted
+	void writeBatches(uint32_t imageIndex, const std::vector<CullBatch>& batches);
+
+	// run the culling passes of a phase, outside of a render pass
+	// the early phase resets the counts, the late phase has to follow it after the depth pyramid was rebuilt from the early draws
+	// recorded commands are added to counters
+	void recordCull(VkCommandBuffer commandBuffer, uint32_t imageIndex, CullPhase phase, uint32_t frustumOffset, uint32_t objectCount, uint32_t batchCount,
+		CommandCounters& counters);
+
+	// draw the batches [firstBatch, firstBatch + batchCount) of drawGroup for a phase, pipeline and descriptor sets are bound by the caller
+	void recordDraws(VkCommandBuffer commandBuffer, uint32_t imageIndex, CullPhase phase, uint32_t drawGroup, uint32_t firstBatch, uint32_t batchCount,
+		CommandCounters& counters);
+
+	VkBuffer getVisibleBuffer() const;
+	VkDeviceSize getVisibleRegionSize() const;
+	uint32_t getObjectCapacity() const;
+	uint32_t getBatchCapacity() const;
+
+	// planes of the view frustum of viewProjection, normalized
+	static UboFrustum extractFrustum(const glm::mat4& viewProjection);
+
+private:
+	static inline constexpr const uint32_t PYRAMID_BINDING = 6;
+
+	struct CullParams
+	{
+		uint32_t objectCount;
+		uint32_t batchCount;
+		uint32_t batchCapacity;		// stride of the early / late sections in the draw and count buffers
+		uint32_t pass;
+		uint32_t compactDraws;
+		uint32_t pyramidLevels;
+		float depthSize[2];
+	};
+
+	struct RegionBuffer
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		MemoryAllocation memory;
+		VkDeviceSize regionSize = 0;	// bytes per image
+	};
+
+	void createPipeline(ShaderLibrary* shaderLibrary, PipelineCache* pipelineCache);
+	void createDescriptorSets();
+	void createBuffers();
+	void destroyBuffers();
+	void updateDescriptorSets();
+
+	void createRegionBuffer(RegionBuffer& regionBuffer, VkDeviceSize size, VkMemoryPropertyFlags memoryProperties);
+
+	static VkDescriptorType getDescriptorType(uint32_t binding);
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+	VkDeviceSize storageAlignment = 0;
+	uint32_t imageCount = 0;
+	bool compactDraws = false;
+	const HiZPyramid* depthPyramid = nullptr;
+
+	VkBuffer frustumBuffer = VK_NULL_HANDLE;
+	VkBuffer objectBuffer = VK_NULL_HANDLE;
+	VkDeviceSize objectRegionSize = 0;
+
+	uint32_t objectCapacity = 0;
+	uint32_t batchCapacity = 0;
+
+	RegionBuffer batchBuffer;		// CullBatch per batch, written by the host
+	RegionBuffer visibleBuffer;		// object index per visible instance
+	RegionBuffer drawBuffer;		// VkDrawIndexedIndirectCommand per batch and phase
+	RegionBuffer countBuffer;		// instance count per batch and phase + draw count per group and phase
+	RegionBuffer stateBuffer;		// early phase result per object, the late phase retests the occluded ones
+
+	VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> descriptorSets;	// one per image, regions are fixed
+
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+};
@@ -0,0 +1,257 @@
+#include "GpuProfiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+GpuProfiler::Scope::Scope(GpuProfiler& newProfiler, VkCommandBuffer newCommandBuffer, uint32_t newImage, uint32_t newScope)
+	: profiler(newProfiler), commandBuffer(newCommandBuffer), image(newImage), scope(newScope)
+{
+	profiler.recordBegin(commandBuffer, image, scope);
+}
+
+GpuProfiler::Scope::~Scope()
+{
+	profiler.recordEnd(commandBuffer, image, scope);
+}
+
+void GpuProfiler::init(VkPhysicalDevice physicalDevice, VkDevice newDevice, uint32_t queueFamily, uint32_t imageCount)
+{
+	device = newDevice;
+
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+	auto validBits = queueFamily < queueFamilyCount ? queueFamilies[queueFamily].timestampValidBits : 0;
+	if (validBits == 0)
+	{
+		printf("Timestamps not supported by the graphics queue, gpu profiling disabled\n");
+		return;
+	}
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	timestampPeriod = properties.limits.timestampPeriod;
+	timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+	VkQueryPoolCreateInfo queryPoolCreateInfo{};
+	queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolCreateInfo.queryCount = MAX_SCOPES * 2;
+
+	queryPools.resize(imageCount, VK_NULL_HANDLE);
+	for (auto& queryPool : queryPools)
+	{
+		auto result = vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &queryPool);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create a timestamp query pool!");
+		}
+	}
+
+	recordedScopes.assign(imageCount, std::vector<uint8_t>(MAX_SCOPES, 0));
+	submitted.assign(imageCount, false);
+	results.resize(MAX_SCOPES * 4);
+	supported = true;
+}
+
+void GpuProfiler::cleanup()
+{
+	for (auto queryPool : queryPools)
+	{
+		vkDestroyQueryPool(device, queryPool, nullptr);
+	}
+	queryPools.clear();
+	supported = false;
+}
+
+bool GpuProfiler::isSupported() const
+{
+	return supported;
+}
+
+uint32_t GpuProfiler::getScopeId(const std::string& name)
+{
+	auto scopeId = scopeIds.find(name);
+	if (scopeId != scopeIds.end())
+	{
+		return scopeId->second;
+	}
+
+	if (scopes.size() == MAX_SCOPES)
+	{
+		return INVALID_SCOPE;
+	}
+
+	auto id = static_cast<uint32_t>(scopes.size());
+	scopes.push_back({ name, {}, 0, 0.0 });
+	scopeIds[name] = id;
+	return id;
+}
+
+void GpuProfiler::recordReset(VkCommandBuffer commandBuffer, uint32_t image)
+{
+	if (!supported)
+	{
+		return;
+	}
+
+	// the whole pool, the scopes of the new recording may differ from the old one
+	vkCmdResetQueryPool(commandBuffer, queryPools[image], 0, MAX_SCOPES * 2);
+	std::fill(recordedScopes[image].begin(), recordedScopes[image].end(), 0);
+	submitted[image] = false;
+}
+
+void GpuProfiler::recordBegin(VkCommandBuffer commandBuffer, uint32_t image, uint32_t scope, VkPipelineStageFlagBits stage)
+{
+	if (!supported || scope == INVALID_SCOPE)
+	{
+		return;
+	}
+
+	// each thread writes the flags of its own scopes only
+	recordedScopes[image][scope] = 1;
+	vkCmdWriteTimestamp(commandBuffer, stage, queryPools[image], scope * 2);
+}
+
+void GpuProfiler::recordEnd(VkCommandBuffer commandBuffer, uint32_t image, uint32_t scope, VkPipelineStageFlagBits stage)
+{
+	if (!supported || scope == INVALID_SCOPE)
+	{
+		return;
+	}
+
+	vkCmdWriteTimestamp(commandBuffer, stage, queryPools[image], scope * 2 + 1);
+}
+
+void GpuProfiler::markSubmitted(uint32_t image)
+{
+	if (supported)
+	{
+		submitted[image] = true;
+	}
+}
+
+void GpuProfiler::collect(uint32_t image)
+{
+	if (!supported || !submitted[image])
+	{
+		return;
+	}
+	submitted[image] = false;
+
+	auto& recorded = recordedScopes[image];
+	auto scopeEnd = static_cast<uint32_t>(std::distance(std::find(recorded.rbegin(), recorded.rend(), 1), recorded.rend()));
+	if (scopeEnd == 0)
+	{
+		return;
+	}
+
+	// no wait, queries not written (or not finished for some reason) come back with availability 0 and are skipped
+	// VK_NOT_READY is expected whenever a scope in the range was not recorded
+	auto result = vkGetQueryPoolResults(device, queryPools[image], 0, scopeEnd * 2, scopeEnd * 4 * sizeof(uint64_t), results.data(),
+		2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+	if (result != VK_SUCCESS && result != VK_NOT_READY)
+	{
+		return;
+	}
+
+	for (uint32_t s = 0; s < scopeEnd; s++)
+	{
+		auto begin = &results[s * 4];
+		auto end = &results[s * 4 + 2];
+		if (!recorded[s] || begin[1] == 0 || end[1] == 0)
+		{
+			continue;
+		}
+
+		// masked difference survives a counter wrap
+		auto ticks = (end[0] - begin[0]) & timestampMask;
+		auto milliseconds = static_cast<double>(ticks) * timestampPeriod / 1000000.0;
+
+		auto& scope = scopes[s];
+		if (scope.samples.size() < HISTORY_SIZE)
+		{
+			scope.samples.push_back(milliseconds);
+		}
+		else
+		{
+			scope.samples[scope.nextSample] = milliseconds;
+		}
+		scope.nextSample = (scope.nextSample + 1) % HISTORY_SIZE;
+		scope.lastMs = milliseconds;
+	}
+}
+
+std::vector<GpuProfiler::ScopeStats> GpuProfiler::getStats() const
+{
+	std::vector<ScopeStats> stats;
+	std::vector<double> sorted;
+
+	for (auto& scope : scopes)
+	{
+		if (scope.samples.empty())
+		{
+			continue;
+		}
+
+		sorted = scope.samples;
+		std::sort(sorted.begin(), sorted.end());
+
+		ScopeStats scopeStats;
+		scopeStats.name = scope.name;
+		scopeStats.sampleCount = static_cast<uint32_t>(sorted.size());
+		scopeStats.lastMs = scope.lastMs;
+		for (auto sample : sorted)
+		{
+			scopeStats.averageMs += sample;
+		}
+		scopeStats.averageMs /= sorted.size();
+
+		// nearest rank
+		auto rank = static_cast<size_t>(std::ceil(0.99 * sorted.size()));
+		scopeStats.p99Ms = sorted[std::max<size_t>(rank, 1) - 1];
+
+		stats.push_back(scopeStats);
+	}
+
+	return stats;
+}
+
+void GpuProfiler::writeCsv(const std::string& filename) const
+{
+	std::ofstream file(filename);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open " + filename + " for the gpu timings!");
+	}
+
+	file << "scope,samples,last_ms,average_ms,p99_ms\n";
+	for (auto& scope : getStats())
+	{
+		file << scope.name << "," << scope.sampleCount << "," << scope.lastMs << "," << scope.averageMs << "," << scope.p99Ms << "\n";
+	}
+}
+
+void GpuProfiler::writeJson(const std::string& filename) const
+{
+	std::ofstream file(filename);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open " + filename + " for the gpu timings!");
+	}
+
+	// scope names are ours, nothing to escape
+	file << "{\n\t\"timestampPeriodNs\": " << timestampPeriod << ",\n\t\"scopes\": [";
+	auto stats = getStats();
+	for (size_t i = 0; i < stats.size(); i++)
+	{
+		file << (i == 0 ? "\n" : ",\n") << "\t\t{ \"name\": \"" << stats[i].name << "\", \"samples\": " << stats[i].sampleCount
+			<< ", \"lastMs\": " << stats[i].lastMs << ", \"averageMs\": " << stats[i].averageMs << ", \"p99Ms\": " << stats[i].p99Ms << " }";
+	}
+	file << "\n\t]\n}\n";
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// gpu time of named scopes of the recorded commands, from timestamp query pairs
+// there is one query pool per swapchain image since command buffers are recorded per image and submitted again
+// without re-recording, the queries of an image are read back once the fence of its last submit signaled (never waits)
+// and kept for the last HISTORY_SIZE frames
+class GpuProfiler
+{
+public:
+	static inline constexpr const uint32_t MAX_SCOPES = 512;			// 2 queries each per pool
+	static inline constexpr const uint32_t HISTORY_SIZE = 256;		// frames averages and percentiles are taken over
+	static inline constexpr const uint32_t INVALID_SCOPE = ~0u;
+
+	struct ScopeStats
+	{
+		std::string name;
+		uint32_t sampleCount = 0;		// frames in the history
+		double lastMs = 0.0;
+		double averageMs = 0.0;
+		double p99Ms = 0.0;
+	};
+
+	// begin / end timestamps of a scope around the commands recorded while it lives
+	class Scope
+	{
+	public:
+		Scope(GpuProfiler& newProfiler, VkCommandBuffer newCommandBuffer, uint32_t newImage, uint32_t newScope);
+		~Scope();
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		GpuProfiler& profiler;
+		VkCommandBuffer commandBuffer;
+		uint32_t image;
+		uint32_t scope;
+	};
+
+	GpuProfiler() = default;
+
+	// queries are written on queues of queueFamily, the profiler stays disabled if it has no timestamp support
+	void init(VkPhysicalDevice physicalDevice, VkDevice newDevice, uint32_t queueFamily, uint32_t imageCount);
+	void cleanup();
+
+	bool isSupported() const;
+
+	// id of a named scope, registered the first time, INVALID_SCOPE once MAX_SCOPES are taken (not timed)
+	// not thread safe, register scopes before recording on other threads
+	uint32_t getScopeId(const std::string& name);
+
+	// resets the queries of image, first command of its primary command buffer (outside of a render pass)
+	void recordReset(VkCommandBuffer commandBuffer, uint32_t image);
+
+	// timestamps of a scope, each scope at most once per recording of an image
+	// thread safe for different scopes, so secondary command buffers can be recorded in parallel
+	void recordBegin(VkCommandBuffer commandBuffer, uint32_t image, uint32_t scope, VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+	void recordEnd(VkCommandBuffer commandBuffer, uint32_t image, uint32_t scope, VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+	// the command buffer of image was submitted
+	void markSubmitted(uint32_t image);
+
+	// read the timestamps of the last submit of image, call after its fence signaled and before it is submitted again
+	void collect(uint32_t image);
+
+	// scopes timed at least once, in registration order
+	std::vector<ScopeStats> getStats() const;
+
+	void writeCsv(const std::string& filename) const;
+	void writeJson(const std::string& filename) const;
+
+private:
+	struct ScopeHistory
+	{
+		std::string name;
+		std::vector<double> samples;	// ring of HISTORY_SIZE milliseconds
+		uint32_t nextSample = 0;
+		double lastMs = 0.0;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	bool supported = false;
+	double timestampPeriod = 1.0;		// nanoseconds per tick
+	uint64_t timestampMask = ~0ull;		// valid bits of the queue family
+
+	std::vector<VkQueryPool> queryPools;				// per image
+	std::vector<std::vector<uint8_t>> recordedScopes;	// [image][scope], written by the recording of the image
+	std::vector<bool> submitted;						// per image, queries were written since the last collect
+
+	std::unordered_map<std::string, uint32_t> scopeIds;
+	std::vector<ScopeHistory> scopes;
+	std::vector<uint64_t> results;		// timestamp / availability pairs of one collect
+};
@@ -0,0 +1,328 @@
+#include "HiZPyramid.h"
+
+#include <algorithm>
+#include <array>
+
+void HiZPyramid::init(VkDevice newDevice, MemoryAllocator* newAllocator, ShaderLibrary* shaderLibrary, PipelineCache* pipelineCache,
+	VkImageView depthView, uint32_t newDepthWidth, uint32_t newDepthHeight)
+{
+	device = newDevice;
+	allocator = newAllocator;
+	depthImageView = depthView;
+	depthWidth = newDepthWidth;
+	depthHeight = newDepthHeight;
+
+	createImage();
+	createPipeline(shaderLibrary, pipelineCache);
+	createDescriptorSets();
+}
+
+void HiZPyramid::cleanup()
+{
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+	vkDestroyPipeline(device, pipeline, nullptr);
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+
+	vkDestroySampler(device, sampler, nullptr);
+	for (auto levelView : levelViews)
+	{
+		vkDestroyImageView(device, levelView, nullptr);
+	}
+	vkDestroyImageView(device, imageView, nullptr);
+	vkDestroyImage(device, image, nullptr);
+	allocator->free(imageMemory);
+}
+
+void HiZPyramid::recordInitialize(VkCommandBuffer commandBuffer)
+{
+	VkImageMemoryBarrier imageBarrier{};
+	imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageBarrier.srcAccessMask = 0;
+	imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.image = image;
+	imageBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, static_cast<uint32_t>(levelSizes.size()), 0, 1 };
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+	VkClearColorValue farDepth{};
+	farDepth.float32[0] = 1.f;
+	vkCmdClearColorImage(commandBuffer, image, VK_IMAGE_LAYOUT_GENERAL, &farDepth, 1, &imageBarrier.subresourceRange);
+
+	imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	imageBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		0, nullptr, 0, nullptr, 1, &imageBarrier);
+}
+
+void HiZPyramid::recordBuild(VkCommandBuffer commandBuffer, CommandCounters& counters)
+{
+	// earlier compute passes may still read the old pyramid, execution dependency only
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		0, nullptr, 0, nullptr, 0, nullptr);
+
+	VkMemoryBarrier memoryBarrier{};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+
+	for (uint32_t level = 0; level < levelSizes.size(); level++)
+	{
+		auto sourceSize = level == 0 ? VkExtent2D{ depthWidth, depthHeight } : levelSizes[level - 1];
+
+		HiZParams params{};
+		params.sourceSize[0] = static_cast<int32_t>(sourceSize.width);
+		params.sourceSize[1] = static_cast<int32_t>(sourceSize.height);
+		params.destinationSize[0] = static_cast<int32_t>(levelSizes[level].width);
+		params.destinationSize[1] = static_cast<int32_t>(levelSizes[level].height);
+		params.level = level;
+
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[level], 0, nullptr);
+		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(HiZParams), &params);
+		vkCmdDispatch(commandBuffer, (levelSizes[level].width + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE,
+			(levelSizes[level].height + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1);
+
+		// level is complete before the next one (or the culling) reads it
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	auto levelCount = static_cast<uint32_t>(levelSizes.size());
+	counters.pipelineBinds++;
+	counters.descriptorSetBinds += levelCount;
+	counters.dispatches += levelCount;
+	counters.pushConstantBytes += levelCount * static_cast<uint32_t>(sizeof(HiZParams));
+}
+
+VkImageView HiZPyramid::getImageView() const
+{
+	return imageView;
+}
+
+VkSampler HiZPyramid::getSampler() const
+{
+	return sampler;
+}
+
+uint32_t HiZPyramid::getLevelCount() const
+{
+	return static_cast<uint32_t>(levelSizes.size());
+}
+
+uint32_t HiZPyramid::getDepthWidth() const
+{
+	return depthWidth;
+}
+
+uint32_t HiZPyramid::getDepthHeight() const
+{
+	return depthHeight;
+}
+
+void HiZPyramid::createImage()
+{
+	// halve (rounded up) until a single texel is left
+	VkExtent2D size{ (depthWidth + 1) / 2, (depthHeight + 1) / 2 };
+	levelSizes.push_back(size);
+	while (size.width > 1 || size.height > 1)
+	{
+		size = { (size.width + 1) / 2, (size.height + 1) / 2 };
+		levelSizes.push_back(size);
+	}
+
+	VkImageCreateInfo imageCreateInfo{};
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.extent = { levelSizes[0].width, levelSizes[0].height, 1 };
+	imageCreateInfo.mipLevels = static_cast<uint32_t>(levelSizes.size());
+	imageCreateInfo.arrayLayers = 1;
+	imageCreateInfo.format = VK_FORMAT_R32_SFLOAT;		// storage image support is required for it
+	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageCreateInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	auto result = vkCreateImage(device, &imageCreateInfo, nullptr, &image);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the depth pyramid image!");
+	}
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetImageMemoryRequirements(device, image, &memoryRequirements);
+
+	imageMemory = allocator->allocate(memoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+	vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
+
+	VkImageViewCreateInfo viewCreateInfo{};
+	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewCreateInfo.image = image;
+	viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+	viewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, static_cast<uint32_t>(levelSizes.size()), 0, 1 };
+
+	result = vkCreateImageView(device, &viewCreateInfo, nullptr, &imageView);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the depth pyramid image view!");
+	}
+
+	levelViews.resize(levelSizes.size());
+	for (uint32_t level = 0; level < levelViews.size(); level++)
+	{
+		viewCreateInfo.subresourceRange.baseMipLevel = level;
+		viewCreateInfo.subresourceRange.levelCount = 1;
+
+		result = vkCreateImageView(device, &viewCreateInfo, nullptr, &levelViews[level]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create a depth pyramid level view!");
+		}
+	}
+
+	// only read with texelFetch, filtering does not matter
+	VkSamplerCreateInfo samplerCreateInfo{};
+	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+	samplerCreateInfo.minFilter = VK_FILTER_NEAREST;
+	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	result = vkCreateSampler(device, &samplerCreateInfo, nullptr, &sampler);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the depth pyramid sampler!");
+	}
+}
+
+void HiZPyramid::createPipeline(ShaderLibrary* shaderLibrary, PipelineCache* pipelineCache)
+{
+	auto shaderModule = shaderLibrary->getModule("hiz.spv");
+
+	// depth buffer + source level + destination level
+	std::array<VkDescriptorSetLayoutBinding, 3> layoutBindings{};
+	for (uint32_t i = 0; i < layoutBindings.size(); i++)
+	{
+		layoutBindings[i].binding = i;
+		layoutBindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		layoutBindings[i].descriptorCount = 1;
+		layoutBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+	layoutCreateInfo.pBindings = layoutBindings.data();
+
+	auto result = vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &descriptorSetLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create hiz descriptor set layout!");
+	}
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(HiZParams);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create hiz pipeline layout!");
+	}
+
+	VkComputePipelineCreateInfo pipelineCreateInfo{};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = shaderModule;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.layout = pipelineLayout;
+
+	result = pipelineCache->createComputePipeline(pipelineCreateInfo, pipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create hiz pipeline!");
+	}
+}
+
+void HiZPyramid::createDescriptorSets()
+{
+	auto levelCount = static_cast<uint32_t>(levelSizes.size());
+
+	std::array<VkDescriptorPoolSize, 2> poolSizes{};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = levelCount;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[1].descriptorCount = levelCount * 2;
+
+	VkDescriptorPoolCreateInfo poolCreateInfo{};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = levelCount;
+	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+
+	auto result = vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &descriptorPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create hiz descriptor pool!");
+	}
+
+	std::vector<VkDescriptorSetLayout> setLayouts(levelCount, descriptorSetLayout);
+
+	VkDescriptorSetAllocateInfo setAllocInfo{};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = descriptorPool;
+	setAllocInfo.descriptorSetCount = levelCount;
+	setAllocInfo.pSetLayouts = setLayouts.data();
+
+	descriptorSets.resize(levelCount);
+	result = vkAllocateDescriptorSets(device, &setAllocInfo, descriptorSets.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate hiz descriptor sets!");
+	}
+
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		// level 0 reads the depth buffer, the source level binding is unused then but has to be valid
+		std::array<VkDescriptorImageInfo, 3> imageInfos{};
+		imageInfos[0] = { sampler, depthImageView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+		imageInfos[1] = { VK_NULL_HANDLE, levelViews[level == 0 ? 0 : level - 1], VK_IMAGE_LAYOUT_GENERAL };
+		imageInfos[2] = { VK_NULL_HANDLE, levelViews[level], VK_IMAGE_LAYOUT_GENERAL };
+
+		std::array<VkWriteDescriptorSet, 3> setWrites{};
+		for (uint32_t k = 0; k < setWrites.size(); k++)
+		{
+			setWrites[k].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			setWrites[k].dstSet = descriptorSets[level];
+			setWrites[k].dstBinding = k;
+			setWrites[k].dstArrayElement = 0;
+			setWrites[k].descriptorType = k == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			setWrites[k].descriptorCount = 1;
+			setWrites[k].pImageInfo = &imageInfos[k];
+		}
+
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
+	}
+}
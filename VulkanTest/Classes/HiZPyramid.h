@@ -0,0 +1,76 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "Utilities.h"
+#include "FrameStats.h"
+#include "PipelineCache.h"
+#include "ShaderLibrary.h"
+
+// hierarchical z pyramid of a depth buffer, used for occlusion culling
+// level 0 is half the depth buffer resolution, every texel holds the farthest depth of the 2x2 texels below it
+// sizes are rounded up, a texel at level l covers the depth pixels [x << (l + 1), (x + 1) << (l + 1))
+class HiZPyramid
+{
+public:
+	static inline constexpr const uint32_t WORKGROUP_SIZE = 8;
+
+	HiZPyramid() = default;
+
+	// depthView is sampled in VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, only its depth aspect
+	void init(VkDevice newDevice, MemoryAllocator* newAllocator, ShaderLibrary* shaderLibrary, PipelineCache* pipelineCache,
+		VkImageView depthView, uint32_t newDepthWidth, uint32_t newDepthHeight);
+	void cleanup();
+
+	// move the pyramid to VK_IMAGE_LAYOUT_GENERAL, where it stays, and fill it with the far depth (nothing occluded)
+	// has to run once before the first build or read
+	void recordInitialize(VkCommandBuffer commandBuffer);
+
+	// rebuild all levels from the depth buffer, outside of a render pass
+	// the render pass writing the depth has to make its writes available to compute shaders
+	// the pyramid is readable by compute shaders afterwards, recorded commands are added to counters
+	void recordBuild(VkCommandBuffer commandBuffer, CommandCounters& counters);
+
+	// all levels, VK_IMAGE_LAYOUT_GENERAL, read with texelFetch
+	VkImageView getImageView() const;
+	VkSampler getSampler() const;
+	uint32_t getLevelCount() const;
+	uint32_t getDepthWidth() const;
+	uint32_t getDepthHeight() const;
+
+private:
+	struct HiZParams
+	{
+		int32_t sourceSize[2];
+		int32_t destinationSize[2];
+		uint32_t level;
+	};
+
+	void createImage();
+	void createPipeline(ShaderLibrary* shaderLibrary, PipelineCache* pipelineCache);
+	void createDescriptorSets();
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+
+	VkImageView depthImageView = VK_NULL_HANDLE;
+	uint32_t depthWidth = 0;
+	uint32_t depthHeight = 0;
+
+	VkImage image = VK_NULL_HANDLE;
+	MemoryAllocation imageMemory;
+	VkImageView imageView = VK_NULL_HANDLE;			// all levels
+	std::vector<VkImageView> levelViews;			// one per level, storage image writes
+	std::vector<VkExtent2D> levelSizes;
+	VkSampler sampler = VK_NULL_HANDLE;
+
+	VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> descriptorSets;	// one per level
+
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+};
@@ -0,0 +1,235 @@
+#include "MemoryAllocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+
+void MemoryAllocator::init(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkDeviceSize newBlockSize)
+{
+	physicalDevice = newPhysicalDevice;
+	device = newDevice;
+	blockSize = newBlockSize;
+
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+	blocks.resize(memoryProperties.memoryTypeCount);
+}
+
+void MemoryAllocator::cleanup()
+{
+	for (auto& typeBlocks : blocks)
+	{
+		for (auto& block : typeBlocks)
+		{
+			destroyBlock(block);
+		}
+		typeBlocks.clear();
+	}
+}
+
+MemoryAllocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear)
+{
+	// find memory type which is allowed by the resource and has all requested properties
+	auto memoryTypeIndex = memoryProperties.memoryTypeCount;
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		if ((requirements.memoryTypeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			memoryTypeIndex = i;
+			break;
+		}
+	}
+
+	if (memoryTypeIndex == memoryProperties.memoryTypeCount)
+	{
+		throw std::runtime_error("Failed to find a suitable memory type!");
+	}
+
+	// small heaps (e.g. host visible device local) get smaller blocks so a single block can't take most of the heap
+	auto heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+	auto typeBlockSize = std::min(blockSize, heapSize / 8);
+
+	auto& typeBlocks = blocks[memoryTypeIndex];
+
+	MemoryBlock* targetBlock = nullptr;
+	auto offset = RangeAllocator::INVALID_OFFSET;
+
+	// large resources get their own block
+	if (requirements.size > typeBlockSize / 2)
+	{
+		targetBlock = &createBlock(memoryTypeIndex, requirements.size, linear, true);
+		offset = targetBlock->ranges.allocate(requirements.size, requirements.alignment);
+	}
+	else
+	{
+		// try existing blocks first
+		for (auto& block : typeBlocks)
+		{
+			if (block.dedicated || block.linear != linear)
+			{
+				continue;
+			}
+
+			offset = block.ranges.allocate(requirements.size, requirements.alignment);
+			if (offset != RangeAllocator::INVALID_OFFSET)
+			{
+				targetBlock = &block;
+				break;
+			}
+		}
+
+		// no space left, create new block
+		if (!targetBlock)
+		{
+			targetBlock = &createBlock(memoryTypeIndex, typeBlockSize, linear, false);
+			offset = targetBlock->ranges.allocate(requirements.size, requirements.alignment);
+		}
+	}
+
+	targetBlock->allocationCount++;
+	allocationsMade++;
+
+	MemoryAllocation allocation;
+	allocation.memory = targetBlock->memory;
+	allocation.offset = offset;
+	allocation.size = requirements.size;
+	allocation.memoryTypeIndex = memoryTypeIndex;
+	allocation.blockId = targetBlock->id;
+	allocation.mappedData = targetBlock->mappedData ? static_cast<char*>(targetBlock->mappedData) + offset : nullptr;
+
+	return allocation;
+}
+
+void MemoryAllocator::free(MemoryAllocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	auto& typeBlocks = blocks[allocation.memoryTypeIndex];
+	for (auto i = 0lu; i < typeBlocks.size(); i++)
+	{
+		auto& block = typeBlocks[i];
+		if (block.id != allocation.blockId)
+		{
+			continue;
+		}
+
+		block.ranges.free(allocation.offset, allocation.size);
+		block.allocationCount--;
+
+		// release empty blocks, but keep one regular block per type around to avoid allocation churn
+		if (block.allocationCount == 0)
+		{
+			auto regularBlocks = 0u;
+			for (const auto& other : typeBlocks)
+			{
+				regularBlocks += (!other.dedicated && other.linear == block.linear) ? 1 : 0;
+			}
+
+			if (block.dedicated || regularBlocks > 1)
+			{
+				destroyBlock(block);
+				typeBlocks.erase(typeBlocks.begin() + i);
+			}
+		}
+		break;
+	}
+
+	allocation = MemoryAllocation{};
+}
+
+std::vector<HeapUsage> MemoryAllocator::getHeapUsage() const
+{
+	std::vector<HeapUsage> heapUsage(memoryProperties.memoryHeapCount);
+
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+	{
+		heapUsage[i].heapSize = memoryProperties.memoryHeaps[i].size;
+	}
+
+	for (uint32_t type = 0; type < blocks.size(); type++)
+	{
+		auto& usage = heapUsage[memoryProperties.memoryTypes[type].heapIndex];
+		for (const auto& block : blocks[type])
+		{
+			usage.blockBytes += block.size;
+			usage.usedBytes += block.ranges.getUsed();
+			usage.blockCount++;
+			usage.allocationCount += block.allocationCount;
+		}
+	}
+
+	return heapUsage;
+}
+
+void MemoryAllocator::printHeapUsage() const
+{
+	auto heapUsage = getHeapUsage();
+	for (size_t i = 0; i < heapUsage.size(); i++)
+	{
+		const auto& usage = heapUsage[i];
+		printf("heap %zu: %llu KiB used / %llu KiB reserved in %u blocks, %u allocations (heap size %llu MiB)\n", i,
+			static_cast<unsigned long long>(usage.usedBytes / 1024), static_cast<unsigned long long>(usage.blockBytes / 1024),
+			usage.blockCount, usage.allocationCount, static_cast<unsigned long long>(usage.heapSize / (1024 * 1024)));
+	}
+}
+
+uint64_t MemoryAllocator::getAllocationsMade() const
+{
+	return allocationsMade;
+}
+
+uint64_t MemoryAllocator::getBlocksAllocated() const
+{
+	// block ids are handed out in order
+	return nextBlockId;
+}
+
+MemoryAllocator::MemoryBlock& MemoryAllocator::createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool linear, bool dedicated)
+{
+	VkMemoryAllocateInfo memAllocInfo{};
+	memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memAllocInfo.allocationSize = size;
+	memAllocInfo.memoryTypeIndex = memoryTypeIndex;
+
+	MemoryBlock block{};
+	block.id = nextBlockId++;
+	block.size = size;
+	block.linear = linear;
+	block.dedicated = dedicated;
+	block.allocationCount = 0;
+	block.ranges = RangeAllocator(size);
+
+	auto result = vkAllocateMemory(device, &memAllocInfo, nullptr, &block.memory);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate device memory block!");
+	}
+
+	// map host visible blocks once for their whole lifetime
+	block.mappedData = nullptr;
+	if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		result = vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mappedData);
+		if (result != VK_SUCCESS)
+		{
+			// block is not registered yet, nothing else would free the memory
+			vkFreeMemory(device, block.memory, nullptr);
+			throw std::runtime_error("Failed to map device memory block!");
+		}
+	}
+
+	blocks[memoryTypeIndex].push_back(std::move(block));
+	return blocks[memoryTypeIndex].back();
+}
+
+void MemoryAllocator::destroyBlock(MemoryBlock& block)
+{
+	if (block.mappedData)
+	{
+		vkUnmapMemory(device, block.memory);
+	}
+
+	vkFreeMemory(device, block.memory, nullptr);
+}
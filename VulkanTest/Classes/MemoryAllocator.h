@@ -0,0 +1,78 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "RangeAllocator.h"
+
+// piece of a VkDeviceMemory block handed out by the MemoryAllocator
+struct MemoryAllocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;	// block the allocation lives in
+	VkDeviceSize offset = 0;				// offset into the block, use for vkBind*Memory
+	VkDeviceSize size = 0;
+	uint32_t memoryTypeIndex = 0;
+	uint32_t blockId = 0;
+	void* mappedData = nullptr;				// persistently mapped pointer for host visible memory, nullptr otherwise
+};
+
+struct HeapUsage
+{
+	VkDeviceSize heapSize = 0;			// size reported by the device
+	VkDeviceSize blockBytes = 0;		// bytes allocated with vkAllocateMemory
+	VkDeviceSize usedBytes = 0;			// bytes handed out to resources
+	uint32_t blockCount = 0;
+	uint32_t allocationCount = 0;
+};
+
+// block based device memory sub allocator
+// one vkAllocateMemory per block, resources get a range inside a block of the matching memory type
+class MemoryAllocator
+{
+public:
+	static inline constexpr const VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+
+	MemoryAllocator() = default;
+
+	void init(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkDeviceSize newBlockSize = DEFAULT_BLOCK_SIZE);
+	void cleanup();
+
+	// linear = buffers / linear images, kept in separate blocks from optimal images so bufferImageGranularity never applies
+	MemoryAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear);
+	void free(MemoryAllocation& allocation);
+
+	std::vector<HeapUsage> getHeapUsage() const;
+	void printHeapUsage() const;
+
+	// allocate calls since init and the vkAllocateMemory calls among them, live ones are in getHeapUsage
+	uint64_t getAllocationsMade() const;
+	uint64_t getBlocksAllocated() const;
+
+private:
+	struct MemoryBlock
+	{
+		uint32_t id;
+		VkDeviceMemory memory;
+		VkDeviceSize size;
+		void* mappedData;			// whole block mapped once if host visible
+		bool linear;
+		bool dedicated;				// allocation too large for a regular block, freed as soon as it is empty
+		uint32_t allocationCount;
+		RangeAllocator ranges;
+	};
+
+	MemoryBlock& createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool linear, bool dedicated);
+	void destroyBlock(MemoryBlock& block);
+
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
+
+	VkPhysicalDeviceMemoryProperties memoryProperties{};
+	VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE;
+	uint32_t nextBlockId = 0;
+	uint64_t allocationsMade = 0;
+
+	std::vector<std::vector<MemoryBlock>> blocks;	// one list of blocks per memory type
+};
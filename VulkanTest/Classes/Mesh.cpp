@@ -1,24 +1,39 @@
 #include "Mesh.h"
 
+#include <algorithm>
+
 Mesh::Mesh()
 {
 }
 
-Mesh::Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool,
-	std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, int newTexId)
+Mesh::Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, GeometryPool* newGeometryPool, UploadContext* uploadContext,
+	const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, int newTexId)
 {
-	vertexCount = vertices.size();
-	indexCount = indices.size();
 	physicalDevice = newPhysicalDevice;
 	device = newDevice;
-	createVertexBuffer(transferQueue, transferCommandPool, vertices);
-	createIndexBuffer(transferQueue, transferCommandPool, indices);
+	geometryPool = newGeometryPool;
+
+	// reserve space for vertices and indices in the shared buffers
+	geometry = geometryPool->allocate(static_cast<uint32_t>(vertices.size()), static_cast<uint32_t>(indices.size()));
+
+	createVertexBuffer(uploadContext, vertices);
+	createIndexBuffer(uploadContext, indices);
+
+	calculateBounds(vertices);
 
 	model.model = glm::mat4(1.f);
 
 	texId = newTexId;
 }
 
+Mesh Mesh::createInstance() const
+{
+	Mesh instance = *this;
+	instance.ownsGeometry = false;
+
+	return instance;
+}
+
 void Mesh::setModel(glm::mat4 newModel)
 {
 	model.model = newModel;
@@ -29,98 +44,130 @@ Model Mesh::getModel() const
 	return model;
 }
 
+void Mesh::setTexId(int newTexId)
+{
+	texId = newTexId;
+}
+
 int Mesh::getTexId() const
 {
 	return texId;
 }
 
+void Mesh::setFlags(uint32_t newFlags)
+{
+	flags = newFlags;
+}
+
+uint32_t Mesh::getFlags() const
+{
+	return flags;
+}
+
 int Mesh::getVertexCount() const
 {
-	return vertexCount;
+	return geometry.vertexCount;
 }
 
 int Mesh::getIndexCount() const
 {
-	return indexCount;
+	return geometry.indexCount;
 }
 
-VkBuffer Mesh::getVertexBuffer() const
+int32_t Mesh::getVertexOffset() const
 {
-	return vertexBuffer;
+	return static_cast<int32_t>(geometry.vertexOffset);
 }
 
-VkBuffer Mesh::getIndexBuffer() const
+uint32_t Mesh::getFirstIndex() const
 {
-	return indexBuffer;
+	return geometry.firstIndex;
 }
 
-void Mesh::destroyBuffers()
+const GeometryRange& Mesh::getGeometry() const
 {
-	vkDestroyBuffer(device, vertexBuffer, nullptr);
-	vkFreeMemory(device, vertexBufferMemory, nullptr);
-
-	vkDestroyBuffer(device, indexBuffer, nullptr);
-	vkFreeMemory(device, indexBufferMemory, nullptr);
+	return geometry;
 }
 
-void Mesh::createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex>& vertices)
+glm::vec4 Mesh::getBoundingSphere() const
 {
-	// Get size of buffer needed of vertices
-	VkDeviceSize bufferSize = sizeof(Vertex) * vertices.size();
+	return boundingSphere;
+}
 
-	//Tmp buffer to "stage" vertex data before transferring to GPU
+const BoundingBox& Mesh::getBoundingBox() const
+{
+	return boundingBox;
+}
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
+glm::vec4 Mesh::getWorldBoundingSphere() const
+{
+	auto& matrix = model.model;
+	glm::vec3 center = matrix * glm::vec4(glm::vec3(boundingSphere), 1.f);
+	auto scale = std::max({ glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2])) });
 
-	// create staging buffer and allocate memory to it
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		stagingBuffer, stagingBufferMemory);
+	return glm::vec4(center, boundingSphere.w * scale);
+}
 
-	// MAP MEMORY TO VERTEX BUFFER
-	void* data;																	// 1. create pointer to a point in normal memory
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);		//2. map the vertex buffer memory to that point
-	memcpy(data, vertices.data(), (size_t)bufferSize);						//3. copy memory from certices vector to the point
-	vkUnmapMemory(device, stagingBufferMemory);									//4. unmap the vertex memory
+BoundingBox Mesh::getWorldBoundingBox() const
+{
+	return transformBoundingBox(model.model, boundingBox);
+}
 
-	// create buffer with transfer_dst_bit to mark as recipient of transfer data (also vertex_buffer)
-	// buffer memory is to be DEVICE_LOCAL_BIT meaning memory is on the gpu and only accessible by it and not cpu(host)
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+void Mesh::destroyBuffers()
+{
+	if (ownsGeometry)
+	{
+		geometryPool->free(geometry);
+	}
+}
 
-	// copy staging buffer to vertex buffer on GPU
-	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, vertexBuffer, bufferSize);
+void Mesh::createVertexBuffer(UploadContext* uploadContext, const std::vector<Vertex>& vertices)
+{
+	// Get size of buffer needed of vertices
+	VkDeviceSize bufferSize = sizeof(Vertex) * vertices.size();
 
-	//cleanup staging buffer parts
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+	// stage vertex data and record copy to the mesh range of the shared vertex buffer on GPU
+	uploadContext->uploadBuffer(geometryPool->getVertexBuffer(), sizeof(Vertex) * static_cast<VkDeviceSize>(geometry.vertexOffset),
+		vertices.data(), bufferSize);
 }
 
-void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t>& indices)
+void Mesh::createIndexBuffer(UploadContext* uploadContext, const std::vector<uint32_t>& indices)
 {
 	// Get size of buffer needed of indices
 	VkDeviceSize bufferSize = sizeof(uint32_t) * indices.size();
 
-	//Tmp buffer to "stage" vertex data before transferring to GPU
-
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-	// MAP MEMORY TO INDEX BUFFER
-	void* data;																	
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);		
-	memcpy(data, indices.data(), (size_t)bufferSize);						
-	vkUnmapMemory(device, stagingBufferMemory);									
-
-	// create buffer for index data on gpu access only area
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
-
-
-	// copy staging buffer to gpu access buffer
-	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, indexBuffer, bufferSize);
+	// stage index data and record copy to the mesh range of the shared index buffer
+	uploadContext->uploadBuffer(geometryPool->getIndexBuffer(), sizeof(uint32_t) * static_cast<VkDeviceSize>(geometry.firstIndex),
+		indices.data(), bufferSize);
+}
 
-	// destroy + release staging buffer and memory
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+void Mesh::calculateBounds(const std::vector<Vertex>& vertices)
+{
+	if (vertices.empty())
+	{
+		boundingSphere = glm::vec4(0.f);
+		boundingBox = { glm::vec3(0.f), glm::vec3(0.f) };
+		return;
+	}
+
+	// sphere around the center of the bounding box, not minimal but cheap
+	glm::vec3 minPos = vertices[0].pos;
+	glm::vec3 maxPos = vertices[0].pos;
+	for (const auto& vertex : vertices)
+	{
+		minPos = glm::min(minPos, vertex.pos);
+		maxPos = glm::max(maxPos, vertex.pos);
+	}
+
+	boundingBox = { minPos, maxPos };
+
+	glm::vec3 center = (minPos + maxPos) * 0.5f;
+
+	float radius = 0.f;
+	for (const auto& vertex : vertices)
+	{
+		radius = std::max(radius, glm::length(vertex.pos - center));
+	}
+
+	boundingSphere = glm::vec4(center, radius);
 }
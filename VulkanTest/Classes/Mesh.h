@@ -6,6 +6,9 @@
 #include <vector>
 
 #include "Utilities.h"
+#include "Bounds.h"
+#include "GeometryPool.h"
+#include "UploadContext.h"
 
 struct Model
 {
@@ -16,40 +19,62 @@ class Mesh
 {
 public:
 	Mesh();
-	Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool,
-		std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, int newTexId);
+	// vertex and index data is recorded into the upload context, it is usable once the upload batch completed
+	Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, GeometryPool* newGeometryPool, UploadContext* uploadContext,
+		const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, int newTexId);
+
+	// copy drawing the same geometry, the geometry stays owned by this mesh
+	Mesh createInstance() const;
 
 	void setModel(glm::mat4 newModel);
 	Model getModel() const;
 
+	void setTexId(int newTexId);
 	int getTexId() const;
 
+	// OBJECT_FLAG_* bits passed to the culling pass
+	void setFlags(uint32_t newFlags);
+	uint32_t getFlags() const;
+
 	int getVertexCount() const;
 	int getIndexCount() const;
 
-	VkBuffer getVertexBuffer() const;
-	VkBuffer getIndexBuffer() const;
+	// offsets into the shared geometry pool buffers
+	int32_t getVertexOffset() const;
+	uint32_t getFirstIndex() const;
+
+	const GeometryRange& getGeometry() const;
 
+	// xyz center, w radius, in model space
+	glm::vec4 getBoundingSphere() const;
+	const BoundingBox& getBoundingBox() const;		// model space
+
+	// bounding sphere moved by the model matrix, radius scaled by the largest axis scale
+	glm::vec4 getWorldBoundingSphere() const;
+	BoundingBox getWorldBoundingBox() const;
+
+	// release the mesh range in the geometry pool, does nothing for instances
 	void destroyBuffers();
 
 private:
-	void createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex>& vertices);
-	void createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t>& indices);
-	uint32_t findMemoryTypeIndex(uint32_t allowedTypes, VkMemoryPropertyFlags properties);
+	void createVertexBuffer(UploadContext* uploadContext, const std::vector<Vertex>& vertices);
+	void createIndexBuffer(UploadContext* uploadContext, const std::vector<uint32_t>& indices);
+	void calculateBounds(const std::vector<Vertex>& vertices);
 
 private:
 	Model model;
 
 	int texId;
+	uint32_t flags = 0;
 
-	int vertexCount;
-	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
+	// vertex/index counts and offsets in the geometry pool
+	GeometryRange geometry;
+	bool ownsGeometry = true;		// false for instances sharing the range of another mesh
 
-	int indexCount;
-	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
+	glm::vec4 boundingSphere;
+	BoundingBox boundingBox;
 
 	VkPhysicalDevice physicalDevice;
 	VkDevice device;
-};
\ No newline at end of file
+	GeometryPool* geometryPool;
+};
@@ -0,0 +1,230 @@
+#include "PipelineCache.h"
+#include "Utilities.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// data is on disk when this returns true, not just in the os buffers
+	bool syncFile(FILE* file)
+	{
+		if (fflush(file) != 0)
+		{
+			return false;
+		}
+#ifdef _WIN32
+		return _commit(_fileno(file)) == 0;
+#else
+		return fsync(fileno(file)) == 0;
+#endif
+	}
+}
+
+void PipelineCache::init(VkPhysicalDevice physicalDevice, VkDevice newDevice, const std::string& newFilePath)
+{
+	device = newDevice;
+	filePath = newFilePath;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+	std::vector<char> data;
+	warm = loadFile(data);
+
+	VkPipelineCacheCreateInfo cacheCreateInfo{};
+	cacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheCreateInfo.initialDataSize = warm ? data.size() : 0;
+	cacheCreateInfo.pInitialData = warm ? data.data() : nullptr;
+
+	auto result = vkCreatePipelineCache(device, &cacheCreateInfo, nullptr, &cache);
+	if (result != VK_SUCCESS && warm)
+	{
+		// the driver rejected the data after all, start empty
+		warm = false;
+		cacheCreateInfo.initialDataSize = 0;
+		cacheCreateInfo.pInitialData = nullptr;
+		result = vkCreatePipelineCache(device, &cacheCreateInfo, nullptr, &cache);
+	}
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a pipeline cache!");
+	}
+}
+
+void PipelineCache::save()
+{
+	size_t dataSize = 0;
+	auto result = vkGetPipelineCacheData(device, cache, &dataSize, nullptr);
+	if (result != VK_SUCCESS)
+	{
+		printf("WARNING: Failed to get the pipeline cache size, cache not saved\n");
+		return;
+	}
+
+	std::vector<char> data(dataSize);
+	result = vkGetPipelineCacheData(device, cache, &dataSize, data.data());
+	if (result != VK_SUCCESS)
+	{
+		printf("WARNING: Failed to get the pipeline cache data, cache not saved\n");
+		return;
+	}
+	data.resize(dataSize);
+
+	auto header = makeHeader();
+	header.dataSize = data.size();
+	header.dataHash = hashBytes(data.data(), data.size());
+
+	// write a temporary file, sync it and move it over the old one, a crash leaves either the old or the new file
+	auto tempPath = filePath + ".tmp";
+	std::error_code error;
+
+	auto file = fopen(tempPath.c_str(), "wb");
+	if (file == nullptr)
+	{
+		printf("WARNING: Failed to open %s, cache not saved\n", tempPath.c_str());
+		return;
+	}
+
+	auto written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data.data(), 1, data.size(), file) == data.size();
+	written = syncFile(file) && written;
+	written = fclose(file) == 0 && written;
+	if (!written)
+	{
+		printf("WARNING: Failed to write %s, cache not saved\n", tempPath.c_str());
+		std::filesystem::remove(tempPath, error);
+		return;
+	}
+
+	std::filesystem::rename(tempPath, filePath, error);
+	if (error)
+	{
+		printf("WARNING: Failed to replace %s: %s\n", filePath.c_str(), error.message().c_str());
+		std::filesystem::remove(tempPath, error);
+	}
+}
+
+void PipelineCache::cleanup()
+{
+	vkDestroyPipelineCache(device, cache, nullptr);
+}
+
+VkResult PipelineCache::createGraphicsPipeline(const VkGraphicsPipelineCreateInfo& createInfo, VkPipeline& pipeline)
+{
+	auto start = std::chrono::steady_clock::now();
+	auto result = vkCreateGraphicsPipelines(device, cache, 1, &createInfo, nullptr, &pipeline);
+	auto milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::lock_guard<std::mutex> lock(statsMutex);
+	creationMilliseconds += milliseconds;
+	createdPipelineCount++;
+
+	return result;
+}
+
+VkResult PipelineCache::createComputePipeline(const VkComputePipelineCreateInfo& createInfo, VkPipeline& pipeline)
+{
+	auto start = std::chrono::steady_clock::now();
+	auto result = vkCreateComputePipelines(device, cache, 1, &createInfo, nullptr, &pipeline);
+	auto milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::lock_guard<std::mutex> lock(statsMutex);
+	creationMilliseconds += milliseconds;
+	createdPipelineCount++;
+
+	return result;
+}
+
+VkPipelineCache PipelineCache::getCache() const
+{
+	return cache;
+}
+
+bool PipelineCache::isWarm() const
+{
+	return warm;
+}
+
+double PipelineCache::getCreationMilliseconds() const
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+	return creationMilliseconds;
+}
+
+uint32_t PipelineCache::getCreatedPipelineCount() const
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+	return createdPipelineCount;
+}
+
+PipelineCache::FileHeader PipelineCache::makeHeader() const
+{
+	FileHeader header{};
+	header.magic = FILE_MAGIC;
+	header.version = FILE_VERSION;
+	header.vendorId = deviceProperties.vendorID;
+	header.deviceId = deviceProperties.deviceID;
+	header.driverVersion = deviceProperties.driverVersion;
+	memcpy(header.pipelineCacheUuid, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+
+	return header;
+}
+
+bool PipelineCache::loadFile(std::vector<char>& data) const
+{
+	std::ifstream file(filePath, std::ios::binary);
+	if (!file.is_open())
+	{
+		// first run
+		return false;
+	}
+
+	FileHeader header{};
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+	{
+		printf("Pipeline cache %s is truncated, starting cold\n", filePath.c_str());
+		return false;
+	}
+
+	auto expected = makeHeader();
+	if (header.magic != expected.magic || header.version != expected.version)
+	{
+		printf("Pipeline cache %s has an unknown format, starting cold\n", filePath.c_str());
+		return false;
+	}
+
+	if (header.vendorId != expected.vendorId || header.deviceId != expected.deviceId || header.driverVersion != expected.driverVersion
+		|| memcmp(header.pipelineCacheUuid, expected.pipelineCacheUuid, VK_UUID_SIZE) != 0)
+	{
+		printf("Pipeline cache %s belongs to another device or driver, starting cold\n", filePath.c_str());
+		return false;
+	}
+
+	// the size field is not trusted before the hash is checked, it has to match the rest of the file
+	auto dataStart = file.tellg();
+	file.seekg(0, std::ios::end);
+	auto dataEnd = file.tellg();
+	file.seekg(dataStart);
+	if (dataStart < 0 || dataEnd < dataStart || header.dataSize != static_cast<uint64_t>(dataEnd - dataStart))
+	{
+		printf("Pipeline cache %s is damaged, starting cold\n", filePath.c_str());
+		return false;
+	}
+
+	data.resize(static_cast<size_t>(header.dataSize));
+	if (!file.read(data.data(), data.size()) || hashBytes(data.data(), data.size()) != header.dataHash)
+	{
+		printf("Pipeline cache %s is damaged, starting cold\n", filePath.c_str());
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+// VkPipelineCache kept on disk between runs
+// the file starts with a header identifying the device and driver it was written for plus a hash of the data,
+// a file from another device / driver or a damaged one is ignored and the cache starts empty (cold)
+// pipelines are created through the cache so their creation time can be reported, creation is thread safe
+class PipelineCache
+{
+public:
+	PipelineCache() = default;
+
+	// load filePath if it is valid for this device, never fails because of the file
+	void init(VkPhysicalDevice physicalDevice, VkDevice newDevice, const std::string& newFilePath);
+
+	// write the cache back to disk, the old file is replaced atomically
+	void save();
+	void cleanup();
+
+	VkResult createGraphicsPipeline(const VkGraphicsPipelineCreateInfo& createInfo, VkPipeline& pipeline);
+	VkResult createComputePipeline(const VkComputePipelineCreateInfo& createInfo, VkPipeline& pipeline);
+
+	VkPipelineCache getCache() const;
+
+	// true if the cache was filled from disk at startup
+	bool isWarm() const;
+
+	// time spent in pipeline creation since init
+	double getCreationMilliseconds() const;
+	uint32_t getCreatedPipelineCount() const;
+
+private:
+	static inline constexpr const uint32_t FILE_MAGIC = 0x48435056;	// "VPCH"
+	static inline constexpr const uint32_t FILE_VERSION = 1;
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vendorId;
+		uint32_t deviceId;
+		uint32_t driverVersion;
+		uint8_t pipelineCacheUuid[VK_UUID_SIZE];
+		uint32_t padding;
+		uint64_t dataSize;
+		uint64_t dataHash;
+	};
+
+	FileHeader makeHeader() const;
+	bool loadFile(std::vector<char>& data) const;
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties deviceProperties{};
+	std::string filePath;
+
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	bool warm = false;
+
+	mutable std::mutex statsMutex;
+	double creationMilliseconds = 0.0;
+	uint32_t createdPipelineCount = 0;
+};
@@ -0,0 +1,151 @@
+#include "PipelineManager.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+
+void PipelineManager::init(VkDevice newDevice, const Builder& newBuilder, const PipelineState& defaultState, uint32_t workerCount)
+{
+	device = newDevice;
+	builder = newBuilder;
+	stopping = false;
+
+	// fallback of every other variant, has to exist before the first draw
+	Variant defaultVariant;
+	defaultVariant.state = defaultState;
+
+	auto result = builder(defaultState, defaultVariant.pipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the default graphics pipeline!");
+	}
+
+	variants.push_back(defaultVariant);
+	publishedPipelines.push_back(defaultVariant.pipeline);
+	stats.ready = 1;
+
+	for (uint32_t i = 0; i < std::max(1u, workerCount); i++)
+	{
+		workers.emplace_back(&PipelineManager::workerLoop, this);
+	}
+}
+
+void PipelineManager::cleanup()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		queue.clear();
+	}
+	workAvailable.notify_all();
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+
+	for (auto& variant : variants)
+	{
+		vkDestroyPipeline(device, variant.pipeline, nullptr);
+	}
+	variants.clear();
+	publishedPipelines.clear();
+}
+
+uint32_t PipelineManager::request(const PipelineState& state)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (uint32_t i = 0; i < variants.size(); i++)
+	{
+		if (variants[i].state == state)
+		{
+			return i;
+		}
+	}
+
+	auto id = static_cast<uint32_t>(variants.size());
+	variants.push_back({ state, VK_NULL_HANDLE });
+	queue.push_back(id);
+	stats.pending++;
+
+	workAvailable.notify_one();
+	return id;
+}
+
+VkPipeline PipelineManager::getPipeline(uint32_t id) const
+{
+	return id < publishedPipelines.size() ? publishedPipelines[id] : VK_NULL_HANDLE;
+}
+
+bool PipelineManager::collectFinished()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// new ids show up as pending even if nothing finished
+	publishedPipelines.resize(variants.size(), VK_NULL_HANDLE);
+	if (!finishedSinceCollect)
+	{
+		return false;
+	}
+
+	for (uint32_t i = 0; i < variants.size(); i++)
+	{
+		publishedPipelines[i] = variants[i].pipeline;
+	}
+	finishedSinceCollect = false;
+
+	return true;
+}
+
+PipelineManager::Stats PipelineManager::getStats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+void PipelineManager::workerLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		workAvailable.wait(lock, [this] { return stopping || !queue.empty(); });
+		if (stopping)
+		{
+			return;
+		}
+
+		auto id = queue.front();
+		queue.pop_front();
+		auto state = variants[id].state;
+
+		// compile without holding the lock, requests and collects go on meanwhile
+		lock.unlock();
+
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		auto start = std::chrono::steady_clock::now();
+		auto result = builder(state, pipeline);
+		auto compileMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		lock.lock();
+
+		stats.pending--;
+		if (result == VK_SUCCESS)
+		{
+			variants[id].pipeline = pipeline;
+			stats.ready++;
+		}
+		else
+		{
+			// draws keep using the fallback
+			stats.failed++;
+			printf("WARNING: Failed to compile graphics pipeline variant %u\n", id);
+		}
+		stats.totalCompileMs += compileMs;
+		stats.longestCompileMs = std::max(stats.longestCompileMs, compileMs);
+		finishedSinceCollect = true;
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// render state of a graphics pipeline variant, shaders, vertex input, layout and render pass are shared by all variants
+struct PipelineState
+{
+	VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+	VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;	// anything but fill needs the fillModeNonSolid feature
+	VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS;
+	bool depthWrite = true;
+	bool blendEnable = true;
+
+	bool operator==(const PipelineState& other) const
+	{
+		return cullMode == other.cullMode && polygonMode == other.polygonMode && depthCompareOp == other.depthCompareOp
+			&& depthWrite == other.depthWrite && blendEnable == other.blendEnable;
+	}
+};
+
+// compiles graphics pipeline variants on background threads
+// request returns an id right away, the pipeline of the id shows up in getPipeline once a worker compiled it
+// and collectFinished published it, until then draws use the default pipeline (id 0, compiled by init)
+class PipelineManager
+{
+public:
+	// creates the pipeline of a state, called on the worker threads (and once on the init caller for the default)
+	using Builder = std::function<VkResult(const PipelineState& state, VkPipeline& pipeline)>;
+
+	static inline constexpr const uint32_t DEFAULT_PIPELINE = 0;
+
+	struct Stats
+	{
+		uint32_t pending = 0;			// requested, not compiled yet
+		uint32_t ready = 0;
+		uint32_t failed = 0;
+		double totalCompileMs = 0.0;	// spent on worker threads, none of it on the render thread
+		double longestCompileMs = 0.0;
+	};
+
+	PipelineManager() = default;
+
+	// builds the default pipeline synchronously, throws if that fails
+	void init(VkDevice newDevice, const Builder& newBuilder, const PipelineState& defaultState, uint32_t workerCount = 1);
+
+	// waits for the compilation in progress, pipelines not started yet are dropped
+	void cleanup();
+
+	// id of the variant with this state, queued for compilation the first time a state is requested, never blocks
+	uint32_t request(const PipelineState& state);
+
+	// pipeline of id as of the last collectFinished, VK_NULL_HANDLE while pending or if compiling failed
+	// only changes in collectFinished, safe to call from the recording threads
+	VkPipeline getPipeline(uint32_t id) const;
+
+	// publish pipelines the workers finished, call on the render thread outside of command recording
+	// returns true if any were published, commands recorded with fallbacks can bind them now
+	bool collectFinished();
+
+	Stats getStats() const;
+
+private:
+	struct Variant
+	{
+		PipelineState state;
+		VkPipeline pipeline = VK_NULL_HANDLE;		// stays null while pending or if compiling failed
+	};
+
+	void workerLoop();
+
+	VkDevice device = VK_NULL_HANDLE;
+	Builder builder;
+
+	std::vector<std::thread> workers;
+
+	mutable std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::deque<Variant> variants;			// index is the id, guarded by mutex
+	std::deque<uint32_t> queue;				// ids waiting for a worker
+	bool finishedSinceCollect = false;
+	bool stopping = false;
+	Stats stats;
+
+	// render thread copy of the variant pipelines, read without locking
+	std::vector<VkPipeline> publishedPipelines;
+};
@@ -0,0 +1,120 @@
+#include "RangeAllocator.h"
+
+#include <algorithm>
+
+RangeAllocator::RangeAllocator(uint64_t newSize)
+{
+	size = newSize;
+	freeRanges.push_back({ 0, newSize });
+}
+
+uint64_t RangeAllocator::allocate(uint64_t allocSize, uint64_t alignment)
+{
+	if (allocSize == 0)
+	{
+		return INVALID_OFFSET;
+	}
+
+	for (auto i = 0lu; i < freeRanges.size(); i++)
+	{
+		auto range = freeRanges[i];
+
+		// padding needed in front of the range to fulfill alignment
+		auto alignedOffset = alignUp(range.offset, alignment);
+		auto padding = alignedOffset - range.offset;
+
+		if (padding + allocSize > range.size)
+		{
+			continue;
+		}
+
+		auto remaining = range.size - padding - allocSize;
+
+		// keep the padding as its own free range, replace or drop the original one
+		if (padding > 0)
+		{
+			freeRanges[i].size = padding;
+			if (remaining > 0)
+			{
+				freeRanges.insert(freeRanges.begin() + i + 1, { alignedOffset + allocSize, remaining });
+			}
+		}
+		else if (remaining > 0)
+		{
+			freeRanges[i] = { alignedOffset + allocSize, remaining };
+		}
+		else
+		{
+			freeRanges.erase(freeRanges.begin() + i);
+		}
+
+		used += allocSize;
+		return alignedOffset;
+	}
+
+	return INVALID_OFFSET;
+}
+
+void RangeAllocator::free(uint64_t offset, uint64_t allocSize)
+{
+	// find first range behind the freed one
+	auto next = std::lower_bound(freeRanges.begin(), freeRanges.end(), offset,
+		[](const Range& range, uint64_t value) { return range.offset < value; });
+
+	auto it = freeRanges.insert(next, { offset, allocSize });
+	used -= allocSize;
+
+	// merge with following range
+	auto following = it + 1;
+	if (following != freeRanges.end() && it->offset + it->size == following->offset)
+	{
+		it->size += following->size;
+		it = freeRanges.erase(following) - 1;
+	}
+
+	// merge with previous range
+	if (it != freeRanges.begin())
+	{
+		auto previous = it - 1;
+		if (previous->offset + previous->size == it->offset)
+		{
+			previous->size += it->size;
+			freeRanges.erase(it);
+		}
+	}
+}
+
+void RangeAllocator::grow(uint64_t newSize)
+{
+	if (newSize <= size)
+	{
+		return;
+	}
+
+	// extend trailing free range or add a new one
+	if (!freeRanges.empty() && freeRanges.back().offset + freeRanges.back().size == size)
+	{
+		freeRanges.back().size += newSize - size;
+	}
+	else
+	{
+		freeRanges.push_back({ size, newSize - size });
+	}
+
+	size = newSize;
+}
+
+uint64_t RangeAllocator::getSize() const
+{
+	return size;
+}
+
+uint64_t RangeAllocator::getUsed() const
+{
+	return used;
+}
+
+bool RangeAllocator::isEmpty() const
+{
+	return used == 0;
+}
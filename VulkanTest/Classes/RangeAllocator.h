@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// first fit free list over a linear range [0, size)
+// used to sub allocate device memory blocks and shared buffers, does not own any vulkan objects
+class RangeAllocator
+{
+public:
+	static inline constexpr const uint64_t INVALID_OFFSET = ~0ull;
+
+	RangeAllocator() = default;
+	explicit RangeAllocator(uint64_t newSize);
+
+	// returns offset of the allocated range or INVALID_OFFSET if there is no free range large enough
+	uint64_t allocate(uint64_t allocSize, uint64_t alignment = 1);
+	void free(uint64_t offset, uint64_t allocSize);
+
+	// grow the managed range, new space is added to the end
+	void grow(uint64_t newSize);
+
+	uint64_t getSize() const;
+	uint64_t getUsed() const;
+	bool isEmpty() const;
+
+private:
+	struct Range
+	{
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	uint64_t size = 0;
+	uint64_t used = 0;
+	std::vector<Range> freeRanges;		// sorted by offset, adjacent ranges are always merged
+};
+
+static inline uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
@@ -0,0 +1,81 @@
+#include "ShaderLibrary.h"
+#include "Utilities.h"
+
+#include <cstring>
+#include <stdexcept>
+
+void ShaderLibrary::init(VkDevice newDevice)
+{
+	device = newDevice;
+}
+
+void ShaderLibrary::cleanup()
+{
+	for (auto& module : modules)
+	{
+		vkDestroyShaderModule(device, module.second, nullptr);
+	}
+	modules.clear();
+	nameHashes.clear();
+}
+
+VkShaderModule ShaderLibrary::getModule(const std::string& name)
+{
+	// known name, nothing is read or hashed again
+	auto nameHash = nameHashes.find(name);
+	if (nameHash != nameHashes.end())
+	{
+		return modules.at(nameHash->second);
+	}
+
+	const unsigned char* code = nullptr;
+	size_t size = 0;
+
+	size_t embeddedCount;
+	auto embeddedShaders = getEmbeddedShaders(embeddedCount);
+	for (size_t i = 0; i < embeddedCount; i++)
+	{
+		if (strcmp(embeddedShaders[i].name, name.c_str()) == 0)
+		{
+			code = embeddedShaders[i].code;
+			size = embeddedShaders[i].size;
+			break;
+		}
+	}
+
+	// not in SHADER_SOURCES of CMakeLists.txt
+	if (code == nullptr)
+	{
+		throw std::runtime_error("Shader " + name + " is not embedded in the executable!");
+	}
+
+	auto hash = hashBytes(code, size);
+	nameHashes[name] = hash;
+
+	auto module = modules.find(hash);
+	if (module != modules.end())
+	{
+		return module->second;
+	}
+
+	VkShaderModuleCreateInfo shaderModuleCreateInfo{};
+	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderModuleCreateInfo.codeSize = size;
+	shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(code);
+
+	VkShaderModule shaderModule;
+	auto result = vkCreateShaderModule(device, &shaderModuleCreateInfo, nullptr, &shaderModule);
+	if (result != VK_SUCCESS)
+	{
+		nameHashes.erase(name);
+		throw std::runtime_error("Failed to create shader module " + name + "!");
+	}
+
+	modules[hash] = shaderModule;
+	return shaderModule;
+}
+
+uint32_t ShaderLibrary::getModuleCount() const
+{
+	return static_cast<uint32_t>(modules.size());
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <unordered_map>
+
+// spir-v compiled by the build and linked into the executable, see EmbedShaders.cmake
+struct EmbeddedShader
+{
+	const char* name;			// file name of the spir-v, e.g. "vert.spv"
+	const unsigned char* code;	// 4 byte aligned
+	size_t size;
+};
+
+// table of the embedded shaders
+const EmbeddedShader* getEmbeddedShaders(size_t& count);
+
+// shader modules by content hash, a shader is read and hashed once and its module created once
+// no matter how many pipelines use it, all modules live until cleanup
+// shaders are taken from the executable, the build compiles all of Shaders/ (glslangValidator is required)
+// not thread safe, modules are requested while pipelines are set up on the render thread
+class ShaderLibrary
+{
+public:
+	ShaderLibrary() = default;
+
+	void init(VkDevice newDevice);
+	void cleanup();
+
+	// owned by the library, never destroy it, throws for a name that was not embedded
+	VkShaderModule getModule(const std::string& name);
+
+	uint32_t getModuleCount() const;
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+
+	std::unordered_map<std::string, uint64_t> nameHashes;		// names looked up before
+	std::unordered_map<uint64_t, VkShaderModule> modules;		// by content hash, files with equal code share one
+};
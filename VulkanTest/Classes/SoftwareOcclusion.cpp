@@ -0,0 +1,488 @@
+#include "SoftwareOcclusion.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SOFTWARE_OCCLUSION_X86
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	double millisecondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// runs job for every index, inline without a pool
+	void runParallel(ThreadPool* threadPool, uint32_t count, const ThreadPool::Job& job)
+	{
+		if (threadPool != nullptr)
+		{
+			threadPool->parallelFor(count, job);
+			return;
+		}
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			job(i, 0);
+		}
+	}
+}
+
+SoftwareOcclusion::SoftwareOcclusion()
+{
+	resize(DEFAULT_WIDTH, DEFAULT_HEIGHT);
+}
+
+void SoftwareOcclusion::resize(uint32_t newWidth, uint32_t newHeight)
+{
+	// rows are processed in groups of 4 pixels
+	if (newWidth == 0 || newHeight == 0 || newWidth % 4 != 0)
+	{
+		throw std::runtime_error("Software occlusion buffer width has to be a non zero multiple of 4!");
+	}
+
+	width = newWidth;
+	height = newHeight;
+	tilesX = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+	tilesY = (height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+
+	depth.assign(static_cast<size_t>(width) * height, 1.f);
+	tileBins.resize(tilesX * tilesY);
+}
+
+void SoftwareOcclusion::clearOccluders()
+{
+	occluders.clear();
+}
+
+void SoftwareOcclusion::addOccluder(const glm::mat4& model, const std::vector<glm::vec3>& vertices, const std::vector<uint32_t>& indices)
+{
+	occluders.push_back({ model, &vertices, &indices });
+}
+
+void SoftwareOcclusion::render(const glm::mat4& viewProjection, ThreadPool* threadPool)
+{
+	renderViewProjection = viewProjection;
+
+	// transform, every occluder writes its own triangle list
+	auto start = std::chrono::steady_clock::now();
+
+	occluderTriangles.resize(occluders.size());
+	runParallel(threadPool, static_cast<uint32_t>(occluders.size()), [&](uint32_t index, uint32_t)
+	{
+		transformOccluder(occluders[index], viewProjection, occluderTriangles[index]);
+	});
+
+	timings.transformMs = millisecondsSince(start);
+
+	// setup and binning, serial, occluder sets are small
+	start = std::chrono::steady_clock::now();
+
+	triangles.clear();
+	for (auto& bin : tileBins)
+	{
+		bin.clear();
+	}
+
+	for (auto& screenTriangles : occluderTriangles)
+	{
+		for (auto& screenTriangle : screenTriangles)
+		{
+			TriangleSetup setup;
+			if (!setupTriangle(screenTriangle, setup))
+			{
+				continue;
+			}
+
+			auto triangleIndex = static_cast<uint32_t>(triangles.size());
+			triangles.push_back(setup);
+
+			for (auto tileY = setup.minY / TILE_HEIGHT; tileY <= setup.maxY / TILE_HEIGHT; tileY++)
+			{
+				for (auto tileX = setup.minX / TILE_WIDTH; tileX <= setup.maxX / TILE_WIDTH; tileX++)
+				{
+					tileBins[tileY * tilesX + tileX].push_back(triangleIndex);
+				}
+			}
+		}
+	}
+
+	timings.binMs = millisecondsSince(start);
+
+	// rasterize, tiles own disjoint pixels
+	start = std::chrono::steady_clock::now();
+
+	runParallel(threadPool, tilesX * tilesY, [&](uint32_t tile, uint32_t)
+	{
+		rasterizeTile(tile);
+	});
+
+	timings.rasterMs = millisecondsSince(start);
+}
+
+void SoftwareOcclusion::testBoxes(const BoundingBox* boxes, uint32_t count, uint8_t* visibility, ThreadPool* threadPool)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	auto taskCount = (count + BOXES_PER_TEST_TASK - 1) / BOXES_PER_TEST_TASK;
+	runParallel(threadPool, taskCount, [&](uint32_t task, uint32_t)
+	{
+		auto first = task * BOXES_PER_TEST_TASK;
+		auto end = std::min(first + BOXES_PER_TEST_TASK, count);
+
+		for (auto i = first; i < end; i++)
+		{
+			if (visibility[i] != 0 && !isBoxVisible(boxes[i]))
+			{
+				visibility[i] = 0;
+			}
+		}
+	});
+
+	timings.testMs = millisecondsSince(start);
+}
+
+bool SoftwareOcclusion::isBoxVisible(const BoundingBox& box) const
+{
+	// screen rect and closest depth of the corners
+	auto rectMin = glm::vec2(std::numeric_limits<float>::max());
+	auto rectMax = glm::vec2(-std::numeric_limits<float>::max());
+	auto closestDepth = 1.f;
+
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		glm::vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+		auto clip = renderViewProjection * glm::vec4(corner, 1.f);
+
+		// crosses the near plane, the rect is unbounded
+		if (clip.w <= 0.f || clip.z < 0.f)
+		{
+			return true;
+		}
+
+		auto pixel = (glm::vec2(clip) / clip.w * 0.5f + 0.5f) * glm::vec2(static_cast<float>(width), static_cast<float>(height));
+		rectMin = glm::min(rectMin, pixel);
+		rectMax = glm::max(rectMax, pixel);
+		closestDepth = std::min(closestDepth, clip.z / clip.w);
+	}
+
+	// every pixel touched by the rect, widened to groups of 4
+	auto minX = static_cast<int32_t>(std::floor(rectMin.x)) & ~3;
+	auto maxX = static_cast<int32_t>(std::ceil(rectMax.x));
+	auto minY = static_cast<int32_t>(std::floor(rectMin.y));
+	auto maxY = static_cast<int32_t>(std::ceil(rectMax.y));
+
+	minX = std::max(minX, 0);
+	minY = std::max(minY, 0);
+	maxX = std::min(maxX, static_cast<int32_t>(width) - 1);
+	maxY = std::min(maxY, static_cast<int32_t>(height) - 1);
+
+	// off screen, left to the frustum test
+	if (minX > maxX || minY > maxY)
+	{
+		return true;
+	}
+
+	// visible as soon as one pixel is not in front of the box
+	for (auto y = minY; y <= maxY; y++)
+	{
+		auto row = depth.data() + static_cast<size_t>(y) * width;
+
+#if defined(SOFTWARE_OCCLUSION_X86)
+		auto boxDepth = _mm_set1_ps(closestDepth);
+		for (auto x = minX; x <= maxX; x += 4)
+		{
+			if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), boxDepth)) != 0)
+			{
+				return true;
+			}
+		}
+#else
+		for (auto x = minX; x <= maxX; x++)
+		{
+			if (row[x] >= closestDepth)
+			{
+				return true;
+			}
+		}
+#endif
+	}
+
+	return false;
+}
+
+const SoftwareOcclusion::Timings& SoftwareOcclusion::getTimings() const
+{
+	return timings;
+}
+
+void SoftwareOcclusion::dumpDepthBuffer(const std::string& filename) const
+{
+	std::ofstream file(filename, std::ios::binary);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open " + filename + " for the occlusion buffer dump!");
+	}
+
+	file << "P5\n" << width << " " << height << "\n255\n";
+
+	std::vector<uint8_t> pixels(depth.size());
+	for (size_t i = 0; i < depth.size(); i++)
+	{
+		pixels[i] = static_cast<uint8_t>(std::clamp(depth[i], 0.f, 1.f) * 255.f);
+	}
+	file.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+}
+
+uint32_t SoftwareOcclusion::getWidth() const
+{
+	return width;
+}
+
+uint32_t SoftwareOcclusion::getHeight() const
+{
+	return height;
+}
+
+void SoftwareOcclusion::transformOccluder(const Occluder& occluder, const glm::mat4& viewProjection, std::vector<ScreenTriangle>& screenTriangles) const
+{
+	screenTriangles.clear();
+
+	auto modelViewProjection = viewProjection * occluder.model;
+	auto& vertices = *occluder.vertices;
+	auto& indices = *occluder.indices;
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		glm::vec4 clipVertices[3];
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			clipVertices[k] = modelViewProjection * glm::vec4(vertices[indices[i + k]], 1.f);
+		}
+
+		// whole triangle outside one of the side planes
+		auto outside = false;
+		for (uint32_t axis = 0; axis < 2 && !outside; axis++)
+		{
+			outside = (clipVertices[0][axis] > clipVertices[0].w && clipVertices[1][axis] > clipVertices[1].w && clipVertices[2][axis] > clipVertices[2].w)
+				|| (clipVertices[0][axis] < -clipVertices[0].w && clipVertices[1][axis] < -clipVertices[1].w && clipVertices[2][axis] < -clipVertices[2].w);
+		}
+
+		if (!outside)
+		{
+			clipTriangle(clipVertices, screenTriangles);
+		}
+	}
+}
+
+void SoftwareOcclusion::clipTriangle(const glm::vec4* clipVertices, std::vector<ScreenTriangle>& screenTriangles) const
+{
+	// clip against the near plane (z >= 0), a triangle becomes a polygon of up to 4 vertices
+	glm::vec4 polygon[4];
+	uint32_t polygonSize = 0;
+
+	for (uint32_t k = 0; k < 3; k++)
+	{
+		auto& current = clipVertices[k];
+		auto& next = clipVertices[(k + 1) % 3];
+
+		if (current.z >= 0.f)
+		{
+			polygon[polygonSize++] = current;
+		}
+		if ((current.z >= 0.f) != (next.z >= 0.f))
+		{
+			polygon[polygonSize++] = glm::mix(current, next, current.z / (current.z - next.z));
+		}
+	}
+
+	if (polygonSize < 3)
+	{
+		return;
+	}
+
+	// to pixels, y already points down (flipped projection)
+	glm::vec3 screenVertices[4];
+	for (uint32_t k = 0; k < polygonSize; k++)
+	{
+		auto ndc = glm::vec3(polygon[k]) / polygon[k].w;
+		screenVertices[k] = glm::vec3((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height, ndc.z);
+	}
+
+	// fan
+	for (uint32_t k = 1; k + 1 < polygonSize; k++)
+	{
+		screenTriangles.push_back({ { screenVertices[0], screenVertices[k], screenVertices[k + 1] } });
+	}
+}
+
+bool SoftwareOcclusion::setupTriangle(const ScreenTriangle& triangle, TriangleSetup& setup) const
+{
+	auto v0 = triangle.vertices[0];
+	auto v1 = triangle.vertices[1];
+	auto v2 = triangle.vertices[2];
+
+	// both windings are rasterized, flip to a positive area
+	auto area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+	if (area < 0.f)
+	{
+		std::swap(v1, v2);
+		area = -area;
+	}
+	if (area < 1e-6f)
+	{
+		return false;
+	}
+
+	// pixel bounds, clamped to the screen
+	auto minX = std::max(std::floor(std::min({ v0.x, v1.x, v2.x })), 0.f);
+	auto minY = std::max(std::floor(std::min({ v0.y, v1.y, v2.y })), 0.f);
+	auto maxX = std::min(std::ceil(std::max({ v0.x, v1.x, v2.x })), static_cast<float>(width - 1));
+	auto maxY = std::min(std::ceil(std::max({ v0.y, v1.y, v2.y })), static_cast<float>(height - 1));
+	if (minX > maxX || minY > maxY)
+	{
+		return false;
+	}
+
+	setup.minX = static_cast<uint32_t>(minX);
+	setup.minY = static_cast<uint32_t>(minY);
+	setup.maxX = static_cast<uint32_t>(maxX);
+	setup.maxY = static_cast<uint32_t>(maxY);
+
+	// edge k runs from vertex k to vertex k + 1, positive on the side of the remaining vertex
+	const glm::vec3 vertices[3] = { v0, v1, v2 };
+	for (uint32_t k = 0; k < 3; k++)
+	{
+		auto& a = vertices[k];
+		auto& b = vertices[(k + 1) % 3];
+		setup.edgeA[k] = a.y - b.y;
+		setup.edgeB[k] = b.x - a.x;
+		setup.edgeC[k] = -(setup.edgeA[k] * a.x + setup.edgeB[k] * a.y);
+	}
+
+	// depth is linear in screen space, barycentrics of v1 and v2 are edges 2 and 0 over the area
+	auto depth1 = (v1.z - v0.z) / area;
+	auto depth2 = (v2.z - v0.z) / area;
+	setup.depthA = setup.edgeA[2] * depth1 + setup.edgeA[0] * depth2;
+	setup.depthB = setup.edgeB[2] * depth1 + setup.edgeB[0] * depth2;
+	setup.depthC = v0.z + setup.edgeC[2] * depth1 + setup.edgeC[0] * depth2;
+
+	return true;
+}
+
+void SoftwareOcclusion::rasterizeTile(uint32_t tile)
+{
+	auto tileMinX = (tile % tilesX) * TILE_WIDTH;
+	auto tileMinY = (tile / tilesX) * TILE_HEIGHT;
+	auto tileMaxX = std::min(tileMinX + TILE_WIDTH, width) - 1;
+	auto tileMaxY = std::min(tileMinY + TILE_HEIGHT, height) - 1;
+
+	// cleared per tile, so the clear is spread over the threads as well
+	for (auto y = tileMinY; y <= tileMaxY; y++)
+	{
+		std::fill_n(depth.data() + static_cast<size_t>(y) * width + tileMinX, tileMaxX - tileMinX + 1, 1.f);
+	}
+
+	for (auto triangleIndex : tileBins[tile])
+	{
+		auto& setup = triangles[triangleIndex];
+
+		auto minX = std::max(setup.minX, tileMinX);
+		auto maxX = std::min(setup.maxX, tileMaxX);
+		auto minY = std::max(setup.minY, tileMinY);
+		auto maxY = std::min(setup.maxY, tileMaxY);
+
+#if defined(SOFTWARE_OCCLUSION_X86)
+		rasterizeSse(setup, minX, maxX, minY, maxY);
+#else
+		rasterizeScalar(setup, minX, maxX, minY, maxY);
+#endif
+	}
+}
+
+void SoftwareOcclusion::rasterizeScalar(const TriangleSetup& setup, uint32_t minX, uint32_t maxX, uint32_t minY, uint32_t maxY)
+{
+	for (auto y = minY; y <= maxY; y++)
+	{
+		auto row = depth.data() + static_cast<size_t>(y) * width;
+		auto centerY = y + 0.5f;
+
+		for (auto x = minX; x <= maxX; x++)
+		{
+			auto centerX = x + 0.5f;
+
+			auto inside = true;
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				inside &= setup.edgeA[k] * centerX + setup.edgeB[k] * centerY + setup.edgeC[k] >= 0.f;
+			}
+
+			if (inside)
+			{
+				row[x] = std::min(row[x], setup.depthA * centerX + setup.depthB * centerY + setup.depthC);
+			}
+		}
+	}
+}
+
+void SoftwareOcclusion::rasterizeSse(const TriangleSetup& setup, uint32_t minX, uint32_t maxX, uint32_t minY, uint32_t maxY)
+{
+#if defined(SOFTWARE_OCCLUSION_X86)
+	// groups of 4 pixels start at multiples of 4, tiles and rows do as well
+	minX &= ~3u;
+
+	__m128 edgeA[3], edgeB[3], edgeC[3];
+	for (uint32_t k = 0; k < 3; k++)
+	{
+		edgeA[k] = _mm_set1_ps(setup.edgeA[k]);
+		edgeB[k] = _mm_set1_ps(setup.edgeB[k]);
+		edgeC[k] = _mm_set1_ps(setup.edgeC[k]);
+	}
+	auto depthA = _mm_set1_ps(setup.depthA);
+	auto depthB = _mm_set1_ps(setup.depthB);
+	auto depthC = _mm_set1_ps(setup.depthC);
+	auto zero = _mm_setzero_ps();
+	auto laneOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+
+	for (auto y = minY; y <= maxY; y++)
+	{
+		auto row = depth.data() + static_cast<size_t>(y) * width;
+		auto centerY = _mm_set1_ps(y + 0.5f);
+
+		// y part of the edge and depth functions is constant along the row
+		__m128 edgeRow[3];
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			edgeRow[k] = _mm_add_ps(_mm_mul_ps(edgeB[k], centerY), edgeC[k]);
+		}
+		auto depthRow = _mm_add_ps(_mm_mul_ps(depthB, centerY), depthC);
+
+		for (auto x = minX; x <= maxX; x += 4)
+		{
+			auto centerX = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneOffsets);
+
+			auto inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[0], centerX), edgeRow[0]), zero);
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[1], centerX), edgeRow[1]), zero));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[2], centerX), edgeRow[2]), zero));
+
+			if (_mm_movemask_ps(inside) == 0)
+			{
+				continue;
+			}
+
+			auto stored = _mm_loadu_ps(row + x);
+			auto closer = _mm_min_ps(stored, _mm_add_ps(_mm_mul_ps(depthA, centerX), depthRow));
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, stored)));
+		}
+	}
+#else
+	rasterizeScalar(setup, minX, maxX, minY, maxY);
+#endif
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Bounds.h"
+#include "ThreadPool.h"
+
+// occlusion culling on the cpu, no gpu readback involved
+// a few occluder meshes are rasterized into a small depth buffer (nearest depth per pixel, clip space z / w, 1 = nothing drawn),
+// occludee boxes are then tested against it, a box is occluded if its closest point is behind every pixel of its screen rect
+// rasterization runs per screen tile on the thread pool, 4 pixels per instruction with SSE (scalar on other cpus)
+class SoftwareOcclusion
+{
+public:
+	// milliseconds of the stages of the last render / test
+	struct Timings
+	{
+		double transformMs = 0.0;	// occluder vertices to screen space, near plane clipping
+		double binMs = 0.0;			// triangle setup and sorting into screen tiles
+		double rasterMs = 0.0;
+		double testMs = 0.0;		// occludee boxes
+	};
+
+	static inline constexpr const uint32_t DEFAULT_WIDTH = 256;
+	static inline constexpr const uint32_t DEFAULT_HEIGHT = 128;
+	static inline constexpr const uint32_t TILE_WIDTH = 64;
+	static inline constexpr const uint32_t TILE_HEIGHT = 32;
+
+	SoftwareOcclusion();
+
+	// width has to be a multiple of 4
+	void resize(uint32_t newWidth, uint32_t newHeight);
+
+	// occluders of the next render, the vectors are referenced (not copied) until then
+	// vertices are in model space, indices form a triangle list
+	void clearOccluders();
+	void addOccluder(const glm::mat4& model, const std::vector<glm::vec3>& vertices, const std::vector<uint32_t>& indices);
+
+	// clear the depth buffer and rasterize all occluders, threadPool may be null for a single threaded render
+	void render(const glm::mat4& viewProjection, ThreadPool* threadPool);
+
+	// world boxes against the last render, visibility is read and written per box: boxes already at 0 are skipped,
+	// occluded ones are set to 0
+	void testBoxes(const BoundingBox* boxes, uint32_t count, uint8_t* visibility, ThreadPool* threadPool);
+	bool isBoxVisible(const BoundingBox& box) const;
+
+	const Timings& getTimings() const;
+
+	// depth buffer as a binary 8 bit pgm image, near is dark
+	void dumpDepthBuffer(const std::string& filename) const;
+
+	uint32_t getWidth() const;
+	uint32_t getHeight() const;
+
+private:
+	static inline constexpr const uint32_t BOXES_PER_TEST_TASK = 4096;
+
+	struct Occluder
+	{
+		glm::mat4 model;
+		const std::vector<glm::vec3>* vertices;
+		const std::vector<uint32_t>* indices;
+	};
+
+	// screen space x, y and depth of the corners
+	struct ScreenTriangle
+	{
+		glm::vec3 vertices[3];
+	};
+
+	// edge functions (a * x + b * y + c >= 0 inside) and depth plane, evaluated at pixel centers
+	struct TriangleSetup
+	{
+		float edgeA[3];
+		float edgeB[3];
+		float edgeC[3];
+		float depthA;
+		float depthB;
+		float depthC;
+		uint32_t minX, minY, maxX, maxY;	// pixel bounds, inclusive
+	};
+
+	void transformOccluder(const Occluder& occluder, const glm::mat4& viewProjection, std::vector<ScreenTriangle>& triangles) const;
+	void clipTriangle(const glm::vec4* clipVertices, std::vector<ScreenTriangle>& triangles) const;
+	bool setupTriangle(const ScreenTriangle& triangle, TriangleSetup& setup) const;
+
+	void rasterizeTile(uint32_t tile);
+	void rasterizeScalar(const TriangleSetup& setup, uint32_t minX, uint32_t maxX, uint32_t minY, uint32_t maxY);
+	void rasterizeSse(const TriangleSetup& setup, uint32_t minX, uint32_t maxX, uint32_t minY, uint32_t maxY);
+
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t tilesX = 0;
+	uint32_t tilesY = 0;
+	std::vector<float> depth;		// row major, width * height
+	glm::mat4 renderViewProjection{ 1.f };
+
+	std::vector<Occluder> occluders;
+	std::vector<std::vector<ScreenTriangle>> occluderTriangles;		// per occluder, written by the transform stage
+	std::vector<TriangleSetup> triangles;
+	std::vector<std::vector<uint32_t>> tileBins;					// triangle indices per tile
+
+	Timings timings;
+};
@@ -0,0 +1,74 @@
+#include "StagingArena.h"
+
+#include <algorithm>
+
+void StagingArena::init(VkDevice newDevice, MemoryAllocator* newAllocator, VkDeviceSize newBlockSize, VkDeviceSize newMaxSize)
+{
+	device = newDevice;
+	allocator = newAllocator;
+	blockSize = newBlockSize;
+	maxSize = std::max(newMaxSize, newBlockSize);
+
+	// start with one block, more are added on demand
+	grow();
+}
+
+void StagingArena::cleanup()
+{
+	for (auto& block : blocks)
+	{
+		destroyBuffer(device, *allocator, block.buffer, block.memory);
+	}
+	blocks.clear();
+}
+
+bool StagingArena::allocate(VkDeviceSize size, StagingRange& range)
+{
+	for (uint32_t i = 0; i < blocks.size(); i++)
+	{
+		auto& block = blocks[i];
+
+		auto offset = block.ranges.allocate(size, ALIGNMENT);
+		if (offset == RangeAllocator::INVALID_OFFSET)
+		{
+			continue;
+		}
+
+		range.buffer = block.buffer;
+		range.offset = offset;
+		range.size = size;
+		range.data = static_cast<char*>(block.memory.mappedData) + offset;
+		range.block = i;
+
+		return true;
+	}
+
+	return false;
+}
+
+void StagingArena::free(const StagingRange& range)
+{
+	blocks[range.block].ranges.free(range.offset, range.size);
+}
+
+bool StagingArena::grow()
+{
+	if (blockSize * (blocks.size() + 1) > maxSize)
+	{
+		return false;
+	}
+
+	Block block;
+	createBuffer(device, *allocator, blockSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		block.buffer, block.memory);
+	block.ranges = RangeAllocator(blockSize);
+
+	blocks.push_back(std::move(block));
+
+	return true;
+}
+
+VkDeviceSize StagingArena::getBlockSize() const
+{
+	return blockSize;
+}
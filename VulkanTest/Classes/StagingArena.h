@@ -0,0 +1,63 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "Utilities.h"
+#include "RangeAllocator.h"
+
+// piece of a staging block, valid until it is handed back with StagingArena::free
+struct StagingRange
+{
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;			// offset into buffer, use as copy src offset
+	VkDeviceSize size = 0;
+	void* data = nullptr;				// mapped pointer to write the upload data to
+	uint32_t block = 0;
+};
+
+// host visible staging memory shared by all uploads
+// a few large persistently mapped buffers are sub allocated instead of creating a buffer per upload
+// ranges are handed back by the owner once the gpu consumed them (UploadContext does this per batch fence)
+class StagingArena
+{
+public:
+	static inline constexpr const VkDeviceSize DEFAULT_BLOCK_SIZE = 16ull * 1024 * 1024;
+	static inline constexpr const VkDeviceSize DEFAULT_MAX_SIZE = 256ull * 1024 * 1024;
+
+	// copy src offsets stay valid for buffer and image copies of any texel size up to 16 bytes
+	static inline constexpr const VkDeviceSize ALIGNMENT = 16;
+
+	StagingArena() = default;
+
+	void init(VkDevice newDevice, MemoryAllocator* newAllocator, VkDeviceSize newBlockSize = DEFAULT_BLOCK_SIZE, VkDeviceSize newMaxSize = DEFAULT_MAX_SIZE);
+	void cleanup();
+
+	// false if no block has room, size must not exceed the block size
+	bool allocate(VkDeviceSize size, StagingRange& range);
+	void free(const StagingRange& range);
+
+	// add another block, false once the arena reached its max size
+	bool grow();
+
+	// largest single allocation, bigger uploads have to be split
+	VkDeviceSize getBlockSize() const;
+
+private:
+	struct Block
+	{
+		VkBuffer buffer;
+		MemoryAllocation memory;
+		RangeAllocator ranges;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+
+	VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE;
+	VkDeviceSize maxSize = DEFAULT_MAX_SIZE;
+
+	std::vector<Block> blocks;
+};
@@ -0,0 +1,118 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+void ThreadPool::init(uint32_t threadCount)
+{
+	if (threadCount == 0)
+	{
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	stopping = false;
+
+	// thread 0 is the caller of parallelFor
+	for (uint32_t i = 1; i < threadCount; i++)
+	{
+		workers.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+}
+
+void ThreadPool::cleanup()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workAvailable.notify_all();
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+}
+
+void ThreadPool::parallelFor(uint32_t count, const Job& job)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	// no workers or a single job, nothing to hand out
+	if (workers.empty() || count == 1)
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			job(i, 0);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		currentJob = &job;
+		jobCount = count;
+		nextIndex = 0;
+		remainingJobs = count;
+		generation++;
+	}
+	workAvailable.notify_all();
+
+	runJobs(0);
+
+	// workers must be out of runJobs before job goes out of scope
+	std::unique_lock<std::mutex> lock(mutex);
+	workFinished.wait(lock, [this] { return remainingJobs == 0 && activeWorkers == 0; });
+	currentJob = nullptr;
+}
+
+uint32_t ThreadPool::getThreadCount() const
+{
+	return static_cast<uint32_t>(workers.size()) + 1;
+}
+
+void ThreadPool::workerLoop(uint32_t threadIndex)
+{
+	uint64_t lastGeneration = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			workAvailable.wait(lock, [&] { return stopping || (generation != lastGeneration && currentJob != nullptr); });
+
+			if (stopping)
+			{
+				return;
+			}
+
+			lastGeneration = generation;
+			activeWorkers++;
+		}
+
+		runJobs(threadIndex);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			activeWorkers--;
+		}
+		workFinished.notify_all();
+	}
+}
+
+void ThreadPool::runJobs(uint32_t threadIndex)
+{
+	uint32_t index;
+	while ((index = nextIndex.fetch_add(1)) < jobCount)
+	{
+		(*currentJob)(index, threadIndex);
+
+		if (remainingJobs.fetch_sub(1) == 1)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			workFinished.notify_all();
+		}
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed set of worker threads running index based jobs
+// parallelFor is meant to be called from one thread at a time, the calling thread works along as thread 0
+class ThreadPool
+{
+public:
+	// job(index, threadIndex), threadIndex is stable per thread and < getThreadCount()
+	using Job = std::function<void(uint32_t index, uint32_t threadIndex)>;
+
+	ThreadPool() = default;
+
+	// threadCount includes the calling thread, 0 = one per hardware thread
+	void init(uint32_t threadCount = 0);
+	void cleanup();
+
+	// runs job for every index in [0, count) and returns once all of them finished
+	void parallelFor(uint32_t count, const Job& job);
+
+	uint32_t getThreadCount() const;
+
+private:
+	void workerLoop(uint32_t threadIndex);
+	void runJobs(uint32_t threadIndex);
+
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::condition_variable workFinished;
+
+	const Job* currentJob = nullptr;
+	uint32_t jobCount = 0;
+	uint64_t generation = 0;			// increased for every parallelFor, wakes the workers
+	uint32_t activeWorkers = 0;			// workers currently inside runJobs
+	bool stopping = false;
+
+	std::atomic<uint32_t> nextIndex{ 0 };
+	std::atomic<uint32_t> remainingJobs{ 0 };
+};
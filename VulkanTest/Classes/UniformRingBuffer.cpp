@@ -0,0 +1,58 @@
+#include "UniformRingBuffer.h"
+
+void UniformRingBuffer::init(VkPhysicalDevice physicalDevice, VkDevice newDevice, MemoryAllocator* newAllocator, uint32_t newFrameCount,
+	VkDeviceSize newFrameSize)
+{
+	device = newDevice;
+	allocator = newAllocator;
+	frameCount = newFrameCount;
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+	alignment = deviceProperties.limits.minUniformBufferOffsetAlignment;
+
+	// every region has to start at a valid dynamic offset
+	frameSize = alignUp(newFrameSize, alignment);
+
+	// host coherent, so writes need no flush, memory is mapped once by the allocator
+	createBuffer(device, *allocator, frameSize * frameCount, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, bufferMemory);
+
+	frameBegin = 0;
+	head = 0;
+}
+
+void UniformRingBuffer::cleanup()
+{
+	destroyBuffer(device, *allocator, buffer, bufferMemory);
+}
+
+void UniformRingBuffer::beginFrame(uint32_t frameIndex)
+{
+	frameBegin = frameSize * (frameIndex % frameCount);
+	head = 0;
+}
+
+uint32_t UniformRingBuffer::allocate(VkDeviceSize size, void** data)
+{
+	auto offset = alignUp(head, alignment);
+	if (offset + size > frameSize)
+	{
+		throw std::runtime_error("Uniform ring buffer frame region is full!");
+	}
+
+	head = offset + size;
+
+	*data = static_cast<char*>(bufferMemory.mappedData) + frameBegin + offset;
+	return static_cast<uint32_t>(frameBegin + offset);
+}
+
+VkBuffer UniformRingBuffer::getBuffer() const
+{
+	return buffer;
+}
+
+VkDeviceSize UniformRingBuffer::getFrameSize() const
+{
+	return frameSize;
+}
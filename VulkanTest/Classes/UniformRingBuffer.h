@@ -0,0 +1,56 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <cstring>
+
+#include "Utilities.h"
+
+// one persistently mapped uniform buffer split into a region per frame
+// per frame constants are bump allocated from the region of the current frame and bound with dynamic offsets
+// so no map / unmap or buffer creation happens while drawing
+class UniformRingBuffer
+{
+public:
+	static inline constexpr const VkDeviceSize DEFAULT_FRAME_SIZE = 64 * 1024;
+
+	UniformRingBuffer() = default;
+
+	void init(VkPhysicalDevice physicalDevice, VkDevice newDevice, MemoryAllocator* newAllocator, uint32_t newFrameCount,
+		VkDeviceSize newFrameSize = DEFAULT_FRAME_SIZE);
+	void cleanup();
+
+	// start writing into the region of the given frame, the gpu must be done with its previous use
+	void beginFrame(uint32_t frameIndex);
+
+	// reserve size bytes in the current frame region, returns the dynamic offset and the mapped pointer to write to
+	uint32_t allocate(VkDeviceSize size, void** data);
+
+	// copy value into the current frame region, returns its dynamic offset
+	template<typename T>
+	uint32_t push(const T& value)
+	{
+		void* data;
+		auto offset = allocate(sizeof(T), &data);
+		memcpy(data, &value, sizeof(T));
+		return offset;
+	}
+
+	VkBuffer getBuffer() const;
+	VkDeviceSize getFrameSize() const;
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+
+	VkBuffer buffer = VK_NULL_HANDLE;
+	MemoryAllocation bufferMemory;
+
+	VkDeviceSize alignment = 0;		// minUniformBufferOffsetAlignment
+	VkDeviceSize frameSize = 0;
+	uint32_t frameCount = 0;
+
+	VkDeviceSize frameBegin = 0;	// start of the current frame region
+	VkDeviceSize head = 0;			// next free byte in the current frame region, relative to frameBegin
+};
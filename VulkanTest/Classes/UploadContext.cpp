@@ -0,0 +1,511 @@
+#include "UploadContext.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+static VkCommandPool createUploadCommandPool(VkDevice device, uint32_t queueFamily)
+{
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;	// batch command buffers are reset and reused
+	poolInfo.queueFamilyIndex = queueFamily;
+
+	VkCommandPool commandPool;
+	auto result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create upload command pool!");
+	}
+
+	return commandPool;
+}
+
+void UploadContext::init(VkDevice newDevice, MemoryAllocator* newAllocator, VkQueue newTransferQueue, uint32_t newTransferFamily,
+	VkQueue newGraphicsQueue, uint32_t newGraphicsFamily)
+{
+	device = newDevice;
+	allocator = newAllocator;
+	transferQueue = newTransferQueue;
+	transferFamily = newTransferFamily;
+	graphicsQueue = newGraphicsQueue;
+	graphicsFamily = newGraphicsFamily;
+
+	stagingArena.init(device, allocator);
+
+	transferCommandPool = createUploadCommandPool(device, transferFamily);
+
+	// acquire barriers have to be recorded on the graphics family
+	if (hasDedicatedTransferQueue())
+	{
+		graphicsCommandPool = createUploadCommandPool(device, graphicsFamily);
+	}
+}
+
+void UploadContext::cleanup()
+{
+	// make sure nothing is left unsubmitted or in flight
+	flush();
+
+	for (auto fence : freeFences)
+	{
+		vkDestroyFence(device, fence, nullptr);
+	}
+	freeFences.clear();
+
+	for (auto semaphore : freeSemaphores)
+	{
+		vkDestroySemaphore(device, semaphore, nullptr);
+	}
+	freeSemaphores.clear();
+
+	stagingArena.cleanup();
+
+	// destroying the pools frees all command buffers
+	vkDestroyCommandPool(device, transferCommandPool, nullptr);
+	freeTransferCommandBuffers.clear();
+
+	if (graphicsCommandPool != VK_NULL_HANDLE)
+	{
+		vkDestroyCommandPool(device, graphicsCommandPool, nullptr);
+		freeGraphicsCommandBuffers.clear();
+	}
+}
+
+void UploadContext::uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+{
+	// nothing to copy, and a zero sized ownership barrier is invalid
+	if (size == 0)
+	{
+		return;
+	}
+
+	auto chunkSize = stagingArena.getBlockSize();
+	for (VkDeviceSize copied = 0; copied < size; copied += chunkSize)
+	{
+		auto copySize = std::min(chunkSize, size - copied);
+
+		// staging first, getting space may submit the current batch
+		auto staging = allocateStaging(copySize);
+		if (!recording)
+		{
+			beginBatch();
+		}
+
+		memcpy(staging.data, static_cast<const char*>(data) + copied, static_cast<size_t>(copySize));
+
+		VkBufferCopy bufferCopyRegion{};
+		bufferCopyRegion.srcOffset = staging.offset;
+		bufferCopyRegion.dstOffset = dstOffset + copied;
+		bufferCopyRegion.size = copySize;
+
+		vkCmdCopyBuffer(currentBatch.commandBuffer, staging.buffer, dstBuffer, 1, &bufferCopyRegion);
+
+		currentBatch.stagingRanges.push_back(staging);
+	}
+
+	currentBatch.hasBufferCopies = true;
+	uploadedBytes += size;
+
+	if (hasDedicatedTransferQueue())
+	{
+		// hand the written range over to the graphics family
+		VkBufferMemoryBarrier releaseBarrier{};
+		releaseBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		releaseBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		releaseBarrier.dstAccessMask = 0;								// ignored for release
+		releaseBarrier.srcQueueFamilyIndex = transferFamily;
+		releaseBarrier.dstQueueFamilyIndex = graphicsFamily;
+		releaseBarrier.buffer = dstBuffer;
+		releaseBarrier.offset = dstOffset;
+		releaseBarrier.size = size;
+
+		auto acquireBarrier = releaseBarrier;
+		acquireBarrier.srcAccessMask = 0;								// ignored for acquire
+		acquireBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+
+		currentBatch.releaseBufferBarriers.push_back(releaseBarrier);
+		currentBatch.acquireBufferBarriers.push_back(acquireBarrier);
+	}
+}
+
+void UploadContext::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset, VkDeviceSize dstOffset)
+{
+	if (!recording)
+	{
+		beginBatch();
+	}
+
+	VkBufferCopy bufferCopyRegion{};
+	bufferCopyRegion.srcOffset = srcOffset;
+	bufferCopyRegion.dstOffset = dstOffset;
+	bufferCopyRegion.size = size;
+
+	// both buffers belong to the graphics family, so copy there instead of transferring ownership back and forth
+	vkCmdCopyBuffer(getGraphicsCommandBuffer(), srcBuffer, dstBuffer, 1, &bufferCopyRegion);
+	currentBatch.hasGraphicsCopies = true;
+}
+
+void UploadContext::uploadImage(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height)
+{
+	uploadedBytes += size;
+
+	if (!recording)
+	{
+		beginBatch();
+	}
+
+	// transition image to be dst for copy operation
+	recordTransitionImageLayout(currentBatch.commandBuffer, image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+	// copy image data, split into bands of whole rows if it does not fit into one staging block
+	auto rowSize = size / height;
+	if (rowSize > stagingArena.getBlockSize())
+	{
+		throw std::runtime_error("Image row does not fit into a staging block!");
+	}
+
+	auto rowsPerChunk = static_cast<uint32_t>(stagingArena.getBlockSize() / rowSize);
+	for (uint32_t row = 0; row < height; row += rowsPerChunk)
+	{
+		auto rowCount = std::min(rowsPerChunk, height - row);
+
+		auto staging = allocateStaging(rowSize * rowCount);
+		if (!recording)
+		{
+			beginBatch();
+		}
+
+		memcpy(staging.data, static_cast<const char*>(data) + rowSize * row, static_cast<size_t>(rowSize * rowCount));
+
+		recordCopyImageBuffer(currentBatch.commandBuffer, staging.buffer, staging.offset, image, width, rowCount, static_cast<int32_t>(row));
+
+		currentBatch.stagingRanges.push_back(staging);
+	}
+
+	// transition to shader readable is recorded for all images of the batch at once on submit
+	VkPipelineStageFlags srcStage;
+	VkPipelineStageFlags dstStage;
+	auto barrier = createImageLayoutBarrier(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, srcStage, dstStage);
+	currentBatch.imageDstStages |= dstStage;
+
+	if (hasDedicatedTransferQueue())
+	{
+		// release + acquire pair must describe the same layout transition
+		barrier.srcQueueFamilyIndex = transferFamily;
+		barrier.dstQueueFamilyIndex = graphicsFamily;
+
+		auto acquireBarrier = barrier;
+		acquireBarrier.srcAccessMask = 0;
+		barrier.dstAccessMask = 0;
+
+		currentBatch.acquireImageBarriers.push_back(acquireBarrier);
+	}
+
+	currentBatch.releaseImageBarriers.push_back(barrier);
+}
+
+UploadTicket UploadContext::submit()
+{
+	if (!recording)
+	{
+		// nothing recorded, last submitted batch is the one to wait for
+		return nextTicket - 1;
+	}
+
+	auto& batch = currentBatch;
+
+	// make transfer writes visible to everything reading the uploaded data
+	VkMemoryBarrier memoryBarrier{};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+
+	VkPipelineStageFlags dstStages = batch.imageDstStages;
+	if (batch.hasBufferCopies || batch.hasGraphicsCopies)
+	{
+		dstStages |= VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	}
+
+	if (hasDedicatedTransferQueue())
+	{
+		// release ownership on the transfer queue, dst stage is ignored for releases
+		if (!batch.releaseBufferBarriers.empty() || !batch.releaseImageBarriers.empty())
+		{
+			vkCmdPipelineBarrier(batch.commandBuffer,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+				0, nullptr,
+				static_cast<uint32_t>(batch.releaseBufferBarriers.size()), batch.releaseBufferBarriers.data(),
+				static_cast<uint32_t>(batch.releaseImageBarriers.size()), batch.releaseImageBarriers.data());
+		}
+
+		// acquire on the graphics queue, src stage is ignored for acquires
+		auto graphicsCommandBuffer = getGraphicsCommandBuffer();
+		vkCmdPipelineBarrier(graphicsCommandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, dstStages, 0,
+			batch.hasGraphicsCopies ? 1 : 0, &memoryBarrier,
+			static_cast<uint32_t>(batch.acquireBufferBarriers.size()), batch.acquireBufferBarriers.data(),
+			static_cast<uint32_t>(batch.acquireImageBarriers.size()), batch.acquireImageBarriers.data());
+
+		vkEndCommandBuffer(graphicsCommandBuffer);
+	}
+	else
+	{
+		vkCmdPipelineBarrier(batch.commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, dstStages, 0,
+			(batch.hasBufferCopies || batch.hasGraphicsCopies) ? 1 : 0, &memoryBarrier,
+			0, nullptr,
+			static_cast<uint32_t>(batch.releaseImageBarriers.size()), batch.releaseImageBarriers.data());
+	}
+
+	vkEndCommandBuffer(batch.commandBuffer);
+
+	// get a fence to signal when the batch is done
+	if (!freeFences.empty())
+	{
+		batch.fence = freeFences.back();
+		freeFences.pop_back();
+	}
+	else
+	{
+		VkFenceCreateInfo fenceCreateInfo{};
+		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		if (vkCreateFence(device, &fenceCreateInfo, nullptr, &batch.fence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create upload fence!");
+		}
+	}
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &batch.commandBuffer;
+
+	if (hasDedicatedTransferQueue())
+	{
+		// graphics submit waits for the transfer submit through a semaphore
+		if (!freeSemaphores.empty())
+		{
+			batch.transferFinished = freeSemaphores.back();
+			freeSemaphores.pop_back();
+		}
+		else
+		{
+			VkSemaphoreCreateInfo semaphoreCreateInfo{};
+			semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+			if (vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &batch.transferFinished) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create upload semaphore!");
+			}
+		}
+
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &batch.transferFinished;
+
+		auto result = vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit upload batch!");
+		}
+
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+		VkSubmitInfo acquireSubmitInfo{};
+		acquireSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		acquireSubmitInfo.waitSemaphoreCount = 1;
+		acquireSubmitInfo.pWaitSemaphores = &batch.transferFinished;
+		acquireSubmitInfo.pWaitDstStageMask = &waitStage;
+		acquireSubmitInfo.commandBufferCount = 1;
+		acquireSubmitInfo.pCommandBuffers = &batch.graphicsCommandBuffer;
+
+		result = vkQueueSubmit(graphicsQueue, 1, &acquireSubmitInfo, batch.fence);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit upload acquire batch!");
+		}
+	}
+	else
+	{
+		auto result = vkQueueSubmit(transferQueue, 1, &submitInfo, batch.fence);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to submit upload batch!");
+		}
+	}
+
+	batch.ticket = nextTicket++;
+	auto ticket = batch.ticket;
+
+	pendingBatches.push_back(std::move(batch));
+	currentBatch = Batch{};
+	recording = false;
+
+	return ticket;
+}
+
+bool UploadContext::isComplete(UploadTicket ticket)
+{
+	retireBatches();
+	return ticket <= completedTicket;
+}
+
+void UploadContext::wait(UploadTicket ticket)
+{
+	// the batch has not been submitted yet
+	if (ticket >= nextTicket)
+	{
+		submit();
+	}
+
+	for (const auto& batch : pendingBatches)
+	{
+		if (batch.ticket > ticket)
+		{
+			break;
+		}
+
+		vkWaitForFences(device, 1, &batch.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+	}
+
+	retireBatches();
+}
+
+void UploadContext::flush()
+{
+	wait(submit());
+}
+
+bool UploadContext::hasDedicatedTransferQueue() const
+{
+	return transferFamily != graphicsFamily;
+}
+
+uint64_t UploadContext::getUploadedBytes() const
+{
+	return uploadedBytes;
+}
+
+void UploadContext::beginBatch()
+{
+	currentBatch.commandBuffer = beginCommandBuffer(transferCommandPool, freeTransferCommandBuffers);
+	recording = true;
+}
+
+VkCommandBuffer UploadContext::beginCommandBuffer(VkCommandPool pool, std::vector<VkCommandBuffer>& freeList)
+{
+	VkCommandBuffer commandBuffer;
+
+	// reuse command buffer of a retired batch if possible
+	if (!freeList.empty())
+	{
+		commandBuffer = freeList.back();
+		freeList.pop_back();
+	}
+	else
+	{
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = pool;
+		allocInfo.commandBufferCount = 1;
+
+		if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate upload command buffer!");
+		}
+	}
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	return commandBuffer;
+}
+
+VkCommandBuffer UploadContext::getGraphicsCommandBuffer()
+{
+	// same family, everything goes into the one command buffer
+	if (!hasDedicatedTransferQueue())
+	{
+		return currentBatch.commandBuffer;
+	}
+
+	if (currentBatch.graphicsCommandBuffer == VK_NULL_HANDLE)
+	{
+		currentBatch.graphicsCommandBuffer = beginCommandBuffer(graphicsCommandPool, freeGraphicsCommandBuffers);
+	}
+
+	return currentBatch.graphicsCommandBuffer;
+}
+
+StagingRange UploadContext::allocateStaging(VkDeviceSize size)
+{
+	StagingRange staging;
+	while (!stagingArena.allocate(size, staging))
+	{
+		// space of finished batches is reused before adding memory
+		retireBatches();
+		if (stagingArena.allocate(size, staging))
+		{
+			break;
+		}
+
+		if (stagingArena.grow())
+		{
+			continue;
+		}
+
+		// arena is at its max size, everything is used by batches in flight or the current one
+		if (pendingBatches.empty())
+		{
+			submit();
+		}
+		wait(pendingBatches.front().ticket);
+	}
+
+	return staging;
+}
+
+void UploadContext::retireBatches()
+{
+	// batches complete in submission order
+	while (!pendingBatches.empty())
+	{
+		auto& batch = pendingBatches.front();
+		if (vkGetFenceStatus(device, batch.fence) != VK_SUCCESS)
+		{
+			break;
+		}
+
+		for (auto& staging : batch.stagingRanges)
+		{
+			stagingArena.free(staging);
+		}
+
+		vkResetFences(device, 1, &batch.fence);
+		freeFences.push_back(batch.fence);
+
+		vkResetCommandBuffer(batch.commandBuffer, 0);
+		freeTransferCommandBuffers.push_back(batch.commandBuffer);
+
+		if (batch.graphicsCommandBuffer != VK_NULL_HANDLE)
+		{
+			vkResetCommandBuffer(batch.graphicsCommandBuffer, 0);
+			freeGraphicsCommandBuffers.push_back(batch.graphicsCommandBuffer);
+		}
+
+		// graphics submit waited on it, so it is unsignaled again
+		if (batch.transferFinished != VK_NULL_HANDLE)
+		{
+			freeSemaphores.push_back(batch.transferFinished);
+		}
+
+		completedTicket = batch.ticket;
+		pendingBatches.pop_front();
+	}
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <deque>
+#include <vector>
+
+#include "Utilities.h"
+#include "StagingArena.h"
+
+// identifies a submitted upload batch, increases with every submit
+using UploadTicket = uint64_t;
+
+// records buffer and image uploads into one command buffer and submits them together
+// instead of one submit + vkQueueWaitIdle per copy
+// uploads run on the transfer queue, if it belongs to a different family than the graphics queue
+// ownership of uploaded ranges / images is released there and acquired on the graphics queue
+class UploadContext
+{
+public:
+	UploadContext() = default;
+
+	void init(VkDevice newDevice, MemoryAllocator* newAllocator, VkQueue newTransferQueue, uint32_t newTransferFamily,
+		VkQueue newGraphicsQueue, uint32_t newGraphicsFamily);
+	void cleanup();
+
+	// record copy of data into dst buffer, data is copied to staging memory immediately
+	// uploads larger than a staging block are split into several copies
+	// dst buffer must be used by the graphics queue family afterwards
+	void uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+
+	// record gpu side copy between two buffers owned by the graphics queue family
+	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0);
+
+	// record copy of tightly packed pixel data into the whole image (single mip / layer)
+	// image ends up in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, owned by the graphics queue family
+	void uploadImage(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height);
+
+	// submit everything recorded so far, returns ticket of the batch (or of the last batch if nothing was recorded)
+	UploadTicket submit();
+
+	// true once the gpu finished the batch with this ticket
+	bool isComplete(UploadTicket ticket);
+	void wait(UploadTicket ticket);
+
+	// submit and wait for everything recorded so far
+	void flush();
+
+	bool hasDedicatedTransferQueue() const;
+
+	// bytes copied through staging memory since init
+	uint64_t getUploadedBytes() const;
+
+private:
+	struct Batch
+	{
+		UploadTicket ticket = 0;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;				// transfer queue
+		VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;		// graphics queue, acquire barriers and graphics side copies
+		VkSemaphore transferFinished = VK_NULL_HANDLE;				// transfer -> graphics submit
+		VkFence fence = VK_NULL_HANDLE;
+		std::vector<StagingRange> stagingRanges;					// returned to the arena once the batch completed
+
+		// shader read transitions / ownership release, recorded together at submit
+		std::vector<VkBufferMemoryBarrier> releaseBufferBarriers;
+		std::vector<VkImageMemoryBarrier> releaseImageBarriers;
+
+		// matching ownership acquire on the graphics queue
+		std::vector<VkBufferMemoryBarrier> acquireBufferBarriers;
+		std::vector<VkImageMemoryBarrier> acquireImageBarriers;
+
+		VkPipelineStageFlags imageDstStages = 0;
+		bool hasBufferCopies = false;
+		bool hasGraphicsCopies = false;
+	};
+
+	void beginBatch();
+	VkCommandBuffer beginCommandBuffer(VkCommandPool pool, std::vector<VkCommandBuffer>& freeList);
+	VkCommandBuffer getGraphicsCommandBuffer();
+	// waits for older batches if the arena is full and can not grow, may submit the current batch
+	StagingRange allocateStaging(VkDeviceSize size);
+
+	// release resources of completed batches
+	void retireBatches();
+
+	VkDevice device = VK_NULL_HANDLE;
+	MemoryAllocator* allocator = nullptr;
+	StagingArena stagingArena;
+
+	VkQueue transferQueue = VK_NULL_HANDLE;
+	uint32_t transferFamily = 0;
+	VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+
+	VkQueue graphicsQueue = VK_NULL_HANDLE;
+	uint32_t graphicsFamily = 0;
+	VkCommandPool graphicsCommandPool = VK_NULL_HANDLE;
+
+	bool recording = false;
+	Batch currentBatch;
+	std::deque<Batch> pendingBatches;		// submitted, oldest first
+
+	// recycled from retired batches
+	std::vector<VkCommandBuffer> freeTransferCommandBuffers;
+	std::vector<VkCommandBuffer> freeGraphicsCommandBuffers;
+	std::vector<VkFence> freeFences;
+	std::vector<VkSemaphore> freeSemaphores;
+
+	UploadTicket nextTicket = 1;
+	UploadTicket completedTicket = 0;
+	uint64_t uploadedBytes = 0;
+};
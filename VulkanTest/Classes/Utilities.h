@@ -10,8 +10,9 @@
 #include <fstream>
 #include <glm/glm.hpp>
 
+#include "MemoryAllocator.h"
+
 static inline constexpr const auto MAX_FRAME_DRAWS = 2;
-static inline constexpr const auto MAX_OBJECTS = 2;
 
 static inline const std::vector<const char*> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 
@@ -27,6 +28,7 @@ struct QueueFamilyIndices
 {
 	int graphicsFamily = -1;	//location of graphics queue family
 	int presentationFamily = -1; // location of presentation queue family
+	int transferFamily = -1;	// location of queue family used for uploads, same as graphics if there is no dedicated one
 
 	//check if queue families are valid
 	bool isValid() const
@@ -48,55 +50,23 @@ struct SwapChainImage
 	VkImageView imageView;
 };
 
-static std::vector<char> readFile(const std::string& filename)
+// FNV-1a, detects changed or damaged data, not meant to resist tampering
+static uint64_t hashBytes(const void* data, size_t size)
 {
-	//open stream from given file
-	//std::ios::binary tells stream to read file as binary
-	//std::ios::ate tells stream to start reading from end of file
-	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	auto bytes = static_cast<const uint8_t*>(data);
 
-	//check if file stream successfully opened
-	if (!file.is_open())
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < size; i++)
 	{
-		throw std::runtime_error("failed to open a file!");
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
 	}
 
-	//get current read position and use it to resize the file buffer
-	auto fileSize = static_cast<size_t>(file.tellg());
-	std::vector<char> fileBuffer(fileSize);
-	
-	// move read position (seek to) the start of the file
-	file.seekg(0);
-
-	//read the file data into the buffer (stream fileSize in total)
-	file.read(fileBuffer.data(), fileSize);
-
-	file.close();
-	return fileBuffer;
+	return hash;
 }
 
-static uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice, uint32_t allowedTypes, VkMemoryPropertyFlags properties)
-{
-	// get properties of physical device memory
-	VkPhysicalDeviceMemoryProperties memoryProperties;
-	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
-
-	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
-	{
-		if ((allowedTypes & (1 << i))				// index of memory type must match corresponding bit in allowedTypes
-			&& (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)  // desired property bit flags are part of the memory types property flags
-		{
-			// this memory type is valid, so return its index
-			return i;
-		}
-	}
-
-	//return ??
-}
-
-
-static void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device,VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage,
-	VkMemoryPropertyFlags bufferProperties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+static void createBuffer(VkDevice device, MemoryAllocator& allocator, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage,
+	VkMemoryPropertyFlags bufferProperties, VkBuffer& buffer, MemoryAllocation& bufferMemory)
 {
 	// CREATE VERTEX BUFFER
 
@@ -117,24 +87,19 @@ static void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device,VkDevi
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-	//allocate memory to buffer
-	VkMemoryAllocateInfo memAllocInfo{};
-	memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memAllocInfo.allocationSize = memRequirements.size;
-	memAllocInfo.memoryTypeIndex = findMemoryTypeIndex(physicalDevice, memRequirements.memoryTypeBits,	//inde of memory type on physical device that has required bitflags
-		bufferProperties);//VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	// VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT : cpu can interact with memory
+	// get a range of a memory block with the required bitflags from the allocator
+	// VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT : cpu can interact with memory (allocator keeps it mapped, see bufferMemory.mappedData)
 	// VK_MEMORY_PROPERTY_HOST_COHERENT_BIT : allows placement of data straight into buffer after mapping (otherwise have to specify manually)
+	bufferMemory = allocator.allocate(memRequirements, bufferProperties, true);
 
-// allocate memory to VkDeviceMemory
-	result = vkAllocateMemory(device, &memAllocInfo, nullptr, &bufferMemory);
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to allocated Vertex Buffer Memory!");
-	}
+	// bind buffer to its range inside the memory block
+	vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);
+}
 
-	// allocate memory to given vertex buffer
-	vkBindBufferMemory(device, buffer, bufferMemory, 0);  // offset in memory is 0, we dont have anything else the using the memory where we would an offset for
+static void destroyBuffer(VkDevice device, MemoryAllocator& allocator, VkBuffer buffer, MemoryAllocation& bufferMemory)
+{
+	vkDestroyBuffer(device, buffer, nullptr);
+	allocator.free(bufferMemory);
 }
 
 static VkCommandBuffer beginCommandbuffer(VkDevice device, VkCommandPool commandPool)
@@ -183,49 +148,29 @@ static void endAndSubmitCommandbuffer(VkDevice device, VkCommandPool commandPool
 	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
 }
 
-static void copyBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool,
-	VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize bufferSize)
-{
-	// create buffer
-	VkCommandBuffer transferCommandBuffer = beginCommandbuffer(device, transferCommandPool);
-	
-	//region of data to copy from and to  (copy from start of src to start of dst (0)
-	VkBufferCopy bufferCopyRegion{};
-	bufferCopyRegion.srcOffset = 0;
-	bufferCopyRegion.dstOffset = 0;
-	bufferCopyRegion.size = bufferSize;
-
-	//command to copy src buffer to dst buffer
-	vkCmdCopyBuffer(transferCommandBuffer, srcBuffer, dstBuffer, 1, &bufferCopyRegion);
-
-	endAndSubmitCommandbuffer(device, transferCommandPool, transferQueue, transferCommandBuffer);
-}
-
-static void copyImageBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool, VkBuffer srcBuffer, VkImage image, uint32_t width, uint32_t height)
+// copies height rows of tightly packed data into the image, starting at row offsetY
+static void recordCopyImageBuffer(VkCommandBuffer commandBuffer, VkBuffer srcBuffer, VkDeviceSize srcOffset, VkImage image, uint32_t width, uint32_t height,
+	int32_t offsetY = 0)
 {
-	VkCommandBuffer transferCommandBuffer = beginCommandbuffer(device, transferCommandPool);
-
 	VkBufferImageCopy imageRegion{};
-	imageRegion.bufferOffset = 0;						// offset into data
+	imageRegion.bufferOffset = srcOffset;				// offset into data
 	imageRegion.bufferRowLength = 0;					// data spacing - row length of data to calculate data spacing
 	imageRegion.bufferImageHeight = 0;					// image height to calculate data spacing
 	imageRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT; // which aspect of image to copy
 	imageRegion.imageSubresource.mipLevel = 0;			// mipmap level to copy
 	imageRegion.imageSubresource.baseArrayLayer = 0;	// starting array layer (if array)
 	imageRegion.imageSubresource.layerCount = 1;		// number of layers to copy, starting at base array layer
-	imageRegion.imageOffset = { 0, 0, 0 };				// offset into image (as opposed to raw data in bufferOffset) - start at origin 0,0,0
+	imageRegion.imageOffset = { 0, offsetY, 0 };		// offset into image (as opposed to raw data in bufferOffset) - start at row offsetY
 	imageRegion.imageExtent = { width, height, 1 };		// size of region to copy as (x, y ,z)
 
 	// copy buffer to given image
-	vkCmdCopyBufferToImage(transferCommandBuffer, srcBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageRegion); // we used transfer_dst_bit
-
-	endAndSubmitCommandbuffer(device, transferCommandPool, transferQueue, transferCommandBuffer);
+	vkCmdCopyBufferToImage(commandBuffer, srcBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageRegion); // we used transfer_dst_bit
 }
 
-static void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool commandPool, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout)
+// fills barrier + stages for the layout transitions used by texture uploads
+static VkImageMemoryBarrier createImageLayoutBarrier(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+	VkPipelineStageFlags& srcStage, VkPipelineStageFlags& dstStage)
 {
-	VkCommandBuffer commandBuffer = beginCommandbuffer(device, commandPool);
-
 	VkImageMemoryBarrier imageMemoryBarrier{};
 	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 	imageMemoryBarrier.oldLayout = oldLayout;								//transition from
@@ -239,8 +184,8 @@ static void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool
 	imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
 	imageMemoryBarrier.subresourceRange.levelCount = 1;
 
-	VkPipelineStageFlags srcStage;
-	VkPipelineStageFlags dstStage;
+	srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	dstStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
 
 	//if transitioning from new image to image ready to received data
 	if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
@@ -262,6 +207,15 @@ static void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool
 		dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;		// makes sure its ready before the fragment shader
 	}
 
+	return imageMemoryBarrier;
+}
+
+static void recordTransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout)
+{
+	VkPipelineStageFlags srcStage;
+	VkPipelineStageFlags dstStage;
+	auto imageMemoryBarrier = createImageLayoutBarrier(image, oldLayout, newLayout, srcStage, dstStage);
+
 	vkCmdPipelineBarrier(commandBuffer,
 		//pipeline stages - match to src and dst accessmask above
 		srcStage,		// srcAccessMask with this stage must happen after
@@ -271,8 +225,4 @@ static void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool
 		0, nullptr, // buffer memory barrier count and data
 		1, &imageMemoryBarrier // image memory barrier, count + data
 		);
-
-
-	endAndSubmitCommandbuffer(device, commandPool, queue, commandBuffer);
-
-}
\ No newline at end of file
+}
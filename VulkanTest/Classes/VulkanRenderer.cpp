@@ -7,67 +7,103 @@ VulkanRenderer::VulkanRenderer()
 int VulkanRenderer::init(GLFWwindow* newWindow)
 {
 	window = newWindow;
+	headless = false;
+
+	return initRenderer();
+}
+
+int VulkanRenderer::initHeadless(const HeadlessSettings& settings)
+{
+	headless = true;
+	headlessSettings = settings;
+
+	return initRenderer();
+}
+
+bool VulkanRenderer::isHeadless() const
+{
+	return headless;
+}
+
+int VulkanRenderer::initRenderer()
+{
+	CpuProfiler::setThreadName("render");
+	CPU_PROFILE_SCOPE("initRenderer");
 
 	try
 	{
+		// command recording workers
+		threadPool.init();
+
 		createInstance();
-		createSurface();
+		if (!headless)
+		{
+			createSurface();
+		}
 		getPhysicalDevice();
 		createLogicalDevice();
-		createSwapChain();
+		allocator.init(mainDevice.physicalDevice, mainDevice.logicalDevice);
+		shaderLibrary.init(mainDevice.logicalDevice);
+		{
+			CPU_PROFILE_SCOPE("load pipeline cache");
+			pipelineCache.init(mainDevice.physicalDevice, mainDevice.logicalDevice, PIPELINE_CACHE_FILE);
+		}
+		if (headless)
+		{
+			createOffscreenImages();
+		}
+		else
+		{
+			createSwapChain();
+		}
 
 		depthBufferFormat = getDepthBufferFormat();
 
 		createRenderPass();
 		createDescriptorSetLayout();
-		createPushConstantRange();
 		createGraphicsPipeline();
 		createDepthBufferImage();
 		createFramebuffers();
 		createCommandPool();
+		auto queueFamilies = getQueueFamilies(mainDevice.physicalDevice);
+		uploadContext.init(mainDevice.logicalDevice, &allocator, transferQueue, queueFamilies.transferFamily, graphicsQueue, queueFamilies.graphicsFamily);
+		geometryPool.init(mainDevice.logicalDevice, &allocator, &uploadContext);
 
 		createCommandBuffers();
+		gpuProfiler.init(mainDevice.physicalDevice, mainDevice.logicalDevice, queueFamilies.graphicsFamily, static_cast<uint32_t>(swapChainImages.size()));
+		gpuScopes.frame = gpuProfiler.getScopeId("frame");
+		gpuScopes.earlyCull = gpuProfiler.getScopeId("early cull");
+		gpuScopes.earlyPass = gpuProfiler.getScopeId("early pass");
+		gpuScopes.earlyHiZ = gpuProfiler.getScopeId("early hiz");
+		gpuScopes.lateCull = gpuProfiler.getScopeId("late cull");
+		gpuScopes.latePass = gpuProfiler.getScopeId("late pass");
+		gpuScopes.lateHiZ = gpuProfiler.getScopeId("late hiz");
 		createTextureSampler();
-		//allocateDynamicBufferTransferSpace();
 		createUniformBuffers();
+		createDepthPyramid();
+		{
+			CPU_PROFILE_SCOPE("gpuCulling init");
+			gpuCulling.init(mainDevice.physicalDevice, mainDevice.logicalDevice, &allocator, &shaderLibrary, &pipelineCache,
+				static_cast<uint32_t>(swapChainImages.size()), uniformRing.getBuffer(), &hiZPyramid, drawIndirectCountSupported);
+		}
+
+		printf("Created %u pipelines in %.2f ms (%s pipeline cache)\n", pipelineCache.getCreatedPipelineCount(),
+			pipelineCache.getCreationMilliseconds(), pipelineCache.isWarm() ? "warm" : "cold");
+		gpuCulling.setObjectBuffer(objectBuffer, objectRegionSize, objectCapacity);
 		createDescriptorPool();
 		createDescriptorSets();
 		createSynchronisation();
 
-		uboViewProjection.projection = glm::perspective(glm::radians(45.0f), (float)swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 100.0f);
-		uboViewProjection.view = glm::lookAt(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-
-		uboViewProjection.projection[1][1] *= -1;
-
-		// Create a mesh
-
-		//vertex data
-		std::vector<Vertex> meshVertices =
-		{
-			{{-0.4, 0.4, 0.0}, {1.f, 0.f, 0.f}, {1.f, 1.f}}, //0
-			{{-0.4, -0.4, 0.0}, {1.f, 0.f, 0.f}, {1.f,0.f}} , //1
-			{{0.4, -0.4, 0.0}, {1.f, 0.f, 0.f}, {0.f, 0.f}}, //2
-			{{0.4, 0.4, 0.0}, {1.f, 0.f, 0.f}, {0.f, 1.f}} , //3
-		};
-
-		std::vector<Vertex> meshVertices2 =
-		{
-			{{-0.4, 0.25, 0.0}, {0.f, 1.f, 0.f}, {1.f, 1.f}}, //0
-			{{-0.4, -0.25, 0.0}, {0.f, 1.f, 0.f}, {1.f, 0.f}} , //1
-			{{0.4, -0.25, 0.0}, {0.f, 1.f, 0.f}, {0.f, 0.f}}, //2
-			{{0.4, 0.25, 0.0}, {0.f, 1.f, 0.f}, {0.f, 1.f}} , //3
-		};
+		setCamera(glm::lookAt(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f)), glm::radians(45.0f), 0.1f, 100.0f);
 
-		// index data
-		std::vector<uint32_t> meshIndices = {
-			0, 1, 2,
-			2 ,3, 0
-		};
+		// frame counters start with the first draw call, scene setup is not part of it
+		lastUploadedBytes = uploadContext.getUploadedBytes();
+		lastAllocations = allocator.getAllocationsMade();
+		lastBlockAllocations = allocator.getBlocksAllocated();
 
-		Mesh firstMesh = Mesh(mainDevice.physicalDevice, mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, meshVertices, meshIndices, createTexture("peepo.jpg"));
-		Mesh secondMesh = Mesh(mainDevice.physicalDevice, mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, meshVertices2, meshIndices, createTexture("peepo2.jpg"));
-		meshList.push_back(firstMesh);
-		meshList.push_back(secondMesh);
+#ifdef SLEI_DEBUG
+		allocator.printHeapUsage();
+#endif
 	}
 	catch (const std::runtime_error& e)
 	{
@@ -84,10 +120,218 @@ void VulkanRenderer::updateModel(int modelId, glm::mat4 newModel)
 		return;
 
 	meshList[modelId].setModel(newModel);
+	drawOrderUnsorted = true;
+
+	// the bvh culling refits every frame, models added after the last build are covered by the next one
+	// otherwise the bvh is only used by picking / queries, rebuilt when the next one runs
+	if (cpuCulling == CpuCulling::Bvh && !sceneBvhDirty)
+	{
+		sceneBvh.updatePrimitive(static_cast<uint32_t>(modelId), meshList[modelId].getWorldBoundingBox());
+	}
+	else
+	{
+		sceneBvhDirty = true;
+	}
+}
+
+void VulkanRenderer::setModelFlags(int modelId, uint32_t flags)
+{
+	if (modelId < 0 || modelId >= meshList.size())
+		return;
+
+	// object buffer is rewritten every frame, no re-recording needed
+	meshList[modelId].setFlags(flags);
+}
+
+int VulkanRenderer::addMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, int textureId, glm::mat4 newModel)
+{
+	Mesh mesh(mainDevice.physicalDevice, mainDevice.logicalDevice, &geometryPool, &uploadContext, vertices, indices, textureId);
+	mesh.setModel(newModel);
+	meshList.push_back(mesh);
+
+	// geometry is recorded into the upload context, submitted before the next frame
+	uploadsPending = true;
+	markCommandBuffersDirty();
+
+	return static_cast<int>(meshList.size() - 1);
+}
+
+void VulkanRenderer::setModelTexture(int modelId, int textureId)
+{
+	if (modelId < 0 || modelId >= meshList.size())
+		return;
+
+	// textures are bindless and written with the objects every frame, batches stay the same
+	// the texture only breaks depth ties in the draw key
+	meshList[modelId].setTexId(textureId);
+	drawOrderUnsorted = true;
+}
+
+void VulkanRenderer::setCamera(const glm::mat4& view, float fovY, float nearPlane, float farPlane)
+{
+	uboViewProjection.projection = glm::perspective(fovY, (float)swapChainExtent.width / (float)swapChainExtent.height, nearPlane, farPlane);
+	uboViewProjection.view = view;
+
+	// vulkan y points down
+	uboViewProjection.projection[1][1] *= -1;
+
+	// depth part of the draw keys is relative to the view
+	drawOrderUnsorted = true;
+}
+
+int VulkanRenderer::addMeshInstance(int meshId, glm::mat4 newModel)
+{
+	if (meshId < 0 || meshId >= meshList.size())
+		return -1;
+
+	auto instance = meshList[meshId].createInstance();
+	instance.setModel(newModel);
+	meshList.push_back(instance);
+
+	// batches and object order change
+	markCommandBuffersDirty();
+
+	return static_cast<int>(meshList.size() - 1);
+}
+
+VulkanRenderer::BindStats VulkanRenderer::getBindStats() const
+{
+	return bindStats;
+}
+
+void VulkanRenderer::setCpuCulling(CpuCulling mode)
+{
+	cpuCulling = mode;
+}
+
+void VulkanRenderer::setOcclusionCulling(bool enabled)
+{
+	occlusionCulling = enabled;
+}
+
+void VulkanRenderer::setModelOccluder(int modelId, const std::vector<glm::vec3>& vertices, const std::vector<uint32_t>& indices)
+{
+	if (modelId < 0 || modelId >= meshList.size())
+		return;
+
+	for (auto& occluderMesh : occluderMeshes)
+	{
+		if (occluderMesh.modelId == modelId)
+		{
+			occluderMesh.vertices = vertices;
+			occluderMesh.indices = indices;
+			return;
+		}
+	}
+
+	occluderMeshes.push_back({ modelId, vertices, indices });
+}
+
+void VulkanRenderer::setSoftwareOcclusion(bool enabled)
+{
+	softwareOcclusionEnabled = enabled;
+}
+
+const SoftwareOcclusion::Timings& VulkanRenderer::getSoftwareOcclusionTimings() const
+{
+	return softwareOcclusion.getTimings();
+}
+
+void VulkanRenderer::dumpSoftwareOcclusionBuffer(const std::string& filename) const
+{
+	softwareOcclusion.dumpDepthBuffer(filename);
+}
+
+void VulkanRenderer::setModelPipeline(int modelId, const PipelineState& state)
+{
+	if (modelId < 0 || modelId >= meshList.size())
+		return;
+
+	// queues the compile, returns right away
+	auto pipelineId = pipelineManager.request(state);
+	if (pipelineId >= (1u << DRAW_KEY_PIPELINE_BITS))
+	{
+		throw std::runtime_error("Too many pipeline variants for the draw sort key!");
+	}
+
+	meshPipelineIds.resize(meshList.size(), PipelineManager::DEFAULT_PIPELINE);
+	if (meshPipelineIds[modelId] == pipelineId)
+	{
+		return;
+	}
+	meshPipelineIds[modelId] = pipelineId;
+
+	// hitches are measured from the request on
+	pipelineStats.longestFrameMs = 0.0;
+	markCommandBuffersDirty();
+}
+
+void VulkanRenderer::setDeferPendingPipelines(bool defer)
+{
+	deferPendingPipelines = defer;
+	std::fill(commandBufferDirty.begin(), commandBufferDirty.end(), true);
+}
+
+VulkanRenderer::PipelineStats VulkanRenderer::getPipelineStats() const
+{
+	auto stats = pipelineStats;
+	stats.compile = pipelineManager.getStats();
+
+	return stats;
+}
+
+const GpuProfiler& VulkanRenderer::getGpuProfiler() const
+{
+	return gpuProfiler;
+}
+
+void VulkanRenderer::setGpuDrawGroupTiming(bool enabled)
+{
+	gpuDrawGroupTiming = enabled;
+	std::fill(commandBufferDirty.begin(), commandBufferDirty.end(), true);
+}
+
+FrameStats VulkanRenderer::getFrameStats() const
+{
+	return frameStatsWindow.getStats();
+}
+
+const FrameCounters& VulkanRenderer::getLastFrameCounters() const
+{
+	return lastFrameCounters;
+}
+
+void VulkanRenderer::resetFrameStats()
+{
+	frameStatsWindow.clear();
+}
+
+int VulkanRenderer::pickModel(const glm::vec3& origin, const glm::vec3& direction, float maxDistance)
+{
+	updateSceneBvh();
+
+	float hitDistance;
+	auto primitive = sceneBvh.raycast(origin, direction, maxDistance, hitDistance);
+
+	return primitive == Bvh::INVALID_PRIMITIVE ? -1 : static_cast<int>(primitive);
+}
+
+void VulkanRenderer::queryModels(const BoundingBox& region, std::vector<int>& modelIds)
+{
+	updateSceneBvh();
+
+	std::vector<uint32_t> primitives;
+	sceneBvh.queryBox(region, primitives);
+
+	modelIds.assign(primitives.begin(), primitives.end());
 }
 
 void VulkanRenderer::draw()
 {
+	CPU_PROFILE_SCOPE("draw");
+	auto frameStart = std::chrono::steady_clock::now();
+	frameCounters = {};
+
 	//1 get next available image to draw to and set something to signal when we're finished with the image (a semaphore)
 	//2 submit command buffer to queue for execution, make sure it waits for image to be signaled as available before drawing
 	// and signals when it has finished rendering
@@ -96,20 +340,79 @@ void VulkanRenderer::draw()
 	//Get next image
 
 	// wait for given fence to signal (open) from last draw before continuing
-	vkWaitForFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
-
-	// manually reset (close) fences
-	vkResetFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame]);
-
+	{
+		CPU_PROFILE_SCOPE("wait frame fence");
+		auto waitStart = std::chrono::steady_clock::now();
+		vkWaitForFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+		frameCounters.fenceWaitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+	}
 
 	//get index of next image to be drawn to, and signal semaphore when ready to be drawn to
 	uint32_t imageIndex;
-	vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint64_t>::max(), imageAvailable[currentFrame], VK_NULL_HANDLE, &imageIndex);
+	if (headless)
+	{
+		// offscreen images are used in turn, nothing to wait for but the fences below
+		imageIndex = offscreenImageIndex;
+		offscreenImageIndex = (offscreenImageIndex + 1) % static_cast<uint32_t>(swapChainImages.size());
+	}
+	else
+	{
+		CPU_PROFILE_SCOPE("acquire");
+		auto acquireStart = std::chrono::steady_clock::now();
+		vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint64_t>::max(), imageAvailable[currentFrame], VK_NULL_HANDLE, &imageIndex);
+		frameCounters.acquireWaitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - acquireStart).count();
+	}
+
+	// image may be acquired again while an earlier frame using it (and its uniform region / command buffer) is still in flight
+	if (imagesInFlight[imageIndex] != VK_NULL_HANDLE)
+	{
+		CPU_PROFILE_SCOPE("wait image fence");
+		auto waitStart = std::chrono::steady_clock::now();
+		vkWaitForFences(mainDevice.logicalDevice, 1, &imagesInFlight[imageIndex], VK_TRUE, std::numeric_limits<uint64_t>::max());
+		frameCounters.fenceWaitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+	}
+	imagesInFlight[imageIndex] = drawFences[currentFrame];
+
+	// last submit of this image is finished, its timestamps are there
+	gpuProfiler.collect(imageIndex);
+
+	// variants compiled in the background replace their fallbacks in the next recording
+	if (pipelineManager.collectFinished())
+	{
+		std::fill(commandBufferDirty.begin(), commandBufferDirty.end(), true);
+	}
+
+	// object buffer is written in batch order
+	if (drawBatchesDirty)
+	{
+		buildDrawBatches();
+	}
+	else if (drawOrderUnsorted)
+	{
+		// batch ranges stay the same, only instances within a batch move
+		sortDrawOrder();
+	}
+	ensureObjectCapacity();
 
-	recordCommands(imageIndex);
+	// meshes and textures added since the last frame
+	if (uploadsPending)
+	{
+		CPU_PROFILE_SCOPE("upload scene");
+		uploadContext.flush();
+		uploadsPending = false;
+	}
 
+	// uniforms first, recording needs their dynamic offsets
 	updateUniformBuffers(imageIndex);
 
+	// reuse the recorded commands of this image unless the scene changed
+	if (commandBufferDirty[imageIndex] || recordedUniformOffsets[imageIndex] != vpUniformOffset || recordedFrustumOffsets[imageIndex] != frustumUniformOffset)
+	{
+		auto recordStart = std::chrono::steady_clock::now();
+		recordCommands(imageIndex);
+		frameCounters.recordMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
+	}
+
 	// submit command buffer to render
 	//queue submussion info
 	VkSubmitInfo submitinfo{};
@@ -126,28 +429,66 @@ void VulkanRenderer::draw()
 	submitinfo.signalSemaphoreCount = 1;					// number of semaphores to signal
 	submitinfo.pSignalSemaphores = &renderFinished[currentFrame];		// semaphores to signal when command buffer finishes
 
-	auto result = vkQueueSubmit(graphicsQueue, 1, &submitinfo, drawFences[currentFrame]);
+	// no acquire to wait for and no present waiting on us
+	if (headless)
+	{
+		submitinfo.waitSemaphoreCount = 0;
+		submitinfo.signalSemaphoreCount = 0;
+	}
+
+	// manually reset (close) fences, not before the image fence wait above, which may be this very fence
+	vkResetFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame]);
+
+	VkResult result;
+	{
+		CPU_PROFILE_SCOPE("submit");
+		result = vkQueueSubmit(graphicsQueue, 1, &submitinfo, drawFences[currentFrame]);
+	}
 	if (result != VK_SUCCESS)
 	{
 		throw std::runtime_error("Failed to submit command buffer to queue");
 	}
+	gpuProfiler.markSubmitted(imageIndex);
 
+	// present rendered image to screen, headless frames stay in their offscreen image
+	if (!headless)
+	{
+		CPU_PROFILE_SCOPE("present");
 
-	// present rendered image to screen
-	VkPresentInfoKHR presentInfo{};
-	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = &renderFinished[currentFrame];
-	presentInfo.swapchainCount = 1;
-	presentInfo.pSwapchains = &swapchain;
-	presentInfo.pImageIndices = &imageIndex;					// index of images in swapchains to present
+		VkPresentInfoKHR presentInfo{};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = &renderFinished[currentFrame];
+		presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = &swapchain;
+		presentInfo.pImageIndices = &imageIndex;					// index of images in swapchains to present
 
-	result = vkQueuePresentKHR(presentationQueue, &presentInfo);
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to present image!");
+		result = vkQueuePresentKHR(presentationQueue, &presentInfo);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to present image!");
+		}
 	}
 
+	// whole draw call including fence waits and present, a pipeline compiled on this thread would show up here
+	pipelineStats.lastFrameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+	pipelineStats.longestFrameMs = std::max(pipelineStats.longestFrameMs, pipelineStats.lastFrameMs);
+
+	// the submitted command buffer, recorded now or by an earlier frame
+	frameCounters.commands = recordedCounters[imageIndex];
+	frameCounters.frameMs = pipelineStats.lastFrameMs;
+
+	// totals since the last draw call, includes uploads and allocations made between draw calls
+	frameCounters.uploadedBytes = uploadContext.getUploadedBytes() - lastUploadedBytes;
+	frameCounters.allocations = static_cast<uint32_t>(allocator.getAllocationsMade() - lastAllocations);
+	frameCounters.deviceAllocations = static_cast<uint32_t>(allocator.getBlocksAllocated() - lastBlockAllocations);
+	lastUploadedBytes = uploadContext.getUploadedBytes();
+	lastAllocations = allocator.getAllocationsMade();
+	lastBlockAllocations = allocator.getBlocksAllocated();
+
+	frameStatsWindow.push(frameCounters);
+	lastFrameCounters = frameCounters;
+
 	// Get next frame ( use & MAX_FRAME_DRAWS to keep value below MAX_FRAME_DRAWS)
 	currentFrame = (currentFrame + 1) % MAX_FRAME_DRAWS;
 }
@@ -157,7 +498,7 @@ void VulkanRenderer::cleanup()
 	//wait until no actions being run on device before destroying
 	vkDeviceWaitIdle(mainDevice.logicalDevice);
 
-	//_aligned_free(modelTransferSpace);
+	threadPool.cleanup();
 
 	vkDestroyDescriptorPool(mainDevice.logicalDevice, samplerDescriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, samplerSetLayout, nullptr);
@@ -168,29 +509,28 @@ void VulkanRenderer::cleanup()
 	{
 		vkDestroyImageView(mainDevice.logicalDevice, textureImageViews[i], nullptr);
 		vkDestroyImage(mainDevice.logicalDevice, textureImages[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, textureImageMemory[i], nullptr);
+		allocator.free(textureImageMemory[i]);
 	}
 
 	vkDestroyImageView(mainDevice.logicalDevice, depthBufferImageView, nullptr);
 	vkDestroyImage(mainDevice.logicalDevice, depthBufferImage, nullptr);
-	vkFreeMemory(mainDevice.logicalDevice, depthBufferMemory, nullptr);
+	allocator.free(depthBufferMemory);
 
 	vkDestroyDescriptorPool(mainDevice.logicalDevice, descriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, descriptorSetLayout, nullptr);
 
-	for (auto i = 0lu; i < swapChainImages.size(); i++)
-	{
-		vkDestroyBuffer(mainDevice.logicalDevice, vpUniformBuffers[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, vpUniformBufferMemory[i], nullptr);
-/*
-		vkDestroyBuffer(mainDevice.logicalDevice, modelDynUniformBuffers[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, modelDynUniformBufferMemory[i], nullptr);*/
-	}
+	gpuCulling.cleanup();
+	hiZPyramid.cleanup();
+	gpuProfiler.cleanup();
+	destroyBuffer(mainDevice.logicalDevice, allocator, objectBuffer, objectBufferMemory);
+	uniformRing.cleanup();
 
 	for (auto& mesh : meshList)
 	{
 		mesh.destroyBuffers();
 	}
+	geometryPool.cleanup();
+	uploadContext.cleanup();
 
 	for (auto i = 0lu; i < MAX_FRAME_DRAWS; i++)
 	{
@@ -199,14 +539,27 @@ void VulkanRenderer::cleanup()
 		vkDestroyFence(mainDevice.logicalDevice, drawFences[i], nullptr);
 	}
 
+	for (auto& imagePools : secondaryCommandPools)
+	{
+		for (auto& threadCommandPool : imagePools)
+		{
+			vkDestroyCommandPool(mainDevice.logicalDevice, threadCommandPool.pool, nullptr);
+		}
+	}
 	vkDestroyCommandPool(mainDevice.logicalDevice, graphicsCommandPool, nullptr);
 	for (auto framebuffer : swapChainFramebuffers)
 	{
 		vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
 	}
 
-	vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline, nullptr);
+	// waits for a variant still compiling
+	pipelineManager.cleanup();
+	shaderLibrary.cleanup();
 	vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout, nullptr);
+	vkDestroyRenderPass(mainDevice.logicalDevice, lateRenderPass, nullptr);
+
+	pipelineCache.save();
+	pipelineCache.cleanup();
 	vkDestroyRenderPass(mainDevice.logicalDevice, renderPass, nullptr);
 
 	for (auto image : swapChainImages)
@@ -214,15 +567,32 @@ void VulkanRenderer::cleanup()
 		vkDestroyImageView(mainDevice.logicalDevice, image.imageView, nullptr);
 	}
 
+	if (headless)
+	{
+		// offscreen images are ours, swapchain images belong to the swapchain
+		for (size_t i = 0; i < swapChainImages.size(); i++)
+		{
+			vkDestroyImage(mainDevice.logicalDevice, swapChainImages[i].image, nullptr);
+			allocator.free(offscreenImageMemory[i]);
+		}
+	}
+	else
+	{
+		vkDestroySwapchainKHR(mainDevice.logicalDevice, swapchain, nullptr);
+		vkDestroySurfaceKHR(instance, surface, nullptr);
+	}
+
+	// all resources are destroyed, release the memory blocks
+	allocator.cleanup();
 
-	vkDestroySwapchainKHR(mainDevice.logicalDevice, swapchain, nullptr);
-	vkDestroySurfaceKHR(instance, surface, nullptr);
 	vkDestroyDevice(mainDevice.logicalDevice, nullptr);
 	vkDestroyInstance(instance, nullptr);
 }
 
 void VulkanRenderer::createInstance()
 {
+	CPU_PROFILE_SCOPE("createInstance");
+
 	if (enableValidationLayers && !checkValidationLayerSupport())
 	{
 		throw std::runtime_error("validation layers requested, but not available!");
@@ -246,12 +616,15 @@ void VulkanRenderer::createInstance()
 	//create list to hold instance extensions
 	std::vector<const char*> instanceExtensions;
 
-	//set up extensions the instance will use
+	//set up extensions the instance will use, headless needs no surface extensions (and glfw isn't initialized)
 	uint32_t glfwExtensionCount = 0;						// glfw may require multiple extensions
-	const char** glfwExtensions;							// extensions passed ass array for cstrings
+	const char** glfwExtensions = nullptr;					// extensions passed ass array for cstrings
 
 	//get glfw extensions
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	if (!headless)
+	{
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	}
 
 	//add glfw extensions to list of extensions
 	for (auto i = 0lu; i < glfwExtensionCount; i++)
@@ -266,7 +639,7 @@ void VulkanRenderer::createInstance()
 		throw std::runtime_error("VkInstance does not support required extensions!");
 	}
 
-	createInfo.enabledExtensionCount = glfwExtensionCount;
+	createInfo.enabledExtensionCount = static_cast<uint32_t>(instanceExtensions.size());
 	createInfo.ppEnabledExtensionNames = instanceExtensions.data();
 
 
@@ -293,12 +666,17 @@ void VulkanRenderer::createInstance()
 
 void VulkanRenderer::createLogicalDevice()
 {
+	CPU_PROFILE_SCOPE("createLogicalDevice");
+
 	//get the queue family indices for the chosen physical devices
 	QueueFamilyIndices indices = getQueueFamilies(mainDevice.physicalDevice);
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 
 	//can have the same value, check if this is the case through set
-	std::set<int> queueFamilyIndices{ indices.graphicsFamily, indices.presentationFamily };
+	std::set<int> queueFamilyIndices{ indices.graphicsFamily, indices.presentationFamily, indices.transferFamily };
+
+	// vulkan needs to know priorities to handle multiple queues(1 = highest prio), read by vkCreateDevice so it has to outlive the loop
+	float priority = 1.f;
 
 	for (auto queueFamilyIndex : queueFamilyIndices)
 	{
@@ -307,8 +685,6 @@ void VulkanRenderer::createLogicalDevice()
 		queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
 		queueCreateInfo.queueFamilyIndex = queueFamilyIndex;				// the index of the family to create a queue from
 		queueCreateInfo.queueCount = 1;										// number of queues to create
-
-		float priority = 1.f;												 // vulkan needs to know priorities to handle multiple queues(1 = highest prio) 
 		queueCreateInfo.pQueuePriorities = &priority;
 		queueCreateInfos.push_back(queueCreateInfo);
 	}
@@ -318,14 +694,40 @@ void VulkanRenderer::createLogicalDevice()
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());	// number of queue create infos
 	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();				// list of queue create infos so device can create required queues
-	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size()); // number of enabled logical device extensions
-	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	auto requiredExtensions = getRequiredDeviceExtensions();
+	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(requiredExtensions.size()); // number of enabled logical device extensions
+	deviceCreateInfo.ppEnabledExtensionNames = requiredExtensions.data();
 
 	// physical device features the logical device will be using
 	VkPhysicalDeviceFeatures deviceFeatures{};
 	deviceFeatures.samplerAnisotropy = VK_TRUE;	// Enable Anisotropy
+	deviceFeatures.multiDrawIndirect = VK_TRUE;				// many draws per indirect call
+	deviceFeatures.drawIndirectFirstInstance = VK_TRUE;		// indirect draws start at their instance range in the visible list
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 
+	// gpu provided draw count, without it culled draws are issued with zero instances
+	VkPhysicalDeviceVulkan12Features supportedFeatures12{};
+	supportedFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+	VkPhysicalDeviceFeatures2 supportedFeatures{};
+	supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supportedFeatures.pNext = &supportedFeatures12;
+	vkGetPhysicalDeviceFeatures2(mainDevice.physicalDevice, &supportedFeatures);
+
+	drawIndirectCountSupported = supportedFeatures12.drawIndirectCount == VK_TRUE;
+
+	VkPhysicalDeviceVulkan12Features deviceFeatures12{};
+	deviceFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	deviceFeatures12.drawIndirectCount = supportedFeatures12.drawIndirectCount;
+
+	// bindless textures, checked in checkDeviceSuitable
+	deviceFeatures12.runtimeDescriptorArray = VK_TRUE;								// unsized texture array in shader.frag
+	deviceFeatures12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;			// texture index differs between instances
+	deviceFeatures12.descriptorBindingPartiallyBound = VK_TRUE;						// only the first textureCount elements are written
+	deviceFeatures12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;		// textures are added while command buffers are recorded
+	deviceFeatures12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;			// ...or pending
+	deviceCreateInfo.pNext = &deviceFeatures12;
+
 	//create the logical device for the given physical device
 	auto result = vkCreateDevice(mainDevice.physicalDevice, &deviceCreateInfo, nullptr, &mainDevice.logicalDevice);
 
@@ -339,10 +741,13 @@ void VulkanRenderer::createLogicalDevice()
 	// from given logical device of given queue family of given queue index (0 since only one queue), place reference in given queue
 	vkGetDeviceQueue(mainDevice.logicalDevice, indices.graphicsFamily, 0, &graphicsQueue);
 	vkGetDeviceQueue(mainDevice.logicalDevice, indices.presentationFamily, 0, &presentationQueue);
+	vkGetDeviceQueue(mainDevice.logicalDevice, indices.transferFamily, 0, &transferQueue);
 }
 
 void VulkanRenderer::createSurface()
 {
+	CPU_PROFILE_SCOPE("createSurface");
+
 	//create surface, creating a surface create info struct, runs the create surface function
 	auto result = glfwCreateWindowSurface(instance, window, nullptr, &surface);
 
@@ -354,6 +759,8 @@ void VulkanRenderer::createSurface()
 
 void VulkanRenderer::createSwapChain()
 {
+	CPU_PROFILE_SCOPE("createSwapChain");
+
 	//get swap chain details so we can pick best settings
 	SwapChainDetails swapChainDetail = getSwapChainDetails(mainDevice.physicalDevice);
 
@@ -445,8 +852,31 @@ void VulkanRenderer::createSwapChain()
 	}
 }
 
+void VulkanRenderer::createOffscreenImages()
+{
+	CPU_PROFILE_SCOPE("createOffscreenImages");
+
+	// stands in for the swapchain, the rest of the renderer doesn't know the difference
+	swapChainImageFormat = chooseSupportedFormat({ headlessSettings.format }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
+	swapChainExtent = { headlessSettings.width, headlessSettings.height };
+
+	auto imageCount = std::max(1u, headlessSettings.imageCount);
+	offscreenImageMemory.resize(imageCount);
+	for (uint32_t i = 0; i < imageCount; i++)
+	{
+		SwapChainImage offscreenImage;
+		offscreenImage.image = createImage(swapChainExtent.width, swapChainExtent.height, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, offscreenImageMemory[i]);
+		offscreenImage.imageView = createImageView(offscreenImage.image, swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		swapChainImages.push_back(offscreenImage);
+	}
+}
+
 void VulkanRenderer::createRenderPass()
 {
+	CPU_PROFILE_SCOPE("createRenderPass");
+
 	//color attachment of the render pass
 	VkAttachmentDescription colorAttachment{};
 	colorAttachment.format = swapChainImageFormat;			// format to use for attachment
@@ -459,18 +889,18 @@ void VulkanRenderer::createRenderPass()
 	// framebuffer data will be stored as an image, but images can be given different data layouts
 	// to give optimal use for certain operations
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;	//image data layout before render pass starts
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;	// image data layout after render pass (to change to)
+	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;	// image data layout after render pass (to change to), the late pass presents
 
 	//depth attachment
 	VkAttachmentDescription deptchAttachment{};
 	deptchAttachment.format = depthBufferFormat;
 	deptchAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
 	deptchAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	deptchAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	deptchAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;		// read by the depth pyramid build and the late pass
 	deptchAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	deptchAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	deptchAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	deptchAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	deptchAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;	// sampled by hiz.comp
 
 
 	// attachment reference uses a attachment index that refers to a index in the attachment list passed to the renderPassCreateInfo
@@ -490,7 +920,7 @@ void VulkanRenderer::createRenderPass()
 	subpass.pDepthStencilAttachment = &depthAttachmentReference;
 	
 	// need to determine when layout transitions occur using subpass dependencies
-	std::array<VkSubpassDependency, 2> subpassDependencies;
+	std::array<VkSubpassDependency, 4> subpassDependencies;
 
 	// conversion from vk_image_layout_undefined to vk_image_layout_color_attachment_optimal
 	//transition must happen after this here
@@ -518,6 +948,37 @@ void VulkanRenderer::createRenderPass()
 	subpassDependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
 	subpassDependencies[1].dependencyFlags = 0;
 
+	// depth was last written by the previous pass and read by the depth pyramid build
+	subpassDependencies[2].srcSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[2].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	subpassDependencies[2].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[2].dstSubpass = 0;
+	subpassDependencies[2].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[2].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[2].dependencyFlags = 0;
+
+	// depth writes finished before the depth pyramid build samples it
+	subpassDependencies[3].srcSubpass = 0;
+	subpassDependencies[3].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[3].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[3].dstSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[3].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	subpassDependencies[3].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	subpassDependencies[3].dependencyFlags = 0;
+
+	// color of the early pass is drawn over by the late pass
+	VkSubpassDependency colorBetweenPasses{};
+	colorBetweenPasses.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	colorBetweenPasses.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	colorBetweenPasses.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	colorBetweenPasses.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	colorBetweenPasses.dependencyFlags = 0;
+
+	auto presentDependency = subpassDependencies[1];
+	subpassDependencies[1] = colorBetweenPasses;
+	subpassDependencies[1].srcSubpass = 0;
+	subpassDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+
 	std::array<VkAttachmentDescription, 2> renderPassAttachments{ colorAttachment, deptchAttachment }; // order important 0 color, 1 depth
 
 	//create info for renderpass
@@ -535,28 +996,61 @@ void VulkanRenderer::createRenderPass()
 	{
 		throw std::runtime_error("Failed to create a render pass!");
 	}
+
+	// late pass keeps what the early pass drew and presents, same formats so framebuffers and pipelines are shared
+	renderPassAttachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	renderPassAttachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	renderPassAttachments[0].finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;	// headless frames can be copied out
+	renderPassAttachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	renderPassAttachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+	subpassDependencies[0] = colorBetweenPasses;
+	subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[0].dstSubpass = 0;
+	subpassDependencies[1] = presentDependency;
+	if (headless)
+	{
+		subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		subpassDependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	}
+
+	result = vkCreateRenderPass(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &lateRenderPass);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create the late render pass!");
+	}
 }
 
 void VulkanRenderer::createDescriptorSetLayout()
 {
+	CPU_PROFILE_SCOPE("createDescriptorSetLayout");
+
 	// uniform values descriptor set layout
 	// vp binding info
 	VkDescriptorSetLayoutBinding vpLayoutBinding{};
 	vpLayoutBinding.binding = 0;				// layout(binding=0) in vert shader |binding point in sharder designated by binding number in shader)
-	vpLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER; // type of descriptor (uniform , dynamic uniform, image sampler, etc)
+	vpLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC; // type of descriptor (uniform , dynamic uniform, image sampler, etc), offset into the uniform ring given at bind time
 	vpLayoutBinding.descriptorCount = 1;					// number of descriptors for binding (atm only MVP)
 	vpLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;	//shader stage to bind to (vert in our case)
 	vpLayoutBinding.pImmutableSamplers = nullptr;			// for texture: can make sampler unchangeable (immutable) by specifying layout
 
-	//// model bindings
-	//VkDescriptorSetLayoutBinding modelLayoutBinding{};
-	//modelLayoutBinding.binding = 1;
-	//modelLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-	//modelLayoutBinding.descriptorCount = 1;
-	//modelLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	//modelLayoutBinding.pImmutableSamplers = nullptr;
+	// object transform binding, region of the current image selected by dynamic offset
+	VkDescriptorSetLayoutBinding objectLayoutBinding{};
+	objectLayoutBinding.binding = 1;
+	objectLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	objectLayoutBinding.descriptorCount = 1;
+	objectLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	objectLayoutBinding.pImmutableSamplers = nullptr;
+
+	// visible object list written by the culling pass, same region layout as the object buffer
+	VkDescriptorSetLayoutBinding visibleLayoutBinding{};
+	visibleLayoutBinding.binding = 2;
+	visibleLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	visibleLayoutBinding.descriptorCount = 1;
+	visibleLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	visibleLayoutBinding.pImmutableSamplers = nullptr;
 
-	std::array<VkDescriptorSetLayoutBinding, 1> layoutBindings{ vpLayoutBinding };//, modelLayoutBinding };
+	std::array<VkDescriptorSetLayoutBinding, 3> layoutBindings{ vpLayoutBinding, objectLayoutBinding, visibleLayoutBinding };
 
 	// create descriptor set layout with given bindings
 	VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
@@ -573,18 +1067,40 @@ void VulkanRenderer::createDescriptorSetLayout()
 
 	// create texture sampler descriptor set layout
 
-	//texture binding info
+	// array size is limited by the update after bind limits of the device
+	VkPhysicalDeviceVulkan12Properties deviceProperties12{};
+	deviceProperties12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+
+	VkPhysicalDeviceProperties2 deviceProperties2{};
+	deviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	deviceProperties2.pNext = &deviceProperties12;
+	vkGetPhysicalDeviceProperties2(mainDevice.physicalDevice, &deviceProperties2);
+
+	textureCapacity = std::min({ MAX_TEXTURES, deviceProperties12.maxDescriptorSetUpdateAfterBindSampledImages,
+		deviceProperties12.maxPerStageDescriptorUpdateAfterBindSampledImages });
+
+	//texture binding info, all textures in one array
 	VkDescriptorSetLayoutBinding samplerLayoutBinding{};
 	samplerLayoutBinding.binding = 0;
 	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerLayoutBinding.descriptorCount = 1;
+	samplerLayoutBinding.descriptorCount = textureCapacity;
 	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 	samplerLayoutBinding.pImmutableSamplers = nullptr;
 
+	// elements can be written while the set is bound and unwritten elements are never read
+	VkDescriptorBindingFlags samplerBindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+		| VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCreateInfo{};
+	bindingFlagsCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	bindingFlagsCreateInfo.bindingCount = 1;
+	bindingFlagsCreateInfo.pBindingFlags = &samplerBindingFlags;
 
 	//create descriptor set layout with given bindings for textures
 	VkDescriptorSetLayoutCreateInfo textureLayoutCreateInfo{};
 	textureLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	textureLayoutCreateInfo.pNext = &bindingFlagsCreateInfo;
+	textureLayoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
 	textureLayoutCreateInfo.bindingCount = 1;
 	textureLayoutCreateInfo.pBindings = &samplerLayoutBinding;
 
@@ -596,24 +1112,42 @@ void VulkanRenderer::createDescriptorSetLayout()
 	}
 }
 
-void VulkanRenderer::createPushConstantRange()
-{
-	// define pish constnat values , no create needed
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT; // shader stage push constant where it will go to
-	pushConstantRange.offset = 0;							// offset into given data to pas to push constant
-	pushConstantRange.size = sizeof(Model);					//size of data being passed
-}
-
 void VulkanRenderer::createGraphicsPipeline()
 {
-	//read in SPIR-V code of shaders
-	auto vertexShaderCode = readFile(std::string(PROJ_DIR) + "/Shaders/vert.spv");
-	auto fragmentShaderCode = readFile(std::string(PROJ_DIR) + "/Shaders/frag.spv");
+	CPU_PROFILE_SCOPE("createGraphicsPipeline");
+
+	//shader modules to link to graphics pipeline, SPIR-V is compiled by the build, modules stay for variants compiled later
+	vertexShaderModule = shaderLibrary.getModule("vert.spv");
+	fragmentShaderModule = shaderLibrary.getModule("frag.spv");
 
-	//build shader modules to link to graphics pipeline
-	auto vertexShaderModule = createShaderModule(vertexShaderCode);
-	auto fragmentShaderModule = createShaderModule(fragmentShaderCode);
+	// pipeline layout
 
+	std::array<VkDescriptorSetLayout, 2> descriptorSetLayouts { descriptorSetLayout, samplerSetLayout };
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+	pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts.data();
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 0;		// model matrices are read from the object buffer
+	pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
+
+	//create pipeline layout
+	auto result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create pipeline layout");
+	}
+
+	// default state is compiled right away, variants in the background
+	pipelineManager.init(mainDevice.logicalDevice, [this](const PipelineState& state, VkPipeline& pipeline)
+	{
+		return buildGraphicsPipeline(state, pipeline);
+	}, PipelineState{});
+}
+
+VkResult VulkanRenderer::buildGraphicsPipeline(const PipelineState& state, VkPipeline& pipeline)
+{
+	// only reads state that is fixed after init, runs on the pipeline compile threads
 	// Shader State Creation 
 	//====================================
 
@@ -718,9 +1252,9 @@ void VulkanRenderer::createGraphicsPipeline()
 	rasterizerCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
 	rasterizerCreateInfo.depthClampEnable = VK_FALSE;	// change if fragments beyond near / far planes are clipped or clamped to plane - need to enable device feature depthClamp if true
 	rasterizerCreateInfo.rasterizerDiscardEnable = VK_FALSE;	//whether to discard data and skip rasterizer, never creates fragments, only suitable for pipleline without framebuffer output
-	rasterizerCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;	// how to handle filling points between vertices
+	rasterizerCreateInfo.polygonMode = state.polygonMode;		// how to handle filling points between vertices
 	rasterizerCreateInfo.lineWidth = 1.f;						// how thick lines should be when drawn
-	rasterizerCreateInfo.cullMode = VK_CULL_MODE_BACK_BIT;		// which face of a triangle to cull
+	rasterizerCreateInfo.cullMode = state.cullMode;				// which face of a triangle to cull
 	rasterizerCreateInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;	// winding to determine which side is front   //we inverted Y make CCW
 	rasterizerCreateInfo.depthBiasEnable = VK_FALSE;			// whether to add depth boas to fragments (good for stopping "shadow acne" in shadow mapping)
 
@@ -736,7 +1270,7 @@ void VulkanRenderer::createGraphicsPipeline()
 	//blend attachment state (how blending is handled)
 	VkPipelineColorBlendAttachmentState colorState{};
 	colorState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT; // colors to apply blending to
-	colorState.blendEnable = VK_TRUE; // enable blending
+	colorState.blendEnable = state.blendEnable ? VK_TRUE : VK_FALSE; // enable blending
 	
 	//blending uses equation (srcColorBlendFactor * newColor) colorblendOp (dstColorBlendFactor * old color)
 	colorState.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
@@ -759,30 +1293,12 @@ void VulkanRenderer::createGraphicsPipeline()
 	colorBlendingCreateInfo.pAttachments = &colorState;
 
 
-	// pipeline layout
-
-	std::array<VkDescriptorSetLayout, 2> descriptorSetLayouts { descriptorSetLayout, samplerSetLayout };
-
-	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
-	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
-	pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts.data();
-	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
-
-	//create pipeline layout
-	auto result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to create pipeline layout");
-	}
-
 	// depth stencil testing
 	VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo{};
 	depthStencilCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
 	depthStencilCreateInfo.depthTestEnable = VK_TRUE;		// enable checking depth to determine fragment write
-	depthStencilCreateInfo.depthWriteEnable = VK_TRUE;			// enable writing to depth buffer to replace old values
-	depthStencilCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS; // is new value less ? then replace - comparison operation that allows an overwrite (is in front)
+	depthStencilCreateInfo.depthWriteEnable = state.depthWrite ? VK_TRUE : VK_FALSE;	// enable writing to depth buffer to replace old values
+	depthStencilCreateInfo.depthCompareOp = state.depthCompareOp;	// default less: is new value less ? then replace - comparison operation that allows an overwrite (is in front)
 	depthStencilCreateInfo.depthBoundsTestEnable = VK_FALSE;	// depth bounds test: does the depth value exist between bounds
 	depthStencilCreateInfo.stencilTestEnable = VK_FALSE;		// enable stencil test
 
@@ -808,34 +1324,42 @@ void VulkanRenderer::createGraphicsPipeline()
 	pipelineCreateInfo.renderPass = renderPass;		// renderpass description the pipeline is compatible with
 	pipelineCreateInfo.subpass = 0;					// subpass of render pass to use with the pipeline
 
-	// create graphics pipeline
-	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &graphicsPipeline);
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to create graphics pipeline!");
-	}
-
 	//pipeline derivatives , can create multiple pipelines that derive from one another for optimization
 	pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;	// existing pipeline to derive from
 	pipelineCreateInfo.basePipelineIndex = -1;				// or index of pipeline being created to derive from ( in case create multiple at once)
 
-	// Destroy shader modules - no longer neaded after pipeline was created
-	vkDestroyShaderModule(mainDevice.logicalDevice, fragmentShaderModule, nullptr);
-	vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
+	// create graphics pipeline, errors are handled by the caller (init throws, background compiles fall back)
+	return pipelineCache.createGraphicsPipeline(pipelineCreateInfo, pipeline);
 }
 
 void VulkanRenderer::createDepthBufferImage()
 {
+	CPU_PROFILE_SCOPE("createDepthBufferImage");
+
 	// create depth buffer image
 	depthBufferImage = createImage(swapChainExtent.width, swapChainExtent.height, depthBufferFormat,
-		VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthBufferMemory);
+		VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthBufferMemory);
 
-	// create depth buffer image
+	// create depth buffer image, only the depth aspect so it can be sampled for the depth pyramid
 	depthBufferImageView = createImageView(depthBufferImage, depthBufferFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
 }
 
+void VulkanRenderer::createDepthPyramid()
+{
+	CPU_PROFILE_SCOPE("createDepthPyramid");
+
+	hiZPyramid.init(mainDevice.logicalDevice, &allocator, &shaderLibrary, &pipelineCache, depthBufferImageView, swapChainExtent.width, swapChainExtent.height);
+
+	// pyramid stays in the general layout, it starts out as far depth
+	auto commandBuffer = beginCommandbuffer(mainDevice.logicalDevice, graphicsCommandPool);
+	hiZPyramid.recordInitialize(commandBuffer);
+	endAndSubmitCommandbuffer(mainDevice.logicalDevice, graphicsCommandPool, graphicsQueue, commandBuffer);
+}
+
 void VulkanRenderer::createFramebuffers()
 {
+	CPU_PROFILE_SCOPE("createFramebuffers");
+
 	// resize to the amount of swapchainimages , we create 1 framebuffer per image
 	swapChainFramebuffers.resize(swapChainImages.size());
 
@@ -863,6 +1387,8 @@ void VulkanRenderer::createFramebuffers()
 
 void VulkanRenderer::createCommandPool()
 {
+	CPU_PROFILE_SCOPE("createCommandPool");
+
 	QueueFamilyIndices queueFamilyIndices = getQueueFamilies(mainDevice.physicalDevice);
 
 	VkCommandPoolCreateInfo poolInfo{};
@@ -881,9 +1407,17 @@ void VulkanRenderer::createCommandPool()
 
 void VulkanRenderer::createCommandBuffers()
 {
+	CPU_PROFILE_SCOPE("createCommandBuffers");
+
 	// resize commandbuffer to 1 per framebuffer
 	commandBuffers.resize(swapChainFramebuffers.size());
 
+	// nothing recorded yet
+	commandBufferDirty.resize(commandBuffers.size(), true);
+	recordedCounters.resize(commandBuffers.size());
+	recordedUniformOffsets.resize(commandBuffers.size(), 0);
+	recordedFrustumOffsets.resize(commandBuffers.size(), 0);
+
 	VkCommandBufferAllocateInfo cbAllocInfo{};
 	cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	cbAllocInfo.commandPool = graphicsCommandPool;
@@ -896,10 +1430,33 @@ void VulkanRenderer::createCommandBuffers()
 	{
 		throw std::runtime_error("Failed to allocated command buffers!");
 	}
+
+	// one pool per recording thread and image, so threads never share a pool and
+	// resetting the pools of one image doesn't touch command buffers of images in flight
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = 0;													// whole pool is reset at once
+	poolInfo.queueFamilyIndex = getQueueFamilies(mainDevice.physicalDevice).graphicsFamily;
+
+	secondaryCommandPools.resize(commandBuffers.size());
+	for (auto& imagePools : secondaryCommandPools)
+	{
+		imagePools.resize(threadPool.getThreadCount());
+		for (auto& threadCommandPool : imagePools)
+		{
+			result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &threadCommandPool.pool);
+			if (result != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create secondary command pool!");
+			}
+		}
+	}
 }
 
 void VulkanRenderer::createSynchronisation()
 {
+	CPU_PROFILE_SCOPE("createSynchronisation");
+
 	imageAvailable.resize(MAX_FRAME_DRAWS);
 	renderFinished.resize(MAX_FRAME_DRAWS);
 	drawFences.resize(MAX_FRAME_DRAWS);
@@ -913,6 +1470,9 @@ void VulkanRenderer::createSynchronisation()
 	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;			// fence starts signaled (open) so it doesn't block at start
 
+	// no image is in use yet
+	imagesInFlight.resize(swapChainImages.size(), VK_NULL_HANDLE);
+
 	for (auto i = 0lu; i < MAX_FRAME_DRAWS; i++)
 	{
 		if (vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &imageAvailable[i]) != VK_SUCCESS || 
@@ -926,6 +1486,8 @@ void VulkanRenderer::createSynchronisation()
 
 void VulkanRenderer::createTextureSampler()
 {
+	CPU_PROFILE_SCOPE("createTextureSampler");
+
 	//sampler creation info
 	VkSamplerCreateInfo samplerCreateInfo{};
 	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -946,191 +1508,512 @@ void VulkanRenderer::createTextureSampler()
 	auto result = vkCreateSampler(mainDevice.logicalDevice, &samplerCreateInfo, nullptr, &textureSampler);
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to create texture sampler");
+		throw std::runtime_error("Failed to create texture sampler");
+	}
+}
+
+void VulkanRenderer::createUniformBuffers()
+{
+	CPU_PROFILE_SCOPE("createUniformBuffers");
+
+	// one persistently mapped buffer, one region for each image (and by extension, command buffer)
+	uniformRing.init(mainDevice.physicalDevice, mainDevice.logicalDevice, &allocator, static_cast<uint32_t>(swapChainImages.size()));
+
+	// object regions are bound by a single storage descriptor and selected by a 32 bit dynamic offset
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &deviceProperties);
+
+	auto maxRegionSize = std::min<VkDeviceSize>(deviceProperties.limits.maxStorageBufferRange,
+		std::numeric_limits<uint32_t>::max() / swapChainImages.size());
+	maxObjectCapacity = static_cast<uint32_t>(maxRegionSize / sizeof(ObjectData));
+
+	createObjectBuffer(std::min(INITIAL_OBJECT_CAPACITY, maxObjectCapacity));
+}
+
+void VulkanRenderer::createObjectBuffer(uint32_t capacity)
+{
+	CPU_PROFILE_SCOPE("createObjectBuffer");
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &deviceProperties);
+
+	// regions of all images in one buffer, each has to start at a valid dynamic offset
+	objectCapacity = capacity;
+	objectRegionSize = alignUp(sizeof(ObjectData) * static_cast<VkDeviceSize>(capacity), deviceProperties.limits.minStorageBufferOffsetAlignment);
+
+	createBuffer(mainDevice.logicalDevice, allocator, objectRegionSize * swapChainImages.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, objectBuffer, objectBufferMemory);
+}
+
+void VulkanRenderer::createDescriptorPool()
+{
+	CPU_PROFILE_SCOPE("createDescriptorPool");
+
+	//create uniform descriptor pool
+
+	// type of descriptors + how many descriptors, not descriptor sets (combined makes the poolsize)
+
+	// View Projection Pool
+	VkDescriptorPoolSize vpPoolSize{};
+	vpPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	vpPoolSize.descriptorCount = 1;
+
+	// Object pool (dynamic)
+	VkDescriptorPoolSize objectPoolSize{};
+	objectPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	objectPoolSize.descriptorCount = 2;			// objects + visible list
+
+	std::array<VkDescriptorPoolSize, 2> poolSizes = { vpPoolSize, objectPoolSize };
+
+	// data to create descriptor pool
+	VkDescriptorPoolCreateInfo poolCreateInfo{};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.maxSets = 1;		// maximum number of descriptor sets that can be created from pool
+	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());											// amount of pool sizes being passed
+	poolCreateInfo.pPoolSizes = poolSizes.data();										// pool sizes to create pool with
+
+	// create descriptor pool
+	auto result = vkCreateDescriptorPool(mainDevice.logicalDevice, &poolCreateInfo, nullptr, &descriptorPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create descriptor pool!");
+	}
+
+
+	// create sampler descriptor pool
+	//texture sampler pool
+
+	VkDescriptorPoolSize samplerPoolSize{};
+	samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER; //sperate is probably more optimal TODO
+	samplerPoolSize.descriptorCount = textureCapacity;				  // one set holding every texture
+
+	VkDescriptorPoolCreateInfo samplerPoolCreateInfo{};
+	samplerPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	samplerPoolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	samplerPoolCreateInfo.maxSets = 1;
+	samplerPoolCreateInfo.poolSizeCount = 1;
+	samplerPoolCreateInfo.pPoolSizes = &samplerPoolSize;
+
+	result = vkCreateDescriptorPool(mainDevice.logicalDevice, &samplerPoolCreateInfo, nullptr, &samplerDescriptorPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create sampler descriptor pool!");
+	}
+}
+
+void VulkanRenderer::createDescriptorSets()
+{
+	CPU_PROFILE_SCOPE("createDescriptorSets");
+
+	VkDescriptorSetAllocateInfo setAllocInfo{};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = descriptorPool;				// pool to allocate descriptor set from
+	setAllocInfo.descriptorSetCount = 1;						// number of sets to allocate
+	setAllocInfo.pSetLayouts = &descriptorSetLayout;			// layouts to use to allocate sets
+
+	// allocate descriptor set, frames only differ in the dynamic offset into the uniform ring
+	auto result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, &uniformDescriptorSet);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate descriptor sets!");
+	}
+
+	// buffer info and data offset info
+
+	// view projection
+	VkDescriptorBufferInfo vpBufferInfo{};
+	vpBufferInfo.buffer = uniformRing.getBuffer();		// buffer to get data from
+	vpBufferInfo.offset = 0;							// position of start of data, dynamic offset is added on bind
+	vpBufferInfo.range = sizeof(UboViewProjection);		// size of data
+
+	// data about connection between binding and buffer
+	VkWriteDescriptorSet vpSetWrite{};
+	vpSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	vpSetWrite.dstSet = uniformDescriptorSet;	// descriptor set to update
+	vpSetWrite.dstBinding = 0;				// layout(binding = 0) uniform MVP this here - binding to update
+	vpSetWrite.dstArrayElement = 0;		// index in the array we want to update
+	vpSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;		// type of descriptor
+	vpSetWrite.descriptorCount = 1;		// amount to update
+	vpSetWrite.pBufferInfo = &vpBufferInfo;	// information about buffer data to bind
+
+	std::array<VkWriteDescriptorSet, 1> writeDescriptorSets{ vpSetWrite };
+
+	// update the descriptor set with new buffer / binding info
+	vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+	updateObjectDescriptor();
+
+	// texture array, elements are written by createTextureDescriptor
+	VkDescriptorSetAllocateInfo textureSetAllocInfo{};
+	textureSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	textureSetAllocInfo.descriptorPool = samplerDescriptorPool;
+	textureSetAllocInfo.descriptorSetCount = 1;
+	textureSetAllocInfo.pSetLayouts = &samplerSetLayout;
+
+	result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &textureSetAllocInfo, &textureDescriptorSet);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate texture descriptor sets!");
+	}
+}
+
+void VulkanRenderer::updateObjectDescriptor()
+{
+	// object data and visible list, offset of the image region is added on bind
+	std::array<VkDescriptorBufferInfo, 2> bufferInfos{};
+	bufferInfos[0].buffer = objectBuffer;
+	bufferInfos[0].offset = 0;
+	bufferInfos[0].range = sizeof(ObjectData) * static_cast<VkDeviceSize>(objectCapacity);
+	bufferInfos[1].buffer = gpuCulling.getVisibleBuffer();
+	bufferInfos[1].offset = 0;
+	bufferInfos[1].range = gpuCulling.getVisibleRegionSize();
+
+	std::array<VkWriteDescriptorSet, 2> setWrites{};
+	for (auto i = 0lu; i < setWrites.size(); i++)
+	{
+		setWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		setWrites[i].dstSet = uniformDescriptorSet;
+		setWrites[i].dstBinding = static_cast<uint32_t>(i + 1);
+		setWrites[i].dstArrayElement = 0;
+		setWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		setWrites[i].descriptorCount = 1;
+		setWrites[i].pBufferInfo = &bufferInfos[i];
+	}
+
+	vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
+}
+
+VkFormat VulkanRenderer::getDepthBufferFormat()
+{
+	//get supported format for depth buffer
+	return chooseSupportedFormat({ VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT } //stencil, normal depth, depth 24 normalised
+	, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);	// sampled for the depth pyramid
+}
+
+void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex)
+{
+	CPU_PROFILE_SCOPE("updateUniformBuffers");
+
+	// all per frame constants of this image are bump allocated from its ring region
+	uniformRing.beginFrame(imageIndex);
+
+	// copy VP data (ring buffer is persistently mapped)
+	auto viewProjection = uboViewProjection.projection * uboViewProjection.view;
+	auto frustum = GpuCulling::extractFrustum(viewProjection);
+
+	// the early phase tests against the pyramid of the previous frame, with the matrix it was drawn with
+	frustum.viewProjection = viewProjection;
+	frustum.previousViewProjection = previousViewProjection;
+	frustum.earlyOcclusion = occlusionCulling && occlusionHistoryValid ? 1 : 0;
+	frustum.lateOcclusion = occlusionCulling ? 1 : 0;
+	previousViewProjection = viewProjection;
+	occlusionHistoryValid = true;
+
+	vpUniformOffset = uniformRing.push(uboViewProjection);
+	frustumUniformOffset = uniformRing.push(frustum);
+	frameCounters.hostWrittenBytes += sizeof(uboViewProjection) + sizeof(frustum);
+
+	auto objectCount = static_cast<uint32_t>(drawOrder.size());
+	auto taskCount = (objectCount + OBJECTS_PER_WRITE_TASK - 1) / OBJECTS_PER_WRITE_TASK;
+
+	if (cpuCulling == CpuCulling::Bvh)
+	{
+		updateSceneBvh();
+		sceneBvh.queryFrustum(frustum.planes, cpuVisibleObjects);
+
+		objectVisibility.assign(objectCount, 0);
+		for (auto modelId : cpuVisibleObjects)
+		{
+			objectVisibility[objectSlots[modelId]] = 1;
+		}
+	}
+	else if (cpuCulling == CpuCulling::Flat)
+	{
+		// world space spheres in object buffer order
+		frustumCuller.resize(objectCount);
+		threadPool.parallelFor(taskCount, [&](uint32_t task, uint32_t)
+		{
+			auto first = task * OBJECTS_PER_WRITE_TASK;
+			auto end = std::min(first + OBJECTS_PER_WRITE_TASK, objectCount);
+
+			for (auto i = first; i < end; i++)
+			{
+				frustumCuller.setSphere(i, meshList[drawOrder[i]].getWorldBoundingSphere());
+			}
+		});
+
+		frustumCuller.cull(frustum.planes, cpuVisibleObjects);
+
+		objectVisibility.assign(objectCount, 0);
+		for (auto index : cpuVisibleObjects)
+		{
+			objectVisibility[index] = 1;
+		}
+	}
+
+	// occlusion of the frustum visible objects against the occluders, on the cpu
+	auto softwareOcclusionActive = softwareOcclusionEnabled && !occluderMeshes.empty();
+	if (softwareOcclusionActive)
+	{
+		if (cpuCulling == CpuCulling::None)
+		{
+			objectVisibility.assign(objectCount, 1);
+		}
+
+		softwareOcclusion.clearOccluders();
+		for (auto& occluderMesh : occluderMeshes)
+		{
+			softwareOcclusion.addOccluder(meshList[occluderMesh.modelId].getModel().model, occluderMesh.vertices, occluderMesh.indices);
+		}
+		softwareOcclusion.render(viewProjection, &threadPool);
+
+		occludeeBoxes.resize(objectCount);
+		threadPool.parallelFor(taskCount, [&](uint32_t task, uint32_t)
+		{
+			auto first = task * OBJECTS_PER_WRITE_TASK;
+			auto end = std::min(first + OBJECTS_PER_WRITE_TASK, objectCount);
+
+			for (auto i = first; i < end; i++)
+			{
+				if (objectVisibility[i])
+				{
+					occludeeBoxes[i] = meshList[drawOrder[i]].getWorldBoundingBox();
+				}
+			}
+		});
+
+		softwareOcclusion.testBoxes(occludeeBoxes.data(), objectCount, objectVisibility.data(), &threadPool);
+	}
+	auto cpuTested = cpuCulling != CpuCulling::None || softwareOcclusionActive;
+
+	// copy object data into the region of this image, instances of a batch next to each other
+	// every entry is written by exactly one task, meshList is only read
+	auto objects = reinterpret_cast<ObjectData*>(static_cast<char*>(objectBufferMemory.mappedData) + objectRegionSize * imageIndex);
+	std::vector<uint64_t> taskTriangles(taskCount, 0);
+
+	threadPool.parallelFor(taskCount, [&](uint32_t task, uint32_t)
+	{
+		auto first = task * OBJECTS_PER_WRITE_TASK;
+		auto end = std::min(first + OBJECTS_PER_WRITE_TASK, objectCount);
+
+		for (auto i = first; i < end; i++)
+		{
+			auto& mesh = meshList[drawOrder[i]];
+
+			ObjectData object{};
+			object.model = mesh.getModel().model;
+			object.boundingSphere = mesh.getBoundingSphere();
+			object.batchIndex = objectBatches[i];
+			object.textureIndex = static_cast<uint32_t>(mesh.getTexId());
+			object.flags = mesh.getFlags();
+
+			// already tested on the cpu, the gpu pass only tests what is left
+			if (cpuTested && (object.flags & OBJECT_FLAG_NO_CULL) == 0)
+			{
+				if (!objectVisibility[i])
+				{
+					object.flags |= OBJECT_FLAG_HIDDEN;
+				}
+				else if (cpuCulling != CpuCulling::None)
+				{
+					object.flags |= OBJECT_FLAG_FRUSTUM_VISIBLE;
+				}
+			}
+
+			// one full write, the memory is write combined
+			objects[i] = object;
+
+			if ((object.flags & OBJECT_FLAG_HIDDEN) == 0)
+			{
+				taskTriangles[task] += drawBatches[objectBatches[i]].geometry.indexCount / 3;
+			}
+		}
+	});
+
+	for (auto triangles : taskTriangles)
+	{
+		frameCounters.triangles += triangles;
 	}
+	frameCounters.hostWrittenBytes += sizeof(ObjectData) * objectCount;
 }
 
-void VulkanRenderer::createUniformBuffers()
+void VulkanRenderer::ensureObjectCapacity()
 {
-	// buffer size will be size of all 2 variables (will offset to access) - view projection size
-	VkDeviceSize vpBufferSize = sizeof(UboViewProjection);
-
-	//model buffer size
-	//VkDeviceSize modelDynBufferSize = modelUniformAlignment * MAX_OBJECTS;
+	CPU_PROFILE_SCOPE("ensureObjectCapacity");
 
+	auto objectsFit = meshList.size() <= objectCapacity;
+	auto batchesFit = drawBatches.size() <= gpuCulling.getBatchCapacity();
+	if (objectsFit && batchesFit)
+	{
+		return;
+	}
 
-	//one uniform buffer for each image (and by extension, command buffer)
-	vpUniformBuffers.resize(swapChainImages.size());
-	vpUniformBufferMemory.resize(swapChainImages.size());
-/*
-	modelDynUniformBuffers.resize(swapChainImages.size());
-	modelDynUniformBufferMemory.resize(swapChainImages.size());*/
+	// recorded command buffers and descriptors reference the old buffers
+	vkDeviceWaitIdle(mainDevice.logicalDevice);
 
-	//create uniform buffers
-	for (auto i = 0lu; i < swapChainImages.size(); i++)
+	if (!objectsFit)
 	{
-		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, vpBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, vpUniformBuffers[i], vpUniformBufferMemory[i]);
-/*
-		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, modelDynBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, modelDynUniformBuffers[i], modelDynUniformBufferMemory[i]);*/
-	}
-}
+		if (meshList.size() > maxObjectCapacity)
+		{
+			throw std::runtime_error("Object count exceeds the storage buffer limits of the device!");
+		}
 
-void VulkanRenderer::createDescriptorPool()
-{
-	//create uniform descriptor pool
+		destroyBuffer(mainDevice.logicalDevice, allocator, objectBuffer, objectBufferMemory);
+		createObjectBuffer(std::min(std::max(objectCapacity * 2, static_cast<uint32_t>(meshList.size())), maxObjectCapacity));
+	}
 
-	// type of descriptors + how many descriptors, not descriptor sets (combined makes the poolsize)
+	gpuCulling.reserve(objectCapacity, static_cast<uint32_t>(drawBatches.size()));
+	gpuCulling.setObjectBuffer(objectBuffer, objectRegionSize, objectCapacity);
+	updateObjectDescriptor();
 
-	// View Projection Pool
-	VkDescriptorPoolSize vpPoolSize{};
-	vpPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	vpPoolSize.descriptorCount = static_cast<uint32_t>(vpUniformBuffers.size());
+	std::fill(commandBufferDirty.begin(), commandBufferDirty.end(), true);
+}
 
-	// Model pool (dynamic)
-	/*VkDescriptorPoolSize modelPoolSize{};
-	modelPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-	modelPoolSize.descriptorCount = static_cast<uint32_t>(modelDynUniformBuffers.size());
-	*/
-	std::array<VkDescriptorPoolSize, 1> poolSizes = { vpPoolSize }; //, modelPoolSize
+void VulkanRenderer::markCommandBuffersDirty()
+{
+	std::fill(commandBufferDirty.begin(), commandBufferDirty.end(), true);
+	drawBatchesDirty = true;
+	sceneBvhDirty = true;
+}
 
-	// data to create descriptor pool
-	VkDescriptorPoolCreateInfo poolCreateInfo{};
-	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolCreateInfo.maxSets = static_cast<uint32_t>(swapChainImages.size());		// maximum number of descriptor sets that can be created from pool
-	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());											// amount of pool sizes being passed
-	poolCreateInfo.pPoolSizes = poolSizes.data();										// pool sizes to create pool with
+void VulkanRenderer::buildDrawBatches()
+{
+	CPU_PROFILE_SCOPE("buildDrawBatches");
 
-	// create descriptor pool
-	auto result = vkCreateDescriptorPool(mainDevice.logicalDevice, &poolCreateInfo, nullptr, &descriptorPool);
-	if (result != VK_SUCCESS)
+	// dense id per distinct geometry range, in order of first use
+	std::unordered_map<uint64_t, uint32_t> geometryIds;
+	meshGeometryIds.resize(meshList.size());
+	for (uint32_t i = 0; i < meshList.size(); i++)
 	{
-		throw std::runtime_error("Failed to create descriptor pool!");
-	}
+		auto& geometry = meshList[i].getGeometry();
+		auto geometryKey = (static_cast<uint64_t>(geometry.firstIndex) << 32) | static_cast<uint32_t>(geometry.vertexOffset);
 
+		auto id = geometryIds.emplace(geometryKey, static_cast<uint32_t>(geometryIds.size())).first->second;
+		if (id >= (1u << DRAW_KEY_GEOMETRY_BITS))
+		{
+			throw std::runtime_error("Too many distinct geometries for the draw sort key!");
+		}
+		meshGeometryIds[i] = id;
+	}
 
-	// create sampler descriptor pool
-	//texture sampler pool
-
-	VkDescriptorPoolSize samplerPoolSize{};
-	samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER; //sperate is probably more optimal TODO
-	samplerPoolSize.descriptorCount = MAX_OBJECTS;					  // assuming we only have one texture per object - not optimal TODO
+	// models without a variant use the default pipeline
+	meshPipelineIds.resize(meshList.size(), PipelineManager::DEFAULT_PIPELINE);
 
-	VkDescriptorPoolCreateInfo samplerPoolCreateInfo{};
-	samplerPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	samplerPoolCreateInfo.maxSets = MAX_OBJECTS;					// should use textureAtlas or arraylayers TODO
-	samplerPoolCreateInfo.poolSizeCount = 1;
-	samplerPoolCreateInfo.pPoolSizes = &samplerPoolSize;
+	// same geometry ends up next to each other
+	sortDrawOrder();
 
-	result = vkCreateDescriptorPool(mainDevice.logicalDevice, &samplerPoolCreateInfo, nullptr, &samplerDescriptorPool);
-	if (result != VK_SUCCESS)
+	drawBatches.clear();
+	drawGroups.clear();
+	objectBatches.resize(drawOrder.size());
+	for (uint32_t i = 0; i < drawOrder.size(); i++)
 	{
-		throw std::runtime_error("Failed to create sampler descriptor pool!");
-	}
-}
+		auto& mesh = meshList[drawOrder[i]];
+		auto& geometry = mesh.getGeometry();
+		auto pipelineId = meshPipelineIds[drawOrder[i]];
 
-void VulkanRenderer::createDescriptorSets()
-{
-	// resize descriptor set list so we have one for every buffer
-	descriptorSets.resize(swapChainImages.size());
+		if (!drawBatches.empty())
+		{
+			auto& batch = drawBatches.back();
+			if (batch.geometry.firstIndex == geometry.firstIndex && batch.geometry.vertexOffset == geometry.vertexOffset
+				&& batch.geometry.indexCount == geometry.indexCount && batch.pipelineId == pipelineId)
+			{
+				batch.instanceCount++;
+				objectBatches[i] = static_cast<uint32_t>(drawBatches.size()) - 1;
+				continue;
+			}
+		}
 
-	std::vector<VkDescriptorSetLayout> setLayouts(swapChainImages.size(), descriptorSetLayout);
+		objectBatches[i] = static_cast<uint32_t>(drawBatches.size());
 
-	VkDescriptorSetAllocateInfo setAllocInfo{};
-	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	setAllocInfo.descriptorPool = descriptorPool;				// pool to allocate descriptor set from
-	setAllocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size());			// number of sets to allocate
-	setAllocInfo.pSetLayouts = setLayouts.data();			// first descriptor set uses first element, second uses second element etc, all atm have descriptorSetLayout - layouts to use to allocate sets)
+		// textures are bindless, groups split the batches over the recording threads and by pipeline
+		if (drawGroups.empty() || drawGroups.back().batchCount == BATCHES_PER_DRAW_GROUP || drawGroups.back().pipelineId != pipelineId)
+		{
+			drawGroups.push_back({ static_cast<uint32_t>(drawBatches.size()), 0, pipelineId });
+		}
+		drawGroups.back().batchCount++;
 
-	// allocate descriptor sets
-	auto result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, descriptorSets.data());
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to allocate descriptor sets!");
+		drawBatches.push_back({ geometry, pipelineId, i, 1 });
 	}
 
-	// update all of descriptor set buffer bindings
-	for (auto i = 0lu; i < swapChainImages.size(); i++)
+	// batch table for the culling pass
+	cullBatches.resize(drawBatches.size());
+	for (uint32_t g = 0; g < drawGroups.size(); g++)
 	{
-		// buffer info and data offset info
+		auto& group = drawGroups[g];
+		for (auto b = group.firstBatch; b < group.firstBatch + group.batchCount; b++)
+		{
+			auto& batch = drawBatches[b];
+			auto& cullBatch = cullBatches[b];
+
+			cullBatch = {};
+			cullBatch.indexCount = batch.geometry.indexCount;
+			cullBatch.firstIndex = batch.geometry.firstIndex;
+			cullBatch.vertexOffset = static_cast<int32_t>(batch.geometry.vertexOffset);
+			cullBatch.firstInstance = batch.firstInstance;
+			cullBatch.drawGroup = g;
+			cullBatch.groupFirstDraw = group.firstBatch;
+		}
+	}
 
-		// view projection
-		VkDescriptorBufferInfo vpBufferInfo{};
-		vpBufferInfo.buffer = vpUniformBuffers[i];			// buffer to get data from
-		vpBufferInfo.offset = 0;							// position of start of data
-		vpBufferInfo.range = sizeof(UboViewProjection);					// size of data
+	drawBatchesDirty = false;
+}
 
-		// data about connection between binding and buffer
-		VkWriteDescriptorSet vpSetWrite{};
-		vpSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		vpSetWrite.dstSet = descriptorSets[i];	// descriptor set to update
-		vpSetWrite.dstBinding = 0;				// layout(binding = 0) uniform MVP this here - binding to update
-		vpSetWrite.dstArrayElement = 0;		// index in the array we want to update
-		vpSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;		// type of descriptor
-		vpSetWrite.descriptorCount = 1;		// amount to update
-		vpSetWrite.pBufferInfo = &vpBufferInfo;	// information about buffer data to bind
+void VulkanRenderer::sortDrawOrder()
+{
+	CPU_PROFILE_SCOPE("sortDrawOrder");
 
+	drawOrder.resize(meshList.size());
+	drawKeys.resize(meshList.size());
 
-		// model descriptor
+	for (uint32_t i = 0; i < meshList.size(); i++)
+	{
+		auto& mesh = meshList[i];
 
-		////model buffer binding
-		//VkDescriptorBufferInfo modelBufferInfo{};
-		//modelBufferInfo.buffer = modelDynUniformBuffers[i];		
-		//modelBufferInfo.offset = 0;						
-		//modelBufferInfo.range = modelUniformAlignment;		
+		// distance of the bounding sphere center along the view direction
+		auto sphere = mesh.getBoundingSphere();
+		auto viewPosition = uboViewProjection.view * mesh.getModel().model * glm::vec4(glm::vec3(sphere), 1.f);
 
-		//// data about connection between binding and buffer
-		//VkWriteDescriptorSet modelSetWrite{};
-		//modelSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		//modelSetWrite.dstSet = descriptorSets[i];
-		//modelSetWrite.dstBinding = 1;
-		//modelSetWrite.dstArrayElement = 0;
-		//modelSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-		//modelSetWrite.descriptorCount = 1;
-		//modelSetWrite.pBufferInfo = &modelBufferInfo;
+		// one pipeline change per variant
+		drawKeys[i] = makeDrawKey(meshPipelineIds[i], meshGeometryIds[i], static_cast<uint32_t>(mesh.getTexId()), -viewPosition.z);
+		drawOrder[i] = i;
+	}
 
-		std::array<VkWriteDescriptorSet, 1> writeDescriptorSets{ vpSetWrite }; //, modelSetWrite };
+	drawSorter.sort(drawKeys, drawOrder);
 
-		// update the descriptor sets with new buffer / binding info
-		vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+	objectSlots.resize(drawOrder.size());
+	for (uint32_t i = 0; i < drawOrder.size(); i++)
+	{
+		objectSlots[drawOrder[i]] = i;
 	}
-}
 
-VkFormat VulkanRenderer::getDepthBufferFormat()
-{
-	//get supported format for depth buffer
-	return chooseSupportedFormat({ VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT } //stencil, normal depth, depth 24 normalised
-	, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+	drawOrderUnsorted = false;
 }
 
-void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex)
+void VulkanRenderer::updateSceneBvh()
 {
-	void* data;
-
-	// copy VP data
-	vkMapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex], 0, sizeof(UboViewProjection), 0, &data);
-	memcpy(data, &uboViewProjection, sizeof(UboViewProjection));
-	vkUnmapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex]);
+	CPU_PROFILE_SCOPE("updateSceneBvh");
 
+	if (!sceneBvhDirty)
+	{
+		// moved models only
+		sceneBvh.refit();
+		return;
+	}
 
-	// copy model data
-
-	//// copy data to aligned offset modelTransferSpace
-	//for (auto i = 0lu; i < meshList.size(); i++)
-	//{
-	//	Model* model = (Model*)((uint64_t)modelTransferSpace + (i * modelUniformAlignment));
-	//	*model = meshList[i].getModel();
-	//}
+	std::vector<BoundingBox> worldBounds(meshList.size());
+	for (uint32_t i = 0; i < meshList.size(); i++)
+	{
+		worldBounds[i] = meshList[i].getWorldBoundingBox();
+	}
 
-	////map the list of model data 
-	//vkMapMemory(mainDevice.logicalDevice, modelDynUniformBufferMemory[imageIndex], 0, modelUniformAlignment * meshList.size() , 0, &data); // not max object, since we only want the amount of object that exist
-	//memcpy(data, modelTransferSpace, modelUniformAlignment * meshList.size());
-	//vkUnmapMemory(mainDevice.logicalDevice, modelDynUniformBufferMemory[imageIndex]);
+	sceneBvh.build(worldBounds, &threadPool);
+	sceneBvhDirty = false;
 }
 
 void VulkanRenderer::recordCommands(uint32_t currentImage)
 {
+	CPU_PROFILE_SCOPE("recordCommands");
+
 	// information about how to begin each command buffer
 	VkCommandBufferBeginInfo bufferBeginInfo{};
 	bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -1162,52 +2045,177 @@ void VulkanRenderer::recordCommands(uint32_t currentImage)
 		throw std::runtime_error("failed to start recording a commandbuffer!");
 	}
 
+	// batch table is only rewritten with the commands using it, the image is not in flight now
+	gpuCulling.writeBatches(currentImage, cullBatches);
+	frameCounters.hostWrittenBytes += sizeof(CullBatch) * cullBatches.size();
+	frameCounters.recorded = true;
+
+	// timestamps of the last recording were collected before
+	gpuProfiler.recordReset(commandBuffers[currentImage], currentImage);
+	gpuProfiler.recordBegin(commandBuffers[currentImage], currentImage, gpuScopes.frame);
+
+	// command buffers of the last recording of this image are not in use anymore
+	for (auto& threadCommandPool : secondaryCommandPools[currentImage])
 	{
-		// begin render pass
-		vkCmdBeginRenderPass(commandBuffers[currentImage], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);  //all of the commands will be primary commands
+		vkResetCommandPool(mainDevice.logicalDevice, threadCommandPool.pool, 0);
+		threadCommandPool.usedBuffers = 0;
+	}
 
+	pipelineStats.fallbackGroups = 0;
+	pipelineStats.deferredGroups = 0;
+	for (auto& group : drawGroups)
+	{
+		if (pipelineManager.getPipeline(group.pipelineId) == VK_NULL_HANDLE)
 		{
-			//bind pipeline to be used in render pas
-			vkCmdBindPipeline(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+			(deferPendingPipelines ? pipelineStats.deferredGroups : pipelineStats.fallbackGroups)++;
+		}
+	}
 
-			for (auto k = 0lu; k < meshList.size(); k++)
-			{
-				auto& mesh = meshList[k];
+	// split draws over the worker threads, small ranges are not worth a secondary command buffer
+	// every range is recorded once per culling phase, early ranges first
+	auto drawCount = static_cast<uint32_t>(drawGroups.size());
+	auto threadCount = threadPool.getThreadCount();
+	auto drawsPerTask = std::max(MIN_DRAWS_PER_SECONDARY, (drawCount + threadCount - 1) / threadCount);
+	auto phaseTaskCount = (drawCount + drawsPerTask - 1) / drawsPerTask;
+
+	for (uint32_t phase = 0; phase < 2; phase++)
+	{
+		drawGroupScopes[phase].clear();
+		for (uint32_t g = 0; gpuDrawGroupTiming && g < drawCount; g++)
+		{
+			drawGroupScopes[phase].push_back(gpuProfiler.getScopeId((phase == 0 ? "early group " : "late group ") + std::to_string(g)));
+		}
+	}
+	auto taskCount = phaseTaskCount * 2;
+
+	std::vector<VkCommandBuffer> secondaryCommandBuffers(taskCount);
+	std::vector<VkResult> taskResults(taskCount, VK_SUCCESS);
+	std::vector<BindStats> taskBindStats(taskCount);
+	std::vector<CommandCounters> taskCounters(taskCount);
+
+	// render pass the secondary command buffers are executed in
+	std::array<VkCommandBufferInheritanceInfo, 2> inheritanceInfos{};
+	std::array<VkCommandBufferBeginInfo, 2> secondaryBeginInfos{};
+	for (uint32_t phase = 0; phase < 2; phase++)
+	{
+		inheritanceInfos[phase].sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfos[phase].renderPass = phase == 0 ? renderPass : lateRenderPass;
+		inheritanceInfos[phase].subpass = 0;
+		inheritanceInfos[phase].framebuffer = swapChainFramebuffers[currentImage];
+
+		secondaryBeginInfos[phase].sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		secondaryBeginInfos[phase].flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;	// entirely inside the render pass
+		secondaryBeginInfos[phase].pInheritanceInfo = &inheritanceInfos[phase];
+	}
 
-				VkBuffer vertexBuffers[] = { mesh.getVertexBuffer() };			// buffers to bind
-				VkDeviceSize offsets[] = { 0 };										// offsets into buffers being bound
-				vkCmdBindVertexBuffers(commandBuffers[currentImage], 0, 1, vertexBuffers, offsets);  // command to bind vertex buffer before with them
+	threadPool.parallelFor(taskCount, [&](uint32_t task, uint32_t threadIndex)
+	{
+		CPU_PROFILE_SCOPE("record draws");
 
-				// bind mesh index buffer, with 0 offset and uisng uint32
-				vkCmdBindIndexBuffer(commandBuffers[currentImage], mesh.getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+		// command buffer from the pool of this thread, pools must not be used by two threads at once
+		auto commandBuffer = getSecondaryCommandBuffer(currentImage, threadIndex);
+		if (commandBuffer == VK_NULL_HANDLE)
+		{
+			taskResults[task] = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+			return;
+		}
 
+		auto phase = task / phaseTaskCount;
+		taskResults[task] = vkBeginCommandBuffer(commandBuffer, &secondaryBeginInfos[phase]);
+		if (taskResults[task] != VK_SUCCESS)
+		{
+			return;
+		}
 
-				// dynamic offset amount
-				//uint32_t dynamicOffset = static_cast<uint32_t>(modelUniformAlignment) * k;
+		auto first = (task % phaseTaskCount) * drawsPerTask;
+		recordDraws(commandBuffer, currentImage, phase == 0 ? GpuCulling::CullPhase::Early : GpuCulling::CullPhase::Late,
+			first, std::min(first + drawsPerTask, drawCount), taskBindStats[task], taskCounters[task]);
 
-				//push constants to shader stage directly
-				vkCmdPushConstants(commandBuffers[currentImage], pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(Model), &meshList[k].getModel());
+		taskResults[task] = vkEndCommandBuffer(commandBuffer);
+		secondaryCommandBuffers[task] = commandBuffer;
+	});
 
-				// bind descriptor sets
-				
-				std::array<VkDescriptorSet, 2> descriptorSetGroup{ descriptorSets[currentImage], samplerDescriptorSets[meshList[k].getTexId()] };
-				
-				//vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentImage],
-				//	1, &dynamicOffset); //1 dynamic offset for dynamic uniformbuffer
-				vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(descriptorSetGroup.size())
-					, descriptorSetGroup.data(), 
-					0, nullptr); //1 dynamic offset for dynamic uniformbuffer
+	for (auto taskResult : taskResults)
+	{
+		if (taskResult != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to record a secondary commandbuffer!");
+		}
+	}
 
-				//execute pipeline
-				vkCmdDrawIndexed(commandBuffers[currentImage], mesh.getIndexCount(), 1, 0, 0, 0);
-			}
+	bindStats = {};
+	for (auto& taskStats : taskBindStats)
+	{
+		bindStats.issued += taskStats.issued;
+		bindStats.skipped += taskStats.skipped;
+	}
+
+	CommandCounters counters;
+	for (auto& taskCounter : taskCounters)
+	{
+		counters.add(taskCounter);
+	}
+
+	auto objectCount = static_cast<uint32_t>(drawOrder.size());
+	auto batchCount = static_cast<uint32_t>(drawBatches.size());
+
+	// early phase: objects visible in the depth pyramid of the previous frame
+	{
+		GpuProfiler::Scope scope(gpuProfiler, commandBuffers[currentImage], currentImage, gpuScopes.earlyCull);
+		gpuCulling.recordCull(commandBuffers[currentImage], currentImage, GpuCulling::CullPhase::Early, frustumUniformOffset, objectCount, batchCount, counters);
+	}
 
+	{
+		GpuProfiler::Scope scope(gpuProfiler, commandBuffers[currentImage], currentImage, gpuScopes.earlyPass);
+
+		// begin render pass, draws are recorded into secondary command buffers
+		vkCmdBeginRenderPass(commandBuffers[currentImage], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+		// run them in draw order
+		if (phaseTaskCount > 0)
+		{
+			vkCmdExecuteCommands(commandBuffers[currentImage], phaseTaskCount, secondaryCommandBuffers.data());
 		}
 
 		// end renderpass
 		vkCmdEndRenderPass(commandBuffers[currentImage]);
 	}
 
+	// late phase: objects the early phase found occluded, tested against the early draws
+	{
+		GpuProfiler::Scope scope(gpuProfiler, commandBuffers[currentImage], currentImage, gpuScopes.earlyHiZ);
+		hiZPyramid.recordBuild(commandBuffers[currentImage], counters);
+	}
+	{
+		GpuProfiler::Scope scope(gpuProfiler, commandBuffers[currentImage], currentImage, gpuScopes.lateCull);
+		gpuCulling.recordCull(commandBuffers[currentImage], currentImage, GpuCulling::CullPhase::Late, frustumUniformOffset, objectCount, batchCount, counters);
+	}
+
+	{
+		GpuProfiler::Scope scope(gpuProfiler, commandBuffers[currentImage], currentImage, gpuScopes.latePass);
+
+		// keeps the early draws, nothing is cleared
+		renderPassBeginInfo.renderPass = lateRenderPass;
+		renderPassBeginInfo.clearValueCount = 0;
+		renderPassBeginInfo.pClearValues = nullptr;
+
+		vkCmdBeginRenderPass(commandBuffers[currentImage], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+		if (phaseTaskCount > 0)
+		{
+			vkCmdExecuteCommands(commandBuffers[currentImage], phaseTaskCount, secondaryCommandBuffers.data() + phaseTaskCount);
+		}
+
+		vkCmdEndRenderPass(commandBuffers[currentImage]);
+	}
+
+	// depth of the whole frame for the early phase of the next one
+	{
+		GpuProfiler::Scope scope(gpuProfiler, commandBuffers[currentImage], currentImage, gpuScopes.lateHiZ);
+		hiZPyramid.recordBuild(commandBuffers[currentImage], counters);
+	}
+	gpuProfiler.recordEnd(commandBuffers[currentImage], currentImage, gpuScopes.frame);
+
 	// stop recording to command 
 	result = vkEndCommandBuffer(commandBuffers[currentImage]);
 	if (result != VK_SUCCESS)
@@ -1215,11 +2223,135 @@ void VulkanRenderer::recordCommands(uint32_t currentImage)
 		throw std::runtime_error("failed to stop recording a commandbuffer");
 	}
 
+	commandBufferDirty[currentImage] = false;
+	recordedCounters[currentImage] = counters;
+	recordedUniformOffsets[currentImage] = vpUniformOffset;
+	recordedFrustumOffsets[currentImage] = frustumUniformOffset;
+
 	//vkBeginCommandBuffer(comm)
 }
 
+void VulkanRenderer::recordDraws(VkCommandBuffer commandBuffer, uint32_t currentImage, GpuCulling::CullPhase phase, uint32_t firstGroup, uint32_t endGroup, BindStats& stats,
+	CommandCounters& counters)
+{
+	// secondary command buffers don't inherit any state, every group requests its state and only changes are recorded
+	VkPipeline boundPipeline = VK_NULL_HANDLE;
+	VkBuffer boundVertexBuffer = VK_NULL_HANDLE;
+	VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+	std::array<VkDescriptorSet, 2> boundDescriptorSets{};
+
+	// dynamic offsets in binding order, same for the whole command buffer
+	std::array<uint32_t, 3> dynamicOffsets{ vpUniformOffset, static_cast<uint32_t>(objectRegionSize * currentImage),
+		static_cast<uint32_t>(gpuCulling.getVisibleRegionSize() * currentImage) };
+
+	for (auto g = firstGroup; g < endGroup; g++)
+	{
+		auto& group = drawGroups[g];
+
+		// variant still compiling, draw with the default pipeline (same layout and render pass) or wait for it
+		auto pipeline = pipelineManager.getPipeline(group.pipelineId);
+		if (pipeline == VK_NULL_HANDLE)
+		{
+			if (deferPendingPipelines)
+			{
+				continue;
+			}
+			pipeline = pipelineManager.getPipeline(PipelineManager::DEFAULT_PIPELINE);
+		}
+
+		//bind pipeline to be used in render pas
+		if (boundPipeline != pipeline)
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			boundPipeline = pipeline;
+			stats.issued++;
+			counters.pipelineBinds++;
+		}
+		else
+		{
+			stats.skipped++;
+		}
+
+		// all meshes live in the shared geometry pool buffers
+		VkBuffer vertexBuffers[] = { geometryPool.getVertexBuffer() };		// buffers to bind
+		VkDeviceSize offsets[] = { 0 };										// offsets into buffers being bound
+		if (boundVertexBuffer != vertexBuffers[0])
+		{
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);  // command to bind vertex buffer before with them
+			boundVertexBuffer = vertexBuffers[0];
+			stats.issued++;
+			counters.vertexBufferBinds++;
+		}
+		else
+		{
+			stats.skipped++;
+		}
+
+		// bind shared index buffer, with 0 offset and uisng uint32
+		if (boundIndexBuffer != geometryPool.getIndexBuffer())
+		{
+			vkCmdBindIndexBuffer(commandBuffer, geometryPool.getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+			boundIndexBuffer = geometryPool.getIndexBuffer();
+			stats.issued++;
+			counters.indexBufferBinds++;
+		}
+		else
+		{
+			stats.skipped++;
+		}
+
+		// texture is selected per instance from the texture array
+		std::array<VkDescriptorSet, 2> descriptorSetGroup{ uniformDescriptorSet, textureDescriptorSet };
+		if (boundDescriptorSets != descriptorSetGroup)
+		{
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(descriptorSetGroup.size())
+				, descriptorSetGroup.data(),
+				static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data()); // vp uniform + object buffer + visible list region of this image
+			boundDescriptorSets = descriptorSetGroup;
+			stats.issued++;
+			counters.descriptorSetBinds++;
+		}
+		else
+		{
+			stats.skipped++;
+		}
+
+		//execute pipeline with the draws the culling pass generated for the batches of this group
+		//instances of a draw read their object through the visible list with gl_InstanceIndex (starts at firstInstance)
+		auto& groupScopes = drawGroupScopes[phase == GpuCulling::CullPhase::Early ? 0 : 1];
+		GpuProfiler::Scope scope(gpuProfiler, commandBuffer, currentImage, g < groupScopes.size() ? groupScopes[g] : GpuProfiler::INVALID_SCOPE);
+		gpuCulling.recordDraws(commandBuffer, currentImage, phase, g, group.firstBatch, group.batchCount, counters);
+	}
+}
+
+VkCommandBuffer VulkanRenderer::getSecondaryCommandBuffer(uint32_t currentImage, uint32_t threadIndex)
+{
+	auto& threadCommandPool = secondaryCommandPools[currentImage][threadIndex];
+
+	// allocate more if this thread recorded more ranges than ever before
+	if (threadCommandPool.usedBuffers == threadCommandPool.buffers.size())
+	{
+		VkCommandBufferAllocateInfo cbAllocInfo{};
+		cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cbAllocInfo.commandPool = threadCommandPool.pool;
+		cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		cbAllocInfo.commandBufferCount = 1;
+
+		VkCommandBuffer commandBuffer;
+		if (vkAllocateCommandBuffers(mainDevice.logicalDevice, &cbAllocInfo, &commandBuffer) != VK_SUCCESS)
+		{
+			return VK_NULL_HANDLE;
+		}
+		threadCommandPool.buffers.push_back(commandBuffer);
+	}
+
+	return threadCommandPool.buffers[threadCommandPool.usedBuffers++];
+}
+
 void VulkanRenderer::getPhysicalDevice()
 {
+	CPU_PROFILE_SCOPE("getPhysicalDevice");
+
 	// enumerate physical devices the vkinstance can access
 	uint32_t deviceCount = 0;
 	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
@@ -1235,6 +2367,7 @@ void VulkanRenderer::getPhysicalDevice()
 	vkEnumeratePhysicalDevices(instance, &deviceCount, deviceList.data());
 
 	//pick a suitable device
+	mainDevice.physicalDevice = VK_NULL_HANDLE;
 	for (const auto& device : deviceList)
 	{
 		if (checkDeviceSuitable(device))
@@ -1244,22 +2377,15 @@ void VulkanRenderer::getPhysicalDevice()
 		}
 	}
 
+	if (mainDevice.physicalDevice == VK_NULL_HANDLE)
+	{
+		throw std::runtime_error("can't find a gpu with the required features");
+	}
+
 	VkPhysicalDeviceProperties deviceProperties;
 	vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &deviceProperties);
-
-	//minUniformBufferOffset = deviceProperties.limits.minUniformBufferOffsetAlignment;
-
 }
 
-//void VulkanRenderer::allocateDynamicBufferTransferSpace()
-//{
-//	// calculate alignment of model data
-//	modelUniformAlignment = (sizeof(Model) + minUniformBufferOffset-1) & ~(minUniformBufferOffset - 1);
-//
-//	// cteated space in memory to hold dynamic buffer that is aligned to our required alignment and holds max_objects
-//	modelTransferSpace = (Model*)_aligned_malloc(modelUniformAlignment * MAX_OBJECTS, modelUniformAlignment);
-//}
-
 bool VulkanRenderer::checkInstanceExtensionSupport(const std::vector<const char*>& checkExtensions)
 {
 	uint32_t extensionCount = 0;
@@ -1308,7 +2434,7 @@ bool VulkanRenderer::checkDeviceExtensionSupport(VkPhysicalDevice device)
 	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
 
 	//check for extension
-	for (const auto& deviceExtension : deviceExtensions)
+	for (const auto& deviceExtension : getRequiredDeviceExtensions())
 	{
 		auto haseExtension = false;
 		for (const auto extension : extensions)
@@ -1329,6 +2455,12 @@ bool VulkanRenderer::checkDeviceExtensionSupport(VkPhysicalDevice device)
 	return true;
 }
 
+std::vector<const char*> VulkanRenderer::getRequiredDeviceExtensions() const
+{
+	// swapchain only if there is something to present to
+	return headless ? std::vector<const char*>{} : deviceExtensions;
+}
+
 bool VulkanRenderer::checkDeviceSuitable(VkPhysicalDevice device)
 {
 	//// information about the device itself
@@ -1340,17 +2472,31 @@ bool VulkanRenderer::checkDeviceSuitable(VkPhysicalDevice device)
 	VkPhysicalDeviceFeatures deviceFeatures;
 	vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
 
+	// descriptor indexing features of the bindless texture array
+	VkPhysicalDeviceVulkan12Features deviceFeatures12{};
+	deviceFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+	VkPhysicalDeviceFeatures2 deviceFeatures2{};
+	deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	deviceFeatures2.pNext = &deviceFeatures12;
+	vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
+
+	auto descriptorIndexingSupported = deviceFeatures12.runtimeDescriptorArray && deviceFeatures12.shaderSampledImageArrayNonUniformIndexing
+		&& deviceFeatures12.descriptorBindingPartiallyBound && deviceFeatures12.descriptorBindingSampledImageUpdateAfterBind
+		&& deviceFeatures12.descriptorBindingUpdateUnusedWhilePending;
+
 	auto extensionSupported = checkDeviceExtensionSupport(device);
-	auto swapChainValid = false;
+	auto swapChainValid = headless;
 	
-	if (extensionSupported)
+	if (extensionSupported && !headless)
 	{
 		SwapChainDetails swapChainDetails = getSwapChainDetails(device);
 		swapChainValid = !swapChainDetails.presentationModes.empty() && !swapChainDetails.formats.empty();
 	}
 
 	QueueFamilyIndices indices = getQueueFamilies(device);
-	return indices.isValid() && extensionSupported  && swapChainValid && deviceFeatures.samplerAnisotropy;
+	return indices.isValid() && extensionSupported  && swapChainValid && deviceFeatures.samplerAnisotropy
+		&& deviceFeatures.multiDrawIndirect && deviceFeatures.drawIndirectFirstInstance && descriptorIndexingSupported;
 }
 
 bool VulkanRenderer::checkValidationLayerSupport()
@@ -1469,7 +2615,7 @@ VkFormat VulkanRenderer::chooseSupportedFormat(const std::vector<VkFormat>& form
 	throw std::runtime_error("Failed to find a matching format!");
 }
 
-VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory& imageMemory)
+VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, MemoryAllocation& imageMemory)
 {
 	// create image
 	VkImageCreateInfo imageCreateInfo{};
@@ -1501,20 +2647,11 @@ VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat fo
 	vkGetImageMemoryRequirements(mainDevice.logicalDevice, image, &memoryRequirements);
 
 
-	// allocate memory using image requirements and user defined properties
-	VkMemoryAllocateInfo memoryAllocInfo{};
-	memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memoryAllocInfo.allocationSize = memoryRequirements.size;
-	memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(mainDevice.physicalDevice, memoryRequirements.memoryTypeBits, propFlags);
-
-	result = vkAllocateMemory(mainDevice.logicalDevice, &memoryAllocInfo, nullptr, &imageMemory);
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to allocate memory for image!");
-	}
+	// sub allocate memory using image requirements and user defined properties
+	imageMemory = allocator.allocate(memoryRequirements, propFlags, tiling == VK_IMAGE_TILING_LINEAR);
 
-	// connect memory to image
-	vkBindImageMemory(mainDevice.logicalDevice, image, imageMemory, 0);
+	// connect memory range to image
+	vkBindImageMemory(mainDevice.logicalDevice, image, imageMemory.memory, imageMemory.offset);
 
 	return image;
 }
@@ -1555,109 +2692,81 @@ VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkIm
 	//return viewCreateInfo;
 }
 
-VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& code)
-{
-	//shadermodule creation information
-	VkShaderModuleCreateInfo shaderModuleCreateInfo{};
-	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	shaderModuleCreateInfo.codeSize = code.size();
-	shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
-	
-	VkShaderModule shaderModule;
-	auto result = vkCreateShaderModule(mainDevice.logicalDevice, &shaderModuleCreateInfo, nullptr, &shaderModule);
-
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("faild to create shadermodule!");
-	}
-
-	return shaderModule;
-}
-
 int VulkanRenderer::createTextureImage(const std::string& filename)
 {
 	int width, height;
 	VkDeviceSize imageSize;
 	stbi_uc* imageData = loadTextureFile(filename, width, height, imageSize);
 
+	auto textureImageLoc = createTextureImage(imageData, static_cast<uint32_t>(width), static_cast<uint32_t>(height));
 
-	//create staging buffer to hold loaded data, ready to copy to device
-	VkBuffer imageStagingBuffer;
-	VkDeviceMemory imageStagingBufferMemory;
-	createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, imageStagingBuffer, imageStagingBufferMemory);
-
-	void *data;
-	vkMapMemory(mainDevice.logicalDevice, imageStagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, imageData, static_cast<size_t>(imageSize));
-	vkUnmapMemory(mainDevice.logicalDevice, imageStagingBufferMemory);
-
-	//Free original image data
+	//Free original image data (already copied to staging memory)
 	stbi_image_free(imageData);
 
+	return textureImageLoc;
+}
+
+int VulkanRenderer::createTextureImage(const unsigned char* pixels, uint32_t width, uint32_t height)
+{
+	VkDeviceSize imageSize = static_cast<VkDeviceSize>(width) * height * 4;
 
 	// create image to hold final data
 	VkImage texImage;
-	VkDeviceMemory texImageMemory;
+	MemoryAllocation texImageMemory;
 
 	texImage = createImage(width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
 		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texImageMemory);
 	
-	// copy data to image
-	
-	// transition image to be dst for copy operation
-	transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, texImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-	// copy image data
-	copyImageBuffer(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, imageStagingBuffer, texImage, width, height);
-
-	//transition image to be shader readable for shader usage
-	transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, texImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	// stage pixel data and record layout transitions + copy into the current upload batch
+	// image is shader readable once the batch has completed
+	uploadContext.uploadImage(texImage, pixels, imageSize, width, height);
+	uploadsPending = true;
 
 	// add texture data to vector for reference
 	textureImages.push_back(texImage);
 	textureImageMemory.push_back(texImageMemory);
 
-	// destroy stating buffers
-	vkDestroyBuffer(mainDevice.logicalDevice, imageStagingBuffer, nullptr);
-	vkFreeMemory(mainDevice.logicalDevice, imageStagingBufferMemory, nullptr);
-
 	return static_cast<int>(textureImages.size()) - 1;
 }
 
 int VulkanRenderer::createTexture(const std::string& filename)
 {
+	CPU_PROFILE_SCOPE("createTexture");
+
 	//create texture image and get its location in the array
-	auto textureImageLoc = createTextureImage(filename);
+	return createTextureFromImage(createTextureImage(filename));
+}
+
+int VulkanRenderer::createTexture(const unsigned char* pixels, uint32_t width, uint32_t height)
+{
+	CPU_PROFILE_SCOPE("createTexture");
 
+	return createTextureFromImage(createTextureImage(pixels, width, height));
+}
+
+uint32_t VulkanRenderer::getTextureCapacity() const
+{
+	return textureCapacity;
+}
+
+int VulkanRenderer::createTextureFromImage(int textureImageLoc)
+{
 	// create image view and add to list
 	VkImageView imageView = createImageView(textureImages[textureImageLoc], VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
 	textureImageViews.push_back(imageView);
 
-	//create descriptor set
+	//add to the texture array
 	auto descriptorLoc = createTextureDescriptor(imageView);
 
-	//return location of set with texture
+	//return index of the texture in the array
 	return descriptorLoc;
 }
 
 int VulkanRenderer::createTextureDescriptor(VkImageView textureImage)
 {
-	
-	// descriptorset allocation info
-	VkDescriptorSetAllocateInfo setAllocInfo{};
-	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	setAllocInfo.descriptorPool = samplerDescriptorPool;
-	setAllocInfo.descriptorSetCount = 1;
-	setAllocInfo.pSetLayouts = &samplerSetLayout;
-
-	VkDescriptorSet descriptorSet;
-
-	//allocate descriptor sets
-	auto result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, &descriptorSet);
-	if (result != VK_SUCCESS)
+	if (textureCount >= textureCapacity)
 	{
-		throw std::runtime_error("Failed to allocate texture descriptor sets!");
+		throw std::runtime_error("Texture descriptor array is full!");
 	}
 
 	//texture image info
@@ -1666,24 +2775,21 @@ int VulkanRenderer::createTextureDescriptor(VkImageView textureImage)
 	imageInfo.imageView = textureImage;			// image to bind to set
 	imageInfo.sampler = textureSampler;			// sampler to bind to set
 
-	// descriptor write info
+	// descriptor write info, next free element of the texture array
 	VkWriteDescriptorSet descriptorWrite{};
 	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrite.dstSet = descriptorSet;
+	descriptorWrite.dstSet = textureDescriptorSet;
 	descriptorWrite.dstBinding = 0;
-	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.dstArrayElement = textureCount;
 	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	descriptorWrite.descriptorCount = 1;
 	descriptorWrite.pImageInfo = &imageInfo;
 
-	// update new descriptor set
+	// update after bind, recorded command buffers stay valid
 	vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &descriptorWrite, 0, nullptr);
 
-	// add descriptor set to list
-	samplerDescriptorSets.push_back(descriptorSet);
-
-	// return descriptor set location
-	return samplerDescriptorSets.size() - 1;
+	// return texture index used by shader.frag
+	return static_cast<int>(textureCount++);
 }
 
 QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice device)
@@ -1707,8 +2813,16 @@ QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice device)
 			indices.graphicsFamily = i; // if queue family is valid, then get the index
 		}
 
+		// headless "presents" on the graphics queue
 		VkBool32 presentationSupport = false;
-		auto result = vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
+		if (headless)
+		{
+			presentationSupport = indices.graphicsFamily == static_cast<int>(i);
+		}
+		else
+		{
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
+		}
 
 		if (queueFamily.queueCount > 0 && presentationSupport)
 		{
@@ -1721,6 +2835,31 @@ QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice device)
 		}
 	}
 
+	// prefer a transfer only family (dma engine), then any non graphics family that can transfer
+	// graphics families always support transfer, so fall back to the graphics queue
+	indices.transferFamily = indices.graphicsFamily;
+	auto foundAsyncCompute = false;
+	for (auto i = 0ul; i < queueFamilyCount; i++)
+	{
+		auto& queueFamily = queueFamilyList[i];
+		if (queueFamily.queueCount == 0 || !(queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) || queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		{
+			continue;
+		}
+
+		if (!(queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT))
+		{
+			indices.transferFamily = i;
+			break;
+		}
+
+		if (!foundAsyncCompute)
+		{
+			indices.transferFamily = i;
+			foundAsyncCompute = true;
+		}
+	}
+
 	return indices;
 }
 
@@ -1770,7 +2909,7 @@ stbi_uc* VulkanRenderer::loadTextureFile(const std::string& filename, int& width
 	int channels;
 
 	//load pixel data for image
-	std::string fileloc = "C:/Projects/Vulkan/VulkanTest/Textures/" + filename;
+	std::string fileloc = std::string(PROJ_DIR) + "/Textures/" + filename;
 	stbi_uc* image = stbi_load(fileloc.c_str(), &width, &height, &channels, STBI_rgb_alpha);
 
 	if (!image)
@@ -9,10 +9,28 @@
 #include <set>
 #include <algorithm>
 #include <array>
+#include <limits>
+#include <chrono>
+#include <unordered_map>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "Mesh.h"
+#include "MemoryAllocator.h"
+#include "UniformRingBuffer.h"
+#include "ThreadPool.h"
+#include "GpuCulling.h"
+#include "HiZPyramid.h"
+#include "PipelineCache.h"
+#include "PipelineManager.h"
+#include "GpuProfiler.h"
+#include "CpuProfiler.h"
+#include "FrameStats.h"
+#include "ShaderLibrary.h"
+#include "DrawSort.h"
+#include "FrustumCuller.h"
+#include "Bvh.h"
+#include "SoftwareOcclusion.h"
 #include "../Thirdparty/stb_image.h"
 
 class VulkanRenderer
@@ -23,20 +41,155 @@ public:
 
 	int init(GLFWwindow* newWindw);
 
+	// offscreen target of the headless mode, images are rendered round robin like swapchain images
+	struct HeadlessSettings
+	{
+		uint32_t width = 1280;
+		uint32_t height = 720;
+		VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;		// needs color attachment support
+		uint32_t imageCount = 3;
+	};
+
+	// render without window, surface or swapchain (no glfwInit needed), e.g. on a software device like lavapipe
+	// frames end in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL instead of being presented
+	int initHeadless(const HeadlessSettings& settings);
+	bool isHeadless() const;
+
 	void updateModel(int modelId, glm::mat4 newModel);
+	// OBJECT_FLAG_* of an object, takes effect the next frame
+	void setModelFlags(int modelId, uint32_t flags);
+
+	// texture from an image file in PROJ_DIR/Textures or from tightly packed rgba8 pixels, returns its texture id
+	// throws if the texture array is full (getTextureCapacity)
+	int createTexture(const std::string& filename);
+	int createTexture(const unsigned char* pixels, uint32_t width, uint32_t height);
+	uint32_t getTextureCapacity() const;
+
+	// object with new geometry, returns its model id, geometry and textures are uploaded before the next frame
+	int addMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, int textureId, glm::mat4 newModel);
+	void setModelTexture(int modelId, int textureId);
+
+	// view and perspective projection of the next frames
+	void setCamera(const glm::mat4& view, float fovY, float nearPlane, float farPlane);
+
+	// another object drawing the geometry and texture of an existing mesh, returns its model id (-1 if meshId is invalid)
+	// objects sharing geometry and texture are drawn with one instanced draw
+	int addMeshInstance(int meshId, glm::mat4 newModel);
 
 	void draw();
 	void cleanup();
 
+	// state binds of the last command buffer recording, skipped = requested but already bound
+	struct BindStats
+	{
+		uint32_t issued = 0;
+		uint32_t skipped = 0;
+	};
+
+	BindStats getBindStats() const;
+
+	// frustum test on the cpu before the object buffer is written, with None only cull.comp tests
+	enum class CpuCulling
+	{
+		None,
+		Flat,		// every object, SIMD
+		Bvh			// hierarchical through the scene bvh (default)
+	};
+
+	void setCpuCulling(CpuCulling mode);
+
+	// gpu occlusion test against the depth pyramid of the previous frame / early draws (on by default)
+	void setOcclusionCulling(bool enabled);
+
+	// low poly occluder geometry of a model (model space triangle list), rasterized with the model transform by the cpu occlusion test
+	void setModelOccluder(int modelId, const std::vector<glm::vec3>& vertices, const std::vector<uint32_t>& indices);
+
+	// cull objects behind the occluders on the cpu before the object buffer is written, no gpu readback (off by default)
+	void setSoftwareOcclusion(bool enabled);
+	const SoftwareOcclusion::Timings& getSoftwareOcclusionTimings() const;
+	void dumpSoftwareOcclusionBuffer(const std::string& filename) const;
+
+	// render state of an object, variants are compiled in the background, the object is drawn with the default
+	// pipeline (or not at all with setDeferPendingPipelines) until its variant is ready, at most 16 variants
+	void setModelPipeline(int modelId, const PipelineState& state);
+	void setDeferPendingPipelines(bool defer);
+
+	struct PipelineStats
+	{
+		PipelineManager::Stats compile;
+		uint32_t fallbackGroups = 0;		// draw groups of the last recording drawn with the default pipeline
+		uint32_t deferredGroups = 0;		// draw groups of the last recording skipped
+		double lastFrameMs = 0.0;			// cpu time of the last draw call
+		double longestFrameMs = 0.0;		// longest draw call since the last variant request
+	};
+
+	PipelineStats getPipelineStats() const;
+
+	// gpu time of the culling, depth pyramid and render passes of recent frames (averages, p99, csv / json dumps)
+	const GpuProfiler& getGpuProfiler() const;
+
+	// also time every draw group of both render passes, adds two timestamps per group (off by default)
+	void setGpuDrawGroupTiming(bool enabled);
+
+	// counters of the last FrameStatsWindow::WINDOW_SIZE draw calls, always kept
+	FrameStats getFrameStats() const;
+	void resetFrameStats();
+	const FrameCounters& getLastFrameCounters() const;
+
+	// closest object whose world box is hit by the ray, -1 if none
+	int pickModel(const glm::vec3& origin, const glm::vec3& direction, float maxDistance);
+
+	// objects whose world box overlaps region
+	void queryModels(const BoundingBox& region, std::vector<int>& modelIds);
+
 private:
-	GLFWwindow* window;
+	GLFWwindow* window = nullptr;
 	int currentFrame = 0;
 
+	// no surface / swapchain, swapChainImages are offscreen images
+	bool headless = false;
+	HeadlessSettings headlessSettings;
+	std::vector<MemoryAllocation> offscreenImageMemory;
+	uint32_t offscreenImageIndex = 0;
+
 
 	// scene objects
 	//Mesh firstMesh;
 	std::vector<Mesh> meshList;
 
+	// meshes with the same geometry, drawn with one instanced draw, texture is picked per instance
+	struct DrawBatch
+	{
+		GeometryRange geometry;
+		uint32_t pipelineId;
+		uint32_t firstInstance;		// first object of the batch in the object buffer
+		uint32_t instanceCount;
+	};
+
+	// consecutive batches drawn with one indirect draw, groups are split over the recording threads
+	struct DrawGroup
+	{
+		uint32_t firstBatch;
+		uint32_t batchCount;
+		uint32_t pipelineId;		// PipelineManager id of all batches of the group
+	};
+
+	std::vector<DrawBatch> drawBatches;
+	std::vector<DrawGroup> drawGroups;
+	std::vector<CullBatch> cullBatches;		// drawBatches as read by the culling pass
+	std::vector<uint32_t> drawOrder;		// mesh index of every object buffer entry, instances of a batch are contiguous
+	std::vector<uint32_t> objectBatches;	// batch index of every object buffer entry
+	bool drawBatchesDirty = true;
+
+	// draw order by DrawSort key, instances within a batch are sorted front to back
+	DrawSorter drawSorter;
+	std::vector<uint64_t> drawKeys;
+	std::vector<uint32_t> meshGeometryIds;	// dense geometry id of every mesh, key field
+	std::vector<uint32_t> meshPipelineIds;	// PipelineManager id of every mesh, key field
+	bool drawOrderUnsorted = true;			// objects or camera moved or textures changed, the keys are outdated
+
+	BindStats bindStats;
+
 	// scene settings
 	struct UboViewProjection
 	{
@@ -51,19 +204,55 @@ private:
 		VkDevice logicalDevice;
 	} mainDevice;
 
+	// sub allocates all buffer and image memory
+	MemoryAllocator allocator;
+
+	// shader modules of all pipelines, by content
+	ShaderLibrary shaderLibrary;
+
+	// compiled pipelines of earlier runs, saved at cleanup
+	PipelineCache pipelineCache;
+	static inline constexpr const char* PIPELINE_CACHE_FILE = "pipeline_cache.bin";
+
+	// batches buffer / image uploads into single submits
+	UploadContext uploadContext;
+
+	// shared vertex / index buffers of all meshes
+	GeometryPool geometryPool;
+	bool uploadsPending = false;		// meshes or textures recorded into uploadContext since the last flush
+
 
 	// main components
 	VkQueue graphicsQueue;
 	VkQueue presentationQueue;
-	VkSurfaceKHR surface;
-	VkSwapchainKHR swapchain;
+	VkQueue transferQueue;			// dedicated transfer queue if available, otherwise the graphics queue
+	VkSurfaceKHR surface = VK_NULL_HANDLE;
+	VkSwapchainKHR swapchain = VK_NULL_HANDLE;
 
 	std::vector<SwapChainImage> swapChainImages;
 	std::vector<VkFramebuffer> swapChainFramebuffers;
 	std::vector<VkCommandBuffer> commandBuffers;
+	std::vector<bool> commandBufferDirty;				// command buffer of the image has to be re-recorded before the next submit
+	std::vector<uint32_t> recordedUniformOffsets;		// vp dynamic offset baked into each command buffer
+	std::vector<uint32_t> recordedFrustumOffsets;		// frustum dynamic offset baked into each command buffer
+	std::vector<CommandCounters> recordedCounters;		// commands of each command buffer, counted while recording
+
+	// draws are recorded in parallel into secondary command buffers
+	static inline constexpr const uint32_t MIN_DRAWS_PER_SECONDARY = 4;			// draw groups
+	static inline constexpr const uint32_t BATCHES_PER_DRAW_GROUP = 1024;
+
+	struct ThreadCommandPool
+	{
+		VkCommandPool pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> buffers;		// secondary command buffers allocated from pool
+		uint32_t usedBuffers = 0;					// handed out since the last pool reset
+	};
+
+	ThreadPool threadPool;
+	std::vector<std::vector<ThreadCommandPool>> secondaryCommandPools;	// [image][thread]
 
 	VkImage depthBufferImage;
-	VkDeviceMemory depthBufferMemory;
+	MemoryAllocation depthBufferMemory;
 	VkImageView depthBufferImageView;
 	VkFormat depthBufferFormat;
 
@@ -72,33 +261,107 @@ private:
 	// - Descriptors
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkDescriptorSetLayout samplerSetLayout;
-	VkPushConstantRange pushConstantRange;
-
-	std::vector<VkBuffer> vpUniformBuffers;
-	std::vector<VkDeviceMemory> vpUniformBufferMemory;
 
-	std::vector<VkBuffer> modelDynUniformBuffers;
-	std::vector<VkDeviceMemory> modelDynUniformBufferMemory;
+	// per frame constants, one region per swapchain image
+	UniformRingBuffer uniformRing;
+	uint32_t vpUniformOffset = 0;		// dynamic offset of this frame's view projection
+	uint32_t frustumUniformOffset = 0;	// dynamic offset of this frame's culling frustum
+
+	// objects are culled on the cpu every frame
+	// visible objects are passed to cull.comp as OBJECT_FLAG_FRUSTUM_VISIBLE, the others as OBJECT_FLAG_HIDDEN
+	CpuCulling cpuCulling = CpuCulling::Bvh;
+	FrustumCuller frustumCuller;				// world space bounding spheres in object buffer order
+	std::vector<uint32_t> cpuVisibleObjects;	// CpuCulling::Flat: object buffer indices, CpuCulling::Bvh: model ids
+	std::vector<uint8_t> objectVisibility;		// per object buffer entry
+	std::vector<uint32_t> objectSlots;			// object buffer index of every model id
+
+	// world boxes of all models (primitive id = model id), rebuilt when models are added, refit when they move
+	Bvh sceneBvh;
+	bool sceneBvhDirty = true;
+
+	// occluders rasterized on the cpu, objects behind them are passed as OBJECT_FLAG_HIDDEN
+	struct OccluderMesh
+	{
+		int modelId;
+		std::vector<glm::vec3> vertices;
+		std::vector<uint32_t> indices;
+	};
+
+	SoftwareOcclusion softwareOcclusion;
+	std::vector<OccluderMesh> occluderMeshes;
+	std::vector<BoundingBox> occludeeBoxes;		// per object buffer entry, only set for frustum visible ones
+	bool softwareOcclusionEnabled = false;
+
+	// frustum / occlusion culling and indirect draw generation
+	GpuCulling gpuCulling;
+	bool drawIndirectCountSupported = false;
+
+	// farthest depth pyramid, built from the early draws for the late culling phase
+	// and from the finished frame for the early culling phase of the next one
+	HiZPyramid hiZPyramid;
+	bool occlusionCulling = true;
+	bool occlusionHistoryValid = false;			// a frame was drawn, the pyramid holds its depth
+	glm::mat4 previousViewProjection{ 1.f };	// view projection the pyramid of the previous frame was drawn with
+
+	static inline constexpr const uint32_t INITIAL_OBJECT_CAPACITY = 1024;
+	static inline constexpr const uint32_t OBJECTS_PER_WRITE_TASK = 16384;		// object buffer is written in parallel in chunks of this size
+
+	// per object data (ObjectData), one region per swapchain image, indexed through the visible list with gl_InstanceIndex
+	// written every frame, so moving objects does not require re-recording
+	VkBuffer objectBuffer;
+	MemoryAllocation objectBufferMemory;
+	VkDeviceSize objectRegionSize = 0;
+	uint32_t objectCapacity = 0;
+	uint32_t maxObjectCapacity = 0;		// limited by maxStorageBufferRange and 32 bit dynamic offsets
 
 	VkDescriptorPool descriptorPool;
 	VkDescriptorPool samplerDescriptorPool;
-	std::vector<VkDescriptorSet> descriptorSets;
-	std::vector<VkDescriptorSet> samplerDescriptorSets;
-	/*
-		VkDeviceSize minUniformBufferOffset;
-		size_t modelUniformAlignment;*/
+	VkDescriptorSet uniformDescriptorSet;	// same set for all frames, frame data selected by dynamic offset
 
-	//Model* modelTransferSpace;
+	// every texture is one element of a single update after bind array, bound once per command buffer
+	static inline constexpr const uint32_t MAX_TEXTURES = 4096;
+	VkDescriptorSet textureDescriptorSet;
+	uint32_t textureCapacity = 0;		// MAX_TEXTURES clamped to the device limits
+	uint32_t textureCount = 0;
 
 	//Assets
 	std::vector<VkImage> textureImages;
-	std::vector<VkDeviceMemory> textureImageMemory; //  could use one with offsets
+	std::vector<MemoryAllocation> textureImageMemory;
 	std::vector<VkImageView> textureImageViews;
 
 	// pipeline
-	VkPipeline graphicsPipeline;
+	PipelineManager pipelineManager;		// graphics pipeline variants, the default one is created in init
+	VkShaderModule vertexShaderModule;		// shared by all variants, owned by shaderLibrary
+	VkShaderModule fragmentShaderModule;
 	VkPipelineLayout pipelineLayout;
-	VkRenderPass renderPass;
+	bool deferPendingPipelines = false;
+	PipelineStats pipelineStats;
+
+	// timestamps around the passes of every recording, per draw group if enabled
+	GpuProfiler gpuProfiler;
+	struct GpuScopes
+	{
+		uint32_t frame;
+		uint32_t earlyCull;
+		uint32_t earlyPass;
+		uint32_t earlyHiZ;
+		uint32_t lateCull;
+		uint32_t latePass;
+		uint32_t lateHiZ;
+	} gpuScopes;
+	bool gpuDrawGroupTiming = false;
+
+	// counters of the draw call in progress, pushed to the window when it ends
+	FrameCounters frameCounters;
+	FrameCounters lastFrameCounters;
+	FrameStatsWindow frameStatsWindow;
+	uint64_t lastUploadedBytes = 0;			// upload / allocator totals at the end of the last draw call
+	uint64_t lastAllocations = 0;
+	uint64_t lastBlockAllocations = 0;
+	std::array<std::vector<uint32_t>, 2> drawGroupScopes;		// [phase][group], registered before the parallel recording
+
+	VkRenderPass renderPass;		// early draws, clears the attachments
+	VkRenderPass lateRenderPass;	// late draws on top of the early ones, compatible with renderPass
 
 	// pools
 	VkCommandPool graphicsCommandPool;
@@ -111,20 +374,26 @@ private:
 	std::vector<VkSemaphore> imageAvailable;
 	std::vector<VkSemaphore> renderFinished;
 	std::vector<VkFence> drawFences;
+	std::vector<VkFence> imagesInFlight;	// draw fence of the frame last using each swapchain image
 
 	// vulkan functions
 	//================================================
 	
+	// shared part of init and initHeadless
+	int initRenderer();
+
 	// Create functions
 	void createInstance();
 	void createLogicalDevice();
 	void createSurface();
 	void createSwapChain();
+	void createOffscreenImages();
 	void createRenderPass();
 	void createDescriptorSetLayout();
-	void createPushConstantRange();
 	void createGraphicsPipeline();
+	VkResult buildGraphicsPipeline(const PipelineState& state, VkPipeline& pipeline);		// thread safe
 	void createDepthBufferImage();
+	void createDepthPyramid();
 	void createFramebuffers();
 	void createCommandPool();
 	void createCommandBuffers();
@@ -132,6 +401,7 @@ private:
 	void createTextureSampler();
 	
 	void createUniformBuffers();
+	void createObjectBuffer(uint32_t capacity);
 	void createDescriptorPool();
 	void createDescriptorSets();
 
@@ -139,22 +409,35 @@ private:
 
 
 	void updateUniformBuffers(uint32_t imageIndex);
+	void updateObjectDescriptor();
+
+	// grow object and culling buffers to fit the scene
+	void ensureObjectCapacity();
+
+	// scene content changed (meshes, textures, buffers), all command buffers are recorded again
+	void markCommandBuffersDirty();
+
+	// group meshList into drawBatches
+	void buildDrawBatches();
+	void sortDrawOrder();
+	void updateSceneBvh();
 
 	// record functions
 	void recordCommands(uint32_t currentImage);
+	void recordDraws(VkCommandBuffer commandBuffer, uint32_t currentImage, GpuCulling::CullPhase phase, uint32_t firstGroup, uint32_t endGroup, BindStats& stats,
+		CommandCounters& counters);
+	VkCommandBuffer getSecondaryCommandBuffer(uint32_t currentImage, uint32_t threadIndex);
 
 	// get functions
 	void getPhysicalDevice();
 
-	//allocate functions
-	void allocateDynamicBufferTransferSpace();
-
 
 	// Support functions
 
 	// checkfunctions
 	bool checkInstanceExtensionSupport(const std::vector<const char*>& checkExtensions);
 	bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+	std::vector<const char*> getRequiredDeviceExtensions() const;
 	bool checkDeviceSuitable(VkPhysicalDevice device);
 
 	bool checkValidationLayerSupport();
@@ -165,12 +448,12 @@ private:
 	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& surfaceCapabilities);
 	VkFormat chooseSupportedFormat(const std::vector<VkFormat>& formats, VkImageTiling tiling, VkFormatFeatureFlags featureFlags);
 
-	VkImage createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory& imageMemory);
+	VkImage createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, MemoryAllocation& imageMemory);
 	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
-	VkShaderModule createShaderModule(const std::vector<char>& code);
 
 	int createTextureImage(const std::string& filename);
-	int createTexture(const std::string& filename);
+	int createTextureImage(const unsigned char* pixels, uint32_t width, uint32_t height);
+	int createTextureFromImage(int textureImageLoc);		// view and descriptor, returns the texture id
 	int createTextureDescriptor(VkImageView textureImage);
 
 	//getter functions
@@ -1,7 +1,6 @@
 #include <iostream>
 
 #define STB_IMAGE_IMPLEMENTATION
-#define GLM_FORCE_DEPTH_ZERO_TO_ONE
 
 //auto include vulkan
 #define GLFW_INCLUDE_VULKAN
@@ -13,6 +12,8 @@
 #include <glm/mat4x4.hpp>
 #include "VulkanRenderer.h"
 
+#include <cctype>
+#include <cstdio>
 #include <stdexcept>
 #include <vector>
 
@@ -31,26 +32,104 @@ void initWindow(const std::string& wName = "Test Window", const int width = 800,
 	window = glfwCreateWindow(width, height, wName.c_str(), nullptr, nullptr);
 }
 
-int main()
+int main(int argc, char** argv)
 {
-	initWindow("Test Window", 800, 600);
+	// --headless [frames]: render offscreen without window or display, a fixed number of frames
+	// --trace file: write the cpu scopes as a chrome trace on exit
+	auto headless = false;
+	auto headlessFrames = 1000ul;
+	std::string traceFile;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--headless")
+		{
+			headless = true;
+			if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+			{
+				headlessFrames = std::stoul(argv[++i]);
+			}
+		}
+		else if (arg == "--trace" && i + 1 < argc)
+		{
+			traceFile = argv[++i];
+		}
+	}
 
 	// create vulkan renderer instance
-	if (vulkanRenderer.init(window) == EXIT_FAILURE)
+	if (headless)
+	{
+		if (vulkanRenderer.initHeadless(VulkanRenderer::HeadlessSettings{}) == EXIT_FAILURE)
+		{
+			return EXIT_FAILURE;
+		}
+	}
+	else
+	{
+		initWindow("Test Window", 800, 600);
+
+		if (vulkanRenderer.init(window) == EXIT_FAILURE)
+		{
+			return EXIT_FAILURE;
+		}
+	}
+
+	// two quads, textures from PROJ_DIR/Textures
+	std::vector<Vertex> meshVertices =
 	{
+		{{-0.4, 0.4, 0.0}, {1.f, 0.f, 0.f}, {1.f, 1.f}}, //0
+		{{-0.4, -0.4, 0.0}, {1.f, 0.f, 0.f}, {1.f,0.f}} , //1
+		{{0.4, -0.4, 0.0}, {1.f, 0.f, 0.f}, {0.f, 0.f}}, //2
+		{{0.4, 0.4, 0.0}, {1.f, 0.f, 0.f}, {0.f, 1.f}} , //3
+	};
+
+	std::vector<Vertex> meshVertices2 =
+	{
+		{{-0.4, 0.25, 0.0}, {0.f, 1.f, 0.f}, {1.f, 1.f}}, //0
+		{{-0.4, -0.25, 0.0}, {0.f, 1.f, 0.f}, {1.f, 0.f}} , //1
+		{{0.4, -0.25, 0.0}, {0.f, 1.f, 0.f}, {0.f, 0.f}}, //2
+		{{0.4, 0.25, 0.0}, {0.f, 1.f, 0.f}, {0.f, 1.f}} , //3
+	};
+
+	// index data
+	std::vector<uint32_t> meshIndices = {
+		0, 1, 2,
+		2 ,3, 0
+	};
+
+	try
+	{
+		vulkanRenderer.addMesh(meshVertices, meshIndices, vulkanRenderer.createTexture("peepo.jpg"), glm::mat4(1.f));
+		vulkanRenderer.addMesh(meshVertices2, meshIndices, vulkanRenderer.createTexture("peepo2.jpg"), glm::mat4(1.f));
+	}
+	catch (const std::runtime_error& e)
+	{
+		printf("ERROR: %s\n", e.what());
+		vulkanRenderer.cleanup();
 		return EXIT_FAILURE;
 	}
 
 	float angle = 0.f;
 	float deltaTime = 0.f;
 	float lastTime = 0.f;
+	unsigned long frame = 0;
 
 	//loop until close
-	while (!glfwWindowShouldClose(window))
+	while (headless ? frame < headlessFrames : !glfwWindowShouldClose(window))
 	{
-		glfwPollEvents();
+		float now;
+		if (headless)
+		{
+			// fixed 60 fps steps, every run draws the same frames
+			now = frame / 60.f;
+		}
+		else
+		{
+			glfwPollEvents();
+			now = glfwGetTime();
+		}
+		frame++;
 
-		float now = glfwGetTime();
 		deltaTime = now - lastTime;
 		lastTime = now;
 
@@ -78,6 +157,16 @@ int main()
 
 	vulkanRenderer.cleanup();
 
+	if (!traceFile.empty())
+	{
+		CpuProfiler::writeChromeTrace(traceFile);
+	}
+
+	if (headless)
+	{
+		return 0;
+	}
+
 	//destroy glfw window and stop glfw
 	glfwDestroyWindow(window);
 	glfwTerminate();
@@ -1,13 +1,16 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 // out location 0 is differnt to in location
 layout(location = 0) out vec4 outColor; //final out put color 
 layout(location = 0) in vec3 fragCol;
 layout(location = 1) in vec2 fragTex;
+layout(location = 2) flat in uint fragTexIndex;
 
-layout(set=1, binding=0) uniform sampler2D textureSampler;
+// all textures, index differs between instances of one draw
+layout(set=1, binding=0) uniform sampler2D textures[];
 
 void main()
 {
-	outColor = texture(textureSampler, fragTex);
+	outColor = texture(textures[nonuniformEXT(fragTexIndex)], fragTex);
 }
\ No newline at end of file
@@ -9,22 +9,35 @@ layout(binding = 0) uniform UboViewProjection{
 	mat4 view;
 } uboViewProjection;
 
-// legacy not in use
-//layout(binding = 1) uniform UboModel{
-//	mat4 model;
-//} uboModel;
-
-layout(push_constant) uniform PushModel{
+struct ObjectData{
 	mat4 model;
-}pushModel;
+	vec4 boundingSphere;
+	uint batchIndex;
+	uint textureIndex;
+	uint flags;
+	uint padding0;
+};
+
+// data of all objects
+layout(std430, binding = 1) readonly buffer ObjectBuffer{
+	ObjectData objects[];
+} objectBuffer;
+
+// objects that passed culling, instances of a draw start at its firstInstance
+layout(std430, binding = 2) readonly buffer VisibleBuffer{
+	uint visibleObjects[];
+} visibleBuffer;
 
 layout(location = 0) out vec3 fragCol;
 layout(location = 1) out vec2 fragTex;
+layout(location = 2) flat out uint fragTexIndex;
 
 void main()
 {
-	gl_Position = uboViewProjection.projection * uboViewProjection.view * pushModel.model * vec4(pos, 1.f);
+	ObjectData object = objectBuffer.objects[visibleBuffer.visibleObjects[gl_InstanceIndex]];
+	gl_Position = uboViewProjection.projection * uboViewProjection.view * object.model * vec4(pos, 1.f);
 	
 	fragCol = col;
 	fragTex = tex;
+	fragTexIndex = object.textureIndex;
 }
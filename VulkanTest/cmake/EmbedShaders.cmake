@@ -0,0 +1,40 @@
+# writes OUTPUT, a c++ source with the spir-v files of SHADERS (separated by |) as byte arrays
+# and getEmbeddedShaders (ShaderLibrary.h) returning a table of them
+# run as cmake -DOUTPUT=... -DSHADERS=... -P EmbedShaders.cmake
+
+string(REPLACE "|" ";" SHADERS "${SHADERS}")
+
+set(ARRAYS "")
+set(ENTRIES "")
+set(SHADER_INDEX 0)
+
+foreach(SHADER ${SHADERS})
+	get_filename_component(SHADER_NAME ${SHADER} NAME)
+	file(READ ${SHADER} SHADER_HEX HEX)
+	string(LENGTH "${SHADER_HEX}" SHADER_HEX_LENGTH)
+	math(EXPR SHADER_SIZE "${SHADER_HEX_LENGTH} / 2")
+
+	# 0xab, per byte, 16 bytes per line
+	string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," SHADER_BYTES "${SHADER_HEX}")
+	string(REGEX REPLACE "(0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,)" "\\1\n\t" SHADER_BYTES "${SHADER_BYTES}")
+
+	string(APPEND ARRAYS "// ${SHADER_NAME}\nalignas(uint32_t) static const unsigned char shader${SHADER_INDEX}[] =\n{\n\t${SHADER_BYTES}\n};\n\n")
+	string(APPEND ENTRIES "\t{ \"${SHADER_NAME}\", shader${SHADER_INDEX}, ${SHADER_SIZE} },\n")
+
+	math(EXPR SHADER_INDEX "${SHADER_INDEX} + 1")
+endforeach()
+
+set(CONTENT "// generated by EmbedShaders.cmake from the compiled shaders, do not edit\n\n#include \"ShaderLibrary.h\"\n\n#include <cstdint>\n\n")
+
+string(APPEND CONTENT "${ARRAYS}static const EmbeddedShader embeddedShaders[] =\n{\n${ENTRIES}};\n\n")
+string(APPEND CONTENT "const EmbeddedShader* getEmbeddedShaders(size_t& count)\n{\n\tcount = sizeof(embeddedShaders) / sizeof(embeddedShaders[0]);\n\treturn embeddedShaders;\n}\n")
+
+# unchanged shaders leave the source untouched, nothing is recompiled
+if(EXISTS ${OUTPUT})
+	file(READ ${OUTPUT} OLD_CONTENT)
+	if(OLD_CONTENT STREQUAL CONTENT)
+		return()
+	endif()
+endif()
+
+file(WRITE ${OUTPUT} "${CONTENT}")